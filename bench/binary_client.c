@@ -0,0 +1,169 @@
+#include "binary_client.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+struct BinaryClient {
+    int fd;
+    char *request;
+    size_t request_len;
+    char *reply;          // Received bytes; the current reply starts at 0
+    size_t reply_len;
+    size_t reply_cap;
+    size_t consumed;      // Length of the reply handed out last
+};
+
+int binary_append_command(char **out, size_t *out_len, unsigned opcode, int argc, const char **argv,
+                          const size_t *lens) {
+    size_t body = 0;
+    for (int i = 0; i < argc; i++) {
+        body += 4 + lens[i] + 1;
+    }
+    char *grown = realloc(*out, *out_len + BINARY_HEADER_SIZE + body);
+    if (!grown) {
+        return -1;
+    }
+    *out = grown;
+
+    char *p = *out + *out_len;
+    p[0] = (char)BINARY_MAGIC;
+    p[1] = BINARY_VERSION;
+    binary_put_u16(p + 2, (uint16_t)opcode);
+    binary_put_u32(p + 4, (uint32_t)argc);
+    binary_put_u32(p + 8, (uint32_t)body);
+    p += BINARY_HEADER_SIZE;
+    for (int i = 0; i < argc; i++) {
+        binary_put_u32(p, (uint32_t)lens[i]);
+        p += 4;
+    }
+    for (int i = 0; i < argc; i++) {
+        memcpy(p, argv[i], lens[i]);
+        p += lens[i];
+        *p++ = '\0';
+    }
+    *out_len += BINARY_HEADER_SIZE + body;
+    return 0;
+}
+
+long binary_decode_reply(const char *buf, size_t len, BinaryReply *reply) {
+    long total = binary_reply_length(buf, len);
+    if (total <= 0) {
+        return total;
+    }
+
+    memset(reply, 0, sizeof(*reply));
+    reply->type = buf[0];
+    switch (buf[0]) {
+    case ':':
+        reply->integer = (long long)binary_get_u64(buf + 1);
+        break;
+    case ',': {
+        uint64_t bits = binary_get_u64(buf + 1);
+        memcpy(&reply->number, &bits, sizeof(bits));
+        break;
+    }
+    case '#':
+        reply->integer = buf[1] != 0;
+        break;
+    case '_':
+        break;
+    default:
+        // Strings and aggregates: a u32 length or count, then the contents
+        reply->length = binary_get_u32(buf + 1);
+        reply->data = buf + 5;
+        break;
+    }
+    return total;
+}
+
+BinaryClient *binary_client_connect(const char *host, int port) {
+    BinaryClient *client = calloc(1, sizeof(BinaryClient));
+    if (!client) {
+        return NULL;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    client->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (client->fd < 0 || inet_pton(AF_INET, host, &addr.sin_addr) != 1 ||
+        connect(client->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        binary_client_close(client);
+        return NULL;
+    }
+    int one = 1;
+    setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return client;
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int binary_client_command(BinaryClient *client, unsigned opcode, int argc, const char **argv, const size_t *lens,
+                          BinaryReply *reply) {
+    // Drop the previous reply, keeping anything the server sent after it
+    if (client->consumed > 0) {
+        memmove(client->reply, client->reply + client->consumed, client->reply_len - client->consumed);
+        client->reply_len -= client->consumed;
+        client->consumed = 0;
+    }
+
+    client->request_len = 0;
+    if (binary_append_command(&client->request, &client->request_len, opcode, argc, argv, lens) != 0 ||
+        write_all(client->fd, client->request, client->request_len) != 0) {
+        return -1;
+    }
+
+    long total;
+    while ((total = binary_decode_reply(client->reply, client->reply_len, reply)) == 0) {
+        if (client->reply_len == client->reply_cap) {
+            size_t cap = client->reply_cap ? client->reply_cap * 2 : 4096;
+            char *grown = realloc(client->reply, cap);
+            if (!grown) {
+                return -1;
+            }
+            client->reply = grown;
+            client->reply_cap = cap;
+        }
+        ssize_t n = read(client->fd, client->reply + client->reply_len, client->reply_cap - client->reply_len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        client->reply_len += n;
+    }
+    if (total < 0) {
+        return -1;
+    }
+    client->consumed = total;
+    return 0;
+}
+
+void binary_client_close(BinaryClient *client) {
+    if (client->fd >= 0) {
+        close(client->fd);
+    }
+    free(client->request);
+    free(client->reply);
+    free(client);
+}
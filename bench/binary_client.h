@@ -0,0 +1,55 @@
+#ifndef BINARY_CLIENT_H
+#define BINARY_CLIENT_H
+
+// Reference client for SwiftDB's binary framing (src/core/binary_protocol.h).
+// The server picks the framing from a connection's first byte, so the same
+// port serves RESP and binary clients. Build with
+// src/core/binary_protocol.c:
+//
+//   BinaryClient *client = binary_client_connect("127.0.0.1", 6379);
+//   const char *argv[] = {"key", "value"};
+//   size_t lens[] = {3, 5};
+//   BinaryReply reply;
+//   binary_client_command(client, BINARY_OP_SET, 2, argv, lens, &reply);
+//
+// Commands without an opcode go as BINARY_OP_COMMAND with their name in
+// argv[0].
+
+#include <stddef.h>
+#include "../src/core/binary_protocol.h"
+
+typedef struct BinaryClient BinaryClient;
+
+// One decoded reply. Aggregates leave their elements encoded: data points
+// at the first one, and each is decoded in turn with binary_decode_reply()
+// and skipped with binary_reply_length().
+typedef struct BinaryReply {
+    char type;            // RESP3 type character
+    long long integer;    // ':' and '#'
+    double number;        // ','
+    const char *data;     // '+', '-', '$' and aggregates; points into the decoded buffer
+    size_t length;        // Bytes of a string, elements of an aggregate (pairs for '%')
+} BinaryReply;
+
+// Append the request frame for a command to *out, growing it with
+// realloc. argv holds the arguments after the command name, or the name
+// and then the arguments with BINARY_OP_COMMAND. Returns 0, or -1 if out
+// of memory.
+int binary_append_command(char **out, size_t *out_len, unsigned opcode, int argc, const char **argv,
+                          const size_t *lens);
+
+// Decode the reply at the start of buf. Returns the length of the reply,
+// elements included; 0 if more bytes are needed, -1 if it is malformed.
+long binary_decode_reply(const char *buf, size_t len, BinaryReply *reply);
+
+// Blocking TCP connection. NULL on error.
+BinaryClient *binary_client_connect(const char *host, int port);
+
+// Send one command and wait for its reply, which stays valid until the
+// next call. Returns 0, or -1 if the connection failed.
+int binary_client_command(BinaryClient *client, unsigned opcode, int argc, const char **argv, const size_t *lens,
+                          BinaryReply *reply);
+
+void binary_client_close(BinaryClient *client);
+
+#endif // BINARY_CLIENT_H
@@ -0,0 +1,272 @@
+// hash_table: compares the keyspace index (src/core/key_index.c) with
+// uthash, which the keyspace used before, on single-threaded insert,
+// lookup and delete. Keys look like the ones the server stores.
+//
+// Build:  gcc -O2 -o hash_table bench/hash_table.c src/core/key_index.c src/core/epoch.c -lpthread
+//
+// Pass the table sizes to test (default 1000000 10000000):
+//
+//   ./hash_table 1000000 10000000 100000000
+//
+// Both tables are built over the same keys in the same random order. Large
+// sizes need memory: 100M keys take about 16 GB for the two runs together.
+// "worst" is the slowest single insert, which is where a table that grows
+// all at once stalls.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include "../include/uthash.h"
+#include "../src/core/key_index.h"
+
+#define KEY_BUFFER_SIZE 24
+
+typedef struct IndexItem {
+    KeyIndexNode node;
+    char key[KEY_BUFFER_SIZE];
+} IndexItem;
+
+typedef struct UthashItem {
+    char key[KEY_BUFFER_SIZE];
+    UT_hash_handle hh;
+} UthashItem;
+
+typedef struct Keys {
+    size_t count;
+    char (*hits)[KEY_BUFFER_SIZE];     // Stored keys
+    char (*misses)[KEY_BUFFER_SIZE];   // Never stored
+    size_t *order;                     // Random permutation of 0..count-1
+} Keys;
+
+typedef struct PhaseTimes {
+    double insert, hit, miss, remove;   // Nanoseconds per operation
+    double worst_insert;                // Microseconds
+    double bytes;                       // Table and items once everything is inserted
+} PhaseTimes;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long long next_random(unsigned long long *state) {
+    unsigned long long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// Same hash as the keyspace
+static uint64_t key_hash(const char *key, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void *checked_malloc(size_t size) {
+    void *ptr = malloc(size);
+    if (!ptr) {
+        fprintf(stderr, "Error: Out of memory allocating %zu bytes.\n", size);
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static void make_keys(Keys *keys, size_t count) {
+    unsigned long long seed = 0x9E3779B97F4A7C15ULL;
+    keys->count = count;
+    keys->hits = checked_malloc(count * KEY_BUFFER_SIZE);
+    keys->misses = checked_malloc(count * KEY_BUFFER_SIZE);
+    keys->order = checked_malloc(count * sizeof(size_t));
+    for (size_t i = 0; i < count; i++) {
+        snprintf(keys->hits[i], KEY_BUFFER_SIZE, "key:%zu", i);
+        snprintf(keys->misses[i], KEY_BUFFER_SIZE, "miss:%zu", i);
+        keys->order[i] = i;
+    }
+    for (size_t i = count - 1; i > 0; i--) {
+        size_t j = next_random(&seed) % (i + 1);
+        size_t tmp = keys->order[i];
+        keys->order[i] = keys->order[j];
+        keys->order[j] = tmp;
+    }
+}
+
+static void free_keys(Keys *keys) {
+    free(keys->hits);
+    free(keys->misses);
+    free(keys->order);
+}
+
+static void check(size_t found, size_t expected, const char *what) {
+    if (found != expected) {
+        fprintf(stderr, "Error: %s found %zu keys, expected %zu.\n", what, found, expected);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static PhaseTimes run_key_index(const Keys *keys) {
+    PhaseTimes times;
+    size_t n = keys->count;
+    IndexItem *items = checked_malloc(n * sizeof(IndexItem));
+    KeyIndex index;
+    if (key_index_init(&index) != 0) {
+        fprintf(stderr, "Error: Failed to create the key index.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    times.worst_insert = 0;
+    double start = now_seconds();
+    for (size_t i = 0; i < n; i++) {
+        double op_start = now_seconds();
+        IndexItem *item = &items[keys->order[i]];
+        size_t len = strlen(keys->hits[keys->order[i]]);
+        memcpy(item->key, keys->hits[keys->order[i]], len + 1);
+        item->node.hash = key_hash(item->key, len);
+        item->node.key_len = len;
+        item->node.key_offset = offsetof(IndexItem, key);
+        key_index_insert(&index, &item->node);
+        double op_time = now_seconds() - op_start;
+        if (op_time > times.worst_insert) {
+            times.worst_insert = op_time;
+        }
+    }
+    times.worst_insert *= 1e6;
+    times.insert = (now_seconds() - start) * 1e9 / n;
+    times.bytes = (double)n * sizeof(IndexItem);
+    for (KeyIndexTable *table = index.table; table; table = table->previous) {
+        size_t capacity = (table->group_mask + 1) * KEY_INDEX_GROUP_WIDTH;
+        times.bytes += sizeof(KeyIndexTable) + capacity * (1 + sizeof(KeyIndexNode *));
+    }
+
+    size_t found = 0;
+    start = now_seconds();
+    for (size_t i = 0; i < n; i++) {
+        const char *key = keys->hits[keys->order[n - 1 - i]];
+        size_t len = strlen(key);
+        found += key_index_find(&index, key_hash(key, len), key, len) != NULL;
+    }
+    times.hit = (now_seconds() - start) * 1e9 / n;
+    check(found, n, "key index lookup");
+
+    found = 0;
+    start = now_seconds();
+    for (size_t i = 0; i < n; i++) {
+        const char *key = keys->misses[keys->order[i]];
+        size_t len = strlen(key);
+        found += key_index_find(&index, key_hash(key, len), key, len) != NULL;
+    }
+    times.miss = (now_seconds() - start) * 1e9 / n;
+    check(found, 0, "key index miss lookup");
+
+    start = now_seconds();
+    for (size_t i = 0; i < n; i++) {
+        const char *key = keys->hits[keys->order[i]];
+        size_t len = strlen(key);
+        KeyIndexNode *node = key_index_find(&index, key_hash(key, len), key, len);
+        if (node) {
+            key_index_remove(&index, node);
+        }
+    }
+    times.remove = (now_seconds() - start) * 1e9 / n;
+    check(index.count, 0, "key index after delete");
+
+    key_index_destroy(&index);
+    free(items);
+    return times;
+}
+
+static PhaseTimes run_uthash(const Keys *keys) {
+    PhaseTimes times;
+    size_t n = keys->count;
+    UthashItem *items = checked_malloc(n * sizeof(UthashItem));
+    UthashItem *table = NULL;
+
+    times.worst_insert = 0;
+    double start = now_seconds();
+    for (size_t i = 0; i < n; i++) {
+        double op_start = now_seconds();
+        UthashItem *item = &items[keys->order[i]];
+        strcpy(item->key, keys->hits[keys->order[i]]);
+        HASH_ADD_STR(table, key, item);
+        double op_time = now_seconds() - op_start;
+        if (op_time > times.worst_insert) {
+            times.worst_insert = op_time;
+        }
+    }
+    times.worst_insert *= 1e6;
+    times.insert = (now_seconds() - start) * 1e9 / n;
+    times.bytes = (double)n * sizeof(UthashItem) + sizeof(UT_hash_table) +
+                  table->hh.tbl->num_buckets * sizeof(UT_hash_bucket);
+
+    size_t found = 0;
+    start = now_seconds();
+    for (size_t i = 0; i < n; i++) {
+        UthashItem *item;
+        HASH_FIND_STR(table, keys->hits[keys->order[n - 1 - i]], item);
+        found += item != NULL;
+    }
+    times.hit = (now_seconds() - start) * 1e9 / n;
+    check(found, n, "uthash lookup");
+
+    found = 0;
+    start = now_seconds();
+    for (size_t i = 0; i < n; i++) {
+        UthashItem *item;
+        HASH_FIND_STR(table, keys->misses[keys->order[i]], item);
+        found += item != NULL;
+    }
+    times.miss = (now_seconds() - start) * 1e9 / n;
+    check(found, 0, "uthash miss lookup");
+
+    start = now_seconds();
+    for (size_t i = 0; i < n; i++) {
+        UthashItem *item;
+        HASH_FIND_STR(table, keys->hits[keys->order[i]], item);
+        if (item) {
+            HASH_DEL(table, item);
+        }
+    }
+    times.remove = (now_seconds() - start) * 1e9 / n;
+    check(HASH_COUNT(table), 0, "uthash after delete");
+
+    free(items);
+    return times;
+}
+
+static void print_times(const char *name, PhaseTimes times) {
+    fprintf(stderr, "  %-10s insert %6.1f  hit %6.1f  miss %6.1f  delete %6.1f ns/op  "
+            "worst insert %8.1f us  %6.1f bytes/key\n",
+            name, times.insert, times.hit, times.miss, times.remove, times.worst_insert, times.bytes);
+}
+
+int main(int argc, char *argv[]) {
+    size_t default_sizes[] = { 1000000, 10000000 };
+    int size_count = argc > 1 ? argc - 1 : 2;
+
+    for (int s = 0; s < size_count; s++) {
+        size_t n = argc > 1 ? strtoull(argv[s + 1], NULL, 10) : default_sizes[s];
+        if (n == 0) {
+            fprintf(stderr, "Usage: %s [keys ...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        Keys keys;
+        make_keys(&keys, n);
+        fprintf(stderr, "%zu keys:\n", n);
+        PhaseTimes times = run_key_index(&keys);
+        times.bytes /= n;
+        print_times("key_index", times);
+        times = run_uthash(&keys);
+        times.bytes /= n;
+        print_times("uthash", times);
+        free_keys(&keys);
+    }
+    return 0;
+}
@@ -0,0 +1,190 @@
+// keyspace_contention: measures lock contention on the keyspace by running
+// GET/SET through the command table from many threads at once, with no
+// sockets involved. A scanner thread runs cleanup_expired_keys() in a loop
+// the whole time, like the server's background cleanup does.
+//
+// Build:  gcc -O2 -o keyspace_contention bench/keyspace_contention.c src/core/*.c src/persistence/*.c src/replication/*.c -lpthread
+//
+// Sweeps 1, 2, 4, ... up to -t threads (default 64):
+//
+//   ./keyspace_contention -t 64 -n 200000 -k 10000 -r 90
+//
+// Every thread does -n operations on random keys out of -k, -r percent of
+// them GETs. Keys are loaded up front so GETs never fall through to disk.
+// GETs take no lock, so -r 100 -S measures the lock-free read path alone.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "../src/core/commands.h"
+#include "../src/core/protocol.h"
+
+#define KEY_BUFFER_SIZE 32
+
+typedef struct ContentionConfig {
+    int max_threads;
+    long operations;   // Per thread
+    int keys;
+    int read_percent;
+    int scanner;       // Run cleanup_expired_keys() concurrently
+} ContentionConfig;
+
+typedef struct ContentionThread {
+    pthread_t thread;
+    unsigned long long seed;
+    long completed;
+} ContentionThread;
+
+static ContentionConfig config;
+static pthread_barrier_t start_barrier;
+static volatile int scanning = 0;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Replies are thrown away; the cost being measured is the keyspace
+static void discard_reply(int socket, const char *data, size_t len) {
+    (void)socket;
+    (void)data;
+    (void)len;
+}
+
+static unsigned long long next_random(unsigned long long *state) {
+    unsigned long long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void run_command(int argc, const char **argv) {
+    RedisString args[3];
+    for (int i = 0; i < argc; i++) {
+        args[i].data = (char *)argv[i];
+        args[i].length = strlen(argv[i]);
+    }
+    RedisCommand cmd = { .argv = args, .argc = argc };
+    execute_command(-1, &cmd);
+}
+
+static void *contention_thread(void *arg) {
+    ContentionThread *self = (ContentionThread *)arg;
+    char key[KEY_BUFFER_SIZE];
+
+    set_reply_writer(discard_reply);
+    pthread_barrier_wait(&start_barrier);
+
+    for (long i = 0; i < config.operations; i++) {
+        unsigned long long r = next_random(&self->seed);
+        snprintf(key, sizeof(key), "key:%d", (int)(r % config.keys));
+        if ((int)((r >> 32) % 100) < config.read_percent) {
+            const char *argv[] = { "GET", key };
+            run_command(2, argv);
+        } else {
+            const char *argv[] = { "SET", key, "value" };
+            run_command(3, argv);
+        }
+        self->completed++;
+    }
+    return NULL;
+}
+
+static void *scanner_thread(void *arg) {
+    (void)arg;
+    while (scanning) {
+        cleanup_expired_keys();
+    }
+    return NULL;
+}
+
+static double run_round(int threads) {
+    ContentionThread *workers = calloc(threads, sizeof(ContentionThread));
+    pthread_t scanner;
+
+    pthread_barrier_init(&start_barrier, NULL, threads + 1);
+    for (int i = 0; i < threads; i++) {
+        workers[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        pthread_create(&workers[i].thread, NULL, contention_thread, &workers[i]);
+    }
+    if (config.scanner) {
+        scanning = 1;
+        pthread_create(&scanner, NULL, scanner_thread, NULL);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    double start = now_seconds();
+    long completed = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        completed += workers[i].completed;
+    }
+    double elapsed = now_seconds() - start;
+
+    if (config.scanner) {
+        scanning = 0;
+        pthread_join(scanner, NULL);
+    }
+    pthread_barrier_destroy(&start_barrier);
+    free(workers);
+    return completed / elapsed;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [-t max_threads] [-n operations_per_thread] [-k keys]\n"
+            "          [-r read_percent] [-S (no scanner thread)]\n",
+            program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    config.max_threads = 64;
+    config.operations = 200000;
+    config.keys = 10000;
+    config.read_percent = 90;
+    config.scanner = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:k:r:S")) != -1) {
+        switch (opt) {
+        case 't': config.max_threads = atoi(optarg); break;
+        case 'n': config.operations = atol(optarg); break;
+        case 'k': config.keys = atoi(optarg); break;
+        case 'r': config.read_percent = atoi(optarg); break;
+        case 'S': config.scanner = 0; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (config.max_threads <= 0 || config.operations <= 0 || config.keys <= 0 ||
+        config.read_percent < 0 || config.read_percent > 100) {
+        usage(argv[0]);
+    }
+
+    register_commands();
+    set_reply_writer(discard_reply);
+    for (int i = 0; i < config.keys; i++) {
+        char key[KEY_BUFFER_SIZE];
+        snprintf(key, sizeof(key), "key:%d", i);
+        const char *load[] = { "SET", key, "value" };
+        run_command(3, load);
+    }
+
+    // The scanner's progress messages would drown the results
+    if (config.scanner && !freopen("/dev/null", "w", stdout)) {
+        perror("freopen");
+        return EXIT_FAILURE;
+    }
+
+    for (int threads = 1; threads <= config.max_threads; threads *= 2) {
+        double rate = run_round(threads);
+        fprintf(stderr, "%2d threads: %.0f ops/s (%d%% GET, %d keys%s)\n", threads, rate,
+                config.read_percent, config.keys, config.scanner ? ", expiry scanner running" : "");
+    }
+    return 0;
+}
@@ -0,0 +1,139 @@
+// keyspace_memory: heap bytes per key after loading the keyspace through
+// the command table, index included. Heap use is taken from mallinfo2()
+// before and after, so it counts allocator overhead too.
+//
+// Build:  gcc -O2 -o keyspace_memory bench/keyspace_memory.c src/core/*.c src/persistence/*.c src/replication/*.c -lpthread
+//
+// Loads -n keys of -k bytes with values of -v bytes via SET:
+//
+//   ./keyspace_memory -n 1000000 -k 10 -v 8
+//   ./keyspace_memory -n 1000000 -k 16 -v 200
+//
+// With -c it then rewrites that percent of the keys, spread evenly, with
+// -w byte values and reports again. The old entries' size class is left
+// with holes, which shows how much freed space stays reserved:
+//
+//   ./keyspace_memory -n 1000000 -k 10 -v 200 -c 50 -w 8
+//
+// (SET is used because DEL and EXPIRE also write through to the SDB file.)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include "../src/core/commands.h"
+#include "../src/core/protocol.h"
+#include "../src/core/slab.h"
+
+static void discard_reply(int socket, const char *data, size_t len) {
+    (void)socket;
+    (void)data;
+    (void)len;
+}
+
+static size_t heap_in_use(void) {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+// Fill buf with len characters, the key number first so keys are unique
+static void make_string(char *buf, size_t len, long n, char pad) {
+    int written = snprintf(buf, len + 1, "%ld", n);
+    if ((size_t)written < len) {
+        memset(buf + written, pad, len - written);
+    }
+    buf[len] = '\0';
+}
+
+static void run_command(int argc, const char *argv[], const size_t lengths[]) {
+    RedisString args[3];
+    for (int i = 0; i < argc; i++) {
+        args[i].data = (char *)argv[i];
+        args[i].length = lengths[i];
+    }
+    RedisCommand cmd = { .argv = args, .argc = argc };
+    execute_command(-1, &cmd);
+}
+
+static void report(const char *phase, long keys, size_t heap) {
+    SlabStats slab;
+    slab_stats(&slab);
+    printf("%-7s %ld keys: heap %.1f MB, %.1f bytes/key; slabs %.1f MB reserved, "
+           "%.1f MB allocated, %.1f MB used (%.2fx), %.1f MB large\n",
+           phase, keys, heap / 1e6, keys ? (double)heap / keys : 0, slab.reserved / 1e6,
+           slab.allocated / 1e6, slab.requested / 1e6,
+           slab.requested ? (double)slab.reserved / slab.requested : 0, slab.large / 1e6);
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-n keys] [-k key_bytes] [-v value_bytes] [-c churn_percent] [-w churn_value_bytes]\n", program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    long keys = 1000000;
+    size_t key_bytes = 10, value_bytes = 8;
+    size_t churn_bytes = 1;
+    int churn_percent = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:k:v:c:w:")) != -1) {
+        switch (opt) {
+        case 'n': keys = atol(optarg); break;
+        case 'k': key_bytes = strtoul(optarg, NULL, 10); break;
+        case 'v': value_bytes = strtoul(optarg, NULL, 10); break;
+        case 'c': churn_percent = atoi(optarg); break;
+        case 'w': churn_bytes = strtoul(optarg, NULL, 10); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (keys <= 0 || key_bytes < 8 || value_bytes == 0 || churn_bytes == 0 ||
+        churn_percent < 0 || churn_percent > 100) {
+        usage(argv[0]);
+    }
+
+    char *key = malloc(key_bytes + 1);
+    char *value = malloc(value_bytes + 1);
+    if (!key || !value) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return EXIT_FAILURE;
+    }
+
+    register_commands();
+    set_reply_writer(discard_reply);
+    size_t before = heap_in_use();
+
+    printf("%zu-byte keys, %zu-byte values (%zu bytes of data per key)\n",
+           key_bytes, value_bytes, key_bytes + value_bytes);
+    for (long i = 0; i < keys; i++) {
+        make_string(key, key_bytes, i, 'k');
+        make_string(value, value_bytes, i, 'v');
+        const char *set[] = { "SET", key, value };
+        const size_t lengths[] = { 3, key_bytes, value_bytes };
+        run_command(3, set, lengths);
+    }
+    report("loaded", keys, heap_in_use() - before);
+
+    if (churn_percent > 0) {
+        char *churn_value = malloc(churn_bytes + 1);
+        if (!churn_value) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            return EXIT_FAILURE;
+        }
+        for (long i = 0; i < keys; i++) {
+            // Bresenham-style spread, so every slab page loses some entries
+            if ((i + 1) * churn_percent / 100 == i * churn_percent / 100) {
+                continue;
+            }
+            make_string(key, key_bytes, i, 'k');
+            make_string(churn_value, churn_bytes, i, 'w');
+            const char *set[] = { "SET", key, churn_value };
+            const size_t lengths[] = { 3, key_bytes, churn_bytes };
+            run_command(3, set, lengths);
+        }
+        free(churn_value);
+        report("churned", keys, heap_in_use() - before);
+    }
+    return 0;
+}
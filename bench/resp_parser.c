@@ -0,0 +1,225 @@
+// resp_parser: parser throughput on pipelined traffic, with no sockets
+// involved. Frames are parsed from memory one after another, the way a
+// connection parses everything a read returned, once per header scanning
+// level the CPU supports.
+//
+// Build:  gcc -O2 -o resp_parser bench/resp_parser.c src/core/protocol.c src/core/binary_protocol.c
+//
+// Parses -n commands, -r percent of them GETs and the rest SETs with -d
+// byte values, -i times over, and reports the fastest pass:
+//
+//   ./resp_parser -n 100000 -d 16 -r 50
+//   ./resp_parser -n 100000 -d 1024 -b 16384
+//
+// With -b the input arrives -b bytes at a time, so frames are split across
+// reads and resumed like they are on a socket. -B adds a pass over the same
+// commands in the binary framing (src/core/binary_protocol.h), which has
+// no headers to scan.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "../src/core/protocol.h"
+#include "../src/core/binary_protocol.h"
+
+typedef struct ParserConfig {
+    int commands;
+    int value_size;
+    int read_percent;
+    int iterations;
+    size_t read_bytes;   // 0 for all input at once
+    int binary;          // Also parse the traffic as binary frames
+} ParserConfig;
+
+static ParserConfig config;
+
+static const char *level_names[] = { "scalar", "sse4.2", "avx2" };
+
+// CPU time, so time a shared host gives to other work does not count
+static double cpu_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t append_bulk(char *out, const char *data, size_t len) {
+    size_t n = sprintf(out, "$%zu\r\n", len);
+    memcpy(out + n, data, len);
+    memcpy(out + n + len, "\r\n", 2);
+    return n + len + 2;
+}
+
+// A binary frame for a command with an opcode
+static size_t append_binary(char *out, BinaryOpcode opcode, int argc, const char **argv, const size_t *lens) {
+    size_t body = 0;
+    for (int i = 0; i < argc; i++) {
+        body += 4 + lens[i] + 1;
+    }
+    out[0] = (char)BINARY_MAGIC;
+    out[1] = BINARY_VERSION;
+    binary_put_u16(out + 2, opcode);
+    binary_put_u32(out + 4, (uint32_t)argc);
+    binary_put_u32(out + 8, (uint32_t)body);
+    char *p = out + BINARY_HEADER_SIZE;
+    for (int i = 0; i < argc; i++) {
+        binary_put_u32(p, (uint32_t)lens[i]);
+        p += 4;
+    }
+    for (int i = 0; i < argc; i++) {
+        memcpy(p, argv[i], lens[i]);
+        p += lens[i];
+        *p++ = '\0';
+    }
+    return p - out;
+}
+
+// Pipelined GET/SET traffic on keys like those of redis-benchmark, in RESP
+// or as binary frames
+static char *build_traffic(size_t *len, int binary) {
+    size_t capacity = (size_t)config.commands * (64 + config.value_size);
+    char *buf = malloc(capacity);
+    char *value = malloc(config.value_size);
+    if (!buf || !value) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(value, 'x', config.value_size);
+
+    unsigned long long state = 0x9E3779B97F4A7C15ULL;
+    size_t pos = 0;
+    for (int i = 0; i < config.commands; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        char key[32];
+        int key_len = snprintf(key, sizeof(key), "key:%012llu", state % 1000000);
+        const char *argv[] = { key, value };
+        size_t lens[] = { (size_t)key_len, (size_t)config.value_size };
+        int get = (int)((state >> 32) % 100) < config.read_percent;
+        if (binary) {
+            pos += append_binary(buf + pos, get ? BINARY_OP_GET : BINARY_OP_SET, get ? 1 : 2, argv, lens);
+        } else if (get) {
+            pos += sprintf(buf + pos, "*2\r\n");
+            pos += append_bulk(buf + pos, "GET", 3);
+            pos += append_bulk(buf + pos, key, key_len);
+        } else {
+            pos += sprintf(buf + pos, "*3\r\n");
+            pos += append_bulk(buf + pos, "SET", 3);
+            pos += append_bulk(buf + pos, key, key_len);
+            pos += append_bulk(buf + pos, value, config.value_size);
+        }
+    }
+    free(value);
+    *len = pos;
+    return buf;
+}
+
+// Parse all of buf; returns the commands parsed
+static long parse_all(RespParser *parser, char *buf, size_t len) {
+    size_t pos = 0;
+    size_t available = config.read_bytes ? config.read_bytes : len;
+    long commands = 0;
+
+    while (pos < len) {
+        if (available > len) {
+            available = len;
+        }
+        RedisCommand cmd;
+        long consumed = parse_redis_command(parser, buf + pos, available - pos, &cmd);
+        if (consumed < 0) {
+            fprintf(stderr, "Protocol error at byte %zu\n", pos);
+            exit(EXIT_FAILURE);
+        }
+        if (consumed == 0) {
+            available += config.read_bytes;   // The next read
+            continue;
+        }
+        pos += consumed;
+        commands += cmd.argc > 0;
+        reset_resp_arena(parser);
+    }
+    return commands;
+}
+
+static void run_level(const char *name, const char *traffic, size_t len) {
+    char *work = malloc(len);
+    if (!work) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    RespParser parser;
+    init_resp_parser(&parser);
+
+    // The fastest pass, which is the one least disturbed by other work
+    double best = 0;
+    long commands = 0;
+    for (int i = 0; i < config.iterations; i++) {
+        memcpy(work, traffic, len);   // Parsing overwrites each bulk string's CR
+        double start = cpu_seconds();
+        commands = parse_all(&parser, work, len);
+        double elapsed = cpu_seconds() - start;
+        if (i == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    printf("%-7s %6.2f GB/s  %6.2f M commands/s\n", name, len / best / 1e9,
+           commands / best / 1e6);
+    free_resp_parser(&parser);
+    free(work);
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [-n commands] [-d value_size] [-r read_percent] [-i iterations]\n"
+            "          [-b read_bytes] [-B]\n",
+            program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    config.commands = 100000;
+    config.value_size = 16;
+    config.read_percent = 50;
+    config.iterations = 50;
+    config.read_bytes = 0;
+    config.binary = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:r:i:b:B")) != -1) {
+        switch (opt) {
+        case 'n': config.commands = atoi(optarg); break;
+        case 'd': config.value_size = atoi(optarg); break;
+        case 'r': config.read_percent = atoi(optarg); break;
+        case 'i': config.iterations = atoi(optarg); break;
+        case 'b': config.read_bytes = strtoul(optarg, NULL, 10); break;
+        case 'B': config.binary = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (config.commands <= 0 || config.value_size < 0 || config.iterations <= 0 ||
+        config.read_percent < 0 || config.read_percent > 100) {
+        usage(argv[0]);
+    }
+
+    size_t len;
+    char *traffic = build_traffic(&len, 0);
+    printf("%d commands, %.1f MB, %d%% GET, %d byte values%s\n", config.commands, len / 1e6,
+           config.read_percent, config.value_size, config.read_bytes ? ", split into reads" : "");
+
+    for (int level = RESP_SCAN_SCALAR; level <= RESP_SCAN_AVX2; level++) {
+        if (set_resp_scan_level((RespScanLevel)level) == 0) {
+            run_level(level_names[level], traffic, len);
+        }
+    }
+    free(traffic);
+
+    if (config.binary) {
+        traffic = build_traffic(&len, 1);
+        run_level("binary", traffic, len);
+        free(traffic);
+    }
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "shm_client.h"
+#include "../src/networking/shm_ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+struct ShmClient {
+    int control_fd;
+    int request_efd;      // We signal it when the server sleeps
+    int response_efd;     // The server signals it when we sleep
+    ShmRegion *region;
+    size_t region_size;
+    ShmRingView request;
+    ShmRingView response;
+};
+
+// Receive the region size and the memfd plus both eventfds
+static int receive_handshake(ShmClient *client) {
+    uint64_t size;
+    struct iovec iov = { .iov_base = &size, .iov_len = sizeof(size) };
+    int fds[3];
+    char control[CMSG_SPACE(sizeof(fds))];
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(client->control_fd, &msg, MSG_CMSG_CLOEXEC) != (ssize_t)sizeof(size)) {
+        return -1;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    client->region_size = size;
+    client->request_efd = fds[1];
+    client->response_efd = fds[2];
+    client->region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fds[0], 0);
+    close(fds[0]);
+    if (client->region == MAP_FAILED || client->region->magic != SHM_RING_MAGIC) {
+        return -1;
+    }
+    // The layout the server chose; both rings must lie within the mapping
+    uint32_t ring_size = client->region->ring_size;
+    if (ring_size == 0 || (ring_size & (ring_size - 1)) != 0 || shm_region_size(ring_size) > size) {
+        return -1;
+    }
+    shm_ring_attach(&client->request, client->region, &client->region->request, shm_region_header(), ring_size);
+    shm_ring_attach(&client->response, client->region, &client->region->response, shm_region_header() + ring_size,
+                    ring_size);
+    return 0;
+}
+
+ShmClient *shm_client_connect(const char *path) {
+    ShmClient *client = calloc(1, sizeof(ShmClient));
+    if (!client) {
+        return NULL;
+    }
+    client->request_efd = -1;
+    client->response_efd = -1;
+    client->region = MAP_FAILED;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    client->control_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (client->control_fd < 0 || connect(client->control_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        receive_handshake(client) != 0) {
+        shm_client_close(client);
+        return NULL;
+    }
+    return client;
+}
+
+// The server closes the control socket when it drops us
+static int server_gone(ShmClient *client) {
+    struct pollfd pfd = { .fd = client->control_fd, .events = POLLIN };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+int shm_client_write(ShmClient *client, const char *data, size_t len) {
+    ShmRingView *ring = &client->request;
+    while (len > 0) {
+        if (shm_ring_writable(ring) == SHM_RING_CORRUPT) {
+            return -1;
+        }
+        size_t written = shm_ring_write(ring, data, len);
+        data += written;
+        len -= written;
+        if (written > 0 && shm_ring_needs_wakeup(ring)) {
+            uint64_t one = 1;
+            if (write(client->request_efd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+                return -1;
+            }
+        }
+        if (len > 0) {
+            if (server_gone(client)) {
+                return -1;
+            }
+            sched_yield();
+        }
+    }
+    return 0;
+}
+
+ssize_t shm_client_read(ShmClient *client, char *buf, size_t len, int block) {
+    ShmRingView *ring = &client->response;
+    int spins = 0;
+
+    while (shm_ring_readable(ring) == 0) {
+        if (!block) {
+            return 0;
+        }
+        if (++spins < SHM_CLIENT_SPIN) {
+            continue;
+        }
+        if (shm_ring_prepare_wait(ring) == 0) {
+            struct pollfd pfds[2] = {
+                { .fd = client->response_efd, .events = POLLIN },
+                { .fd = client->control_fd, .events = POLLIN },
+            };
+            poll(pfds, 2, -1);
+            uint64_t count;
+            if (pfds[0].revents & POLLIN) {
+                if (read(client->response_efd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                    return -1;
+                }
+            }
+            shm_ring_end_wait(ring);
+            if ((pfds[1].revents & (POLLIN | POLLHUP)) && shm_ring_readable(ring) == 0) {
+                return -1;
+            }
+        }
+        spins = 0;
+    }
+    if (shm_ring_readable(ring) == SHM_RING_CORRUPT) {
+        return -1;
+    }
+    return (ssize_t)shm_ring_read(ring, buf, len);
+}
+
+void shm_client_close(ShmClient *client) {
+    if (client->region != MAP_FAILED) {
+        munmap(client->region, client->region_size);
+    }
+    if (client->request_efd >= 0) {
+        close(client->request_efd);
+    }
+    if (client->response_efd >= 0) {
+        close(client->response_efd);
+    }
+    if (client->control_fd >= 0) {
+        close(client->control_fd);
+    }
+    free(client);
+}
@@ -0,0 +1,29 @@
+#ifndef SHM_CLIENT_H
+#define SHM_CLIENT_H
+
+// Minimal client for SwiftDB's shared-memory transport (--shm-socket).
+// The rings carry plain RESP, so this behaves like a byte stream: write
+// commands, read replies.
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define SHM_CLIENT_SPIN 2000   // Polls of an empty ring before sleeping
+
+typedef struct ShmClient ShmClient;
+
+// Connect to the server's control socket and map the rings. NULL on error.
+ShmClient *shm_client_connect(const char *path);
+
+// Queue all len bytes, spinning while the request ring is full.
+// Returns 0, or -1 if the server went away.
+int shm_client_write(ShmClient *client, const char *data, size_t len);
+
+// Read available reply bytes into buf. With block set, waits until at least
+// one byte arrives. Returns the byte count (0 only when not blocking) or -1
+// if the server went away.
+ssize_t shm_client_read(ShmClient *client, char *buf, size_t len, int block);
+
+void shm_client_close(ShmClient *client);
+
+#endif // SHM_CLIENT_H
@@ -0,0 +1,682 @@
+// swiftbench: closed-loop load generator for SwiftDB.
+//
+// Build:  gcc -O2 -o swiftbench bench/swiftbench.c bench/shm_client.c bench/binary_client.c src/core/binary_protocol.c -lpthread
+//
+// Every connection keeps one request in flight (or a batch of -P pipelined
+// requests); connections are spread over the client threads, each driving
+// its share with its own epoll loop. To
+// compare connection models, start the server with `--io threads` and then
+// `--io epoll` and sweep the connection count:
+//
+//   for c in 10 100 1000 5000; do ./swiftbench -c $c -n 200000 -T get; done
+//
+// Raise `ulimit -n` on both sides before running with thousands of clients.
+// To compare loopback TCP with a Unix domain socket, start the server with
+// `--unixsocket /tmp/swiftdb.sock` and run the same test over both:
+//
+//   ./swiftbench -c 50 -n 500000 -T get
+//   ./swiftbench -c 50 -n 500000 -T get -s /tmp/swiftdb.sock
+//
+// Pipelining sends -P copies of the command at once and waits for all the
+// replies before sending the next batch:
+//
+//   for p in 1 16 64; do ./swiftbench -c 50 -n 1000000 -P $p -T get; done
+//
+// To see how --io threaded scales with the number of I/O threads, restart
+// the server for each count and keep enough clients busy to feed them all
+// (run the bench from another machine or pin it to other cores):
+//
+//   ./swiftdb --io threaded --io-threads $t          # t = 1 2 4 8 16
+//   ./swiftbench -c 400 -t 8 -n 4000000 -T get -P 4
+//
+// Clients on the same host can skip the socket layer entirely: start the
+// server with `--shm-socket /tmp/swiftdb-shm.sock` and pass -m. Each bench
+// thread then busy-polls its connections' response rings:
+//
+//   ./swiftbench -c 4 -t 4 -n 1000000 -T get -m /tmp/swiftdb-shm.sock
+//
+// -B sends the same commands in the binary framing of
+// src/core/binary_protocol.h instead of RESP, against the same server:
+//
+//   for d in 16 1024 65536; do
+//       ./swiftbench -c 50 -n 1000000 -P 16 -T set -d $d
+//       ./swiftbench -c 50 -n 1000000 -P 16 -T set -d $d -B
+//   done
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "shm_client.h"
+#include "binary_client.h"
+
+#define READ_BUFFER_SIZE 65536
+
+typedef struct BenchConfig {
+    const char *host;
+    int port;
+    const char *socket_path;   // Connect over AF_UNIX instead of TCP
+    const char *shm_path;      // Use the shared-memory transport instead
+    int clients;
+    long requests;
+    int threads;
+    const char *test;
+    int value_size;
+    int keys;                  // Keys per MGET
+    int pipeline;
+    int binary;                // Binary framing instead of RESP
+} BenchConfig;
+
+typedef struct BenchConn {
+    int fd;
+    ShmClient *shm;       // Set instead of fd with -m
+    char *pending;        // Unparsed reply bytes
+    size_t pending_len;
+    size_t pending_cap;
+    size_t write_offset;  // Progress through the current request
+    int in_flight;        // Replies still expected for the current batch
+    double sent_at;       // When the current batch was sent
+} BenchConn;
+
+typedef struct BenchThread {
+    pthread_t thread;
+    int connections;
+    long requests;
+    long completed;
+    int errors;
+    double *latencies;    // Round trip of every batch, in microseconds
+    long latency_count;
+} BenchThread;
+
+static BenchConfig config;
+static char *request = NULL;
+static size_t request_len = 0;
+static pthread_barrier_t connected_barrier;
+static double start_time;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Length of the first complete reply in buf, 0 if incomplete, -1 if malformed
+static long reply_length(const char *buf, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    const char *crlf = memchr(buf, '\n', len);
+    if (!crlf) {
+        return 0;
+    }
+    long line = crlf - buf + 1;
+
+    switch (buf[0]) {
+    case '+':
+    case '-':
+    case ':':
+        return line;
+    case '$': {
+        long bulk = strtol(buf + 1, NULL, 10);
+        if (bulk < 0) {
+            return line;
+        }
+        return (size_t)(line + bulk + 2) <= len ? line + bulk + 2 : 0;
+    }
+    case '*': {
+        long count = strtol(buf + 1, NULL, 10);
+        long total = line;
+        for (long i = 0; i < count; i++) {
+            long element = reply_length(buf + total, len - total);
+            if (element <= 0) {
+                return element;
+            }
+            total += element;
+        }
+        return total;
+    }
+    default:
+        return -1;
+    }
+}
+
+// Opcode of a command name, BINARY_OP_COMMAND if it has none
+static unsigned binary_opcode(const char *name) {
+    for (unsigned op = BINARY_OP_COMMAND + 1; op < BINARY_OP_COUNT; op++) {
+        if (strcmp(binary_opcode_name(op), name) == 0) {
+            return op;
+        }
+    }
+    return BINARY_OP_COMMAND;
+}
+
+static void append_command(char **out, size_t *out_len, int argc, const char **argv, const size_t *lens) {
+    if (config.binary) {
+        // argv[0] is the name the opcode stands for
+        binary_append_command(out, out_len, binary_opcode(argv[0]), argc - 1, argv + 1, lens + 1);
+        return;
+    }
+    size_t size = 32;
+    for (int i = 0; i < argc; i++) {
+        size += lens[i] + 32;
+    }
+    *out = realloc(*out, *out_len + size);
+    char *p = *out + *out_len;
+    p += sprintf(p, "*%d\r\n", argc);
+    for (int i = 0; i < argc; i++) {
+        p += sprintf(p, "$%zu\r\n", lens[i]);
+        memcpy(p, argv[i], lens[i]);
+        p += lens[i];
+        *p++ = '\r';
+        *p++ = '\n';
+    }
+    *out_len = p - *out;
+}
+
+// name followed by -k keys, each followed by value unless it is NULL
+static void append_keys_command(char **out, size_t *out_len, const char *name, const char *value) {
+    int per_key = value ? 2 : 1;
+    int argc = 1 + config.keys * per_key;
+    const char **argv = malloc(argc * sizeof(char *));
+    size_t *lens = malloc(argc * sizeof(size_t));
+    char (*keys)[32] = malloc(config.keys * sizeof(*keys));
+    argv[0] = name;
+    lens[0] = strlen(name);
+    for (int i = 0; i < config.keys; i++) {
+        int arg = 1 + i * per_key;
+        lens[arg] = snprintf(keys[i], sizeof(keys[i]), "key:bench:%d", i);
+        argv[arg] = keys[i];
+        if (value) {
+            argv[arg + 1] = value;
+            lens[arg + 1] = config.value_size;
+        }
+    }
+    append_command(out, out_len, argc, argv, lens);
+    free(keys);
+    free(lens);
+    free(argv);
+}
+
+static int build_request(void) {
+    char *value = malloc(config.value_size + 1);
+    memset(value, 'x', config.value_size);
+    value[config.value_size] = '\0';
+
+    if (strcmp(config.test, "ping") == 0) {
+        const char *argv[] = {"PING"};
+        size_t lens[] = {4};
+        append_command(&request, &request_len, 1, argv, lens);
+    } else if (strcmp(config.test, "set") == 0) {
+        const char *argv[] = {"SET", "key:bench", value};
+        size_t lens[] = {3, 9, (size_t)config.value_size};
+        append_command(&request, &request_len, 3, argv, lens);
+    } else if (strcmp(config.test, "get") == 0) {
+        const char *argv[] = {"GET", "key:bench"};
+        size_t lens[] = {3, 9};
+        append_command(&request, &request_len, 2, argv, lens);
+    } else if (strcmp(config.test, "mget") == 0) {
+        append_keys_command(&request, &request_len, "MGET", NULL);
+    } else {
+        fprintf(stderr, "Unknown test '%s'\n", config.test);
+        free(value);
+        return -1;
+    }
+
+    free(value);
+
+    // Pipelining: the request is simply the command repeated
+    size_t command_len = request_len;
+    for (int i = 1; i < config.pipeline; i++) {
+        request = realloc(request, request_len + command_len);
+        memcpy(request + request_len, request, command_len);
+        request_len += command_len;
+    }
+    return 0;
+}
+
+static int connect_unix(void) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, config.socket_path, sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+static int connect_to_server(void) {
+    if (config.socket_path) {
+        return connect_unix();
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.port);
+    inet_pton(AF_INET, config.host, &addr.sin_addr);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+// Store the keys MGET reads, with one BULK_SET over its own connection
+static int populate_keys(void) {
+    int fd = connect_to_server();
+    if (fd < 0) {
+        perror("connect");
+        return -1;
+    }
+    char *value = malloc(config.value_size + 1);
+    memset(value, 'x', config.value_size);
+    value[config.value_size] = '\0';
+    char *buf = NULL;
+    size_t len = 0;
+    append_keys_command(&buf, &len, "BULK_SET", value);
+    free(value);
+
+    struct pollfd pfd = { .fd = fd };
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, buf + done, len - done);
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            break;
+        }
+        if (n > 0) {
+            done += n;
+        } else {
+            pfd.events = POLLOUT;
+            poll(&pfd, 1, -1);
+        }
+    }
+    char reply[256];
+    size_t got = 0;
+    long reply_len = 0;
+    while (done == len && got < sizeof(reply) && reply_len == 0) {
+        pfd.events = POLLIN;
+        poll(&pfd, 1, -1);
+        ssize_t n = read(fd, reply + got, sizeof(reply) - got);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            break;
+        }
+        got += n > 0 ? n : 0;
+        reply_len = config.binary ? binary_reply_length(reply, got) : reply_length(reply, got);
+    }
+    free(buf);
+    close(fd);
+    if (reply_len <= 0 || reply[0] == '-') {
+        fprintf(stderr, "Failed to store the MGET keys\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Push the rest of the current request; returns -1 on error
+static int send_request(BenchConn *conn) {
+    while (conn->write_offset < request_len) {
+        ssize_t n = write(conn->fd, request + conn->write_offset, request_len - conn->write_offset);
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        conn->write_offset += n;
+    }
+    return 0;
+}
+
+// Append received bytes and count the complete replies; -1 if malformed
+static int parse_replies(BenchConn *conn, BenchThread *self, const char *data, size_t n) {
+    int completed = 0;
+
+    if (conn->pending_len + n > conn->pending_cap) {
+        conn->pending_cap = (conn->pending_len + n) * 2;
+        conn->pending = realloc(conn->pending, conn->pending_cap);
+    }
+    memcpy(conn->pending + conn->pending_len, data, n);
+    conn->pending_len += n;
+
+    size_t offset = 0;
+    while (offset < conn->pending_len) {
+        long len = config.binary ? binary_reply_length(conn->pending + offset, conn->pending_len - offset)
+                                 : reply_length(conn->pending + offset, conn->pending_len - offset);
+        if (len < 0) {
+            return -1;
+        }
+        if (len == 0) {
+            break;
+        }
+        if (conn->pending[offset] == '-') {
+            self->errors++;
+        }
+        offset += len;
+        completed++;
+    }
+    memmove(conn->pending, conn->pending + offset, conn->pending_len - offset);
+    conn->pending_len -= offset;
+    return completed;
+}
+
+// Consume replies; returns the number of replies completed or -1 on error
+static int read_replies(BenchConn *conn, BenchThread *self) {
+    char buffer[READ_BUFFER_SIZE];
+    int completed = 0;
+
+    while (1) {
+        ssize_t n = read(conn->fd, buffer, sizeof(buffer));
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            return -1;
+        }
+
+        int done = parse_replies(conn, self, buffer, n);
+        if (done < 0) {
+            return -1;
+        }
+        completed += done;
+    }
+
+    return completed;
+}
+
+// -m: every connection is polled in turn; a batch is sent as soon as the
+// previous one has been answered
+static void *bench_shm_thread(void *arg) {
+    BenchThread *self = (BenchThread *)arg;
+    BenchConn *conns = calloc(self->connections, sizeof(BenchConn));
+    char buffer[READ_BUFFER_SIZE];
+    long issued = 0;
+    self->latencies = malloc((self->requests / config.pipeline + self->connections + 1) * sizeof(double));
+
+    for (int i = 0; i < self->connections; i++) {
+        conns[i].shm = shm_client_connect(config.shm_path);
+        if (!conns[i].shm) {
+            perror("shm connect");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (pthread_barrier_wait(&connected_barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+        start_time = now_seconds();
+    }
+
+    for (int i = 0; i < self->connections; i++) {
+        if (issued < self->requests) {
+            conns[i].in_flight = config.pipeline;
+            conns[i].sent_at = now_seconds();
+            issued += config.pipeline;
+            shm_client_write(conns[i].shm, request, request_len);
+        }
+    }
+
+    // A single connection may block in the read; with several we must not
+    int block = self->connections == 1;
+    while (self->completed < self->requests) {
+        for (int i = 0; i < self->connections; i++) {
+            BenchConn *conn = &conns[i];
+            if (conn->in_flight == 0) {
+                continue;
+            }
+            ssize_t n = shm_client_read(conn->shm, buffer, sizeof(buffer), block);
+            int done = n > 0 ? parse_replies(conn, self, buffer, n) : (int)n;
+            if (done < 0) {
+                fprintf(stderr, "Connection error\n");
+                exit(EXIT_FAILURE);
+            }
+            if (done == 0) {
+                continue;
+            }
+
+            self->completed += done;
+            conn->in_flight -= done;
+            if (conn->in_flight > 0) {
+                continue;
+            }
+            double now = now_seconds();
+            self->latencies[self->latency_count++] = (now - conn->sent_at) * 1e6;
+            if (issued < self->requests) {
+                conn->in_flight = config.pipeline;
+                conn->sent_at = now;
+                issued += config.pipeline;
+                if (shm_client_write(conn->shm, request, request_len) < 0) {
+                    fprintf(stderr, "Write error\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < self->connections; i++) {
+        shm_client_close(conns[i].shm);
+        free(conns[i].pending);
+    }
+    free(conns);
+    return NULL;
+}
+
+static void *bench_thread(void *arg) {
+    BenchThread *self = (BenchThread *)arg;
+    int epoll_fd = epoll_create1(0);
+    BenchConn *conns = calloc(self->connections, sizeof(BenchConn));
+    long issued = 0;
+    self->latencies = malloc((self->requests / config.pipeline + self->connections + 1) * sizeof(double));
+
+    for (int i = 0; i < self->connections; i++) {
+        conns[i].fd = connect_to_server();
+        if (conns[i].fd < 0) {
+            perror("connect");
+            exit(EXIT_FAILURE);
+        }
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = &conns[i] };
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conns[i].fd, &event);
+    }
+
+    // Only time request traffic, not connection setup
+    if (pthread_barrier_wait(&connected_barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+        start_time = now_seconds();
+    }
+
+    for (int i = 0; i < self->connections; i++) {
+        if (issued < self->requests) {
+            conns[i].in_flight = config.pipeline;
+            conns[i].sent_at = now_seconds();
+            issued += config.pipeline;
+            send_request(&conns[i]);
+        }
+    }
+
+    struct epoll_event events[256];
+    while (self->completed < self->requests) {
+        int ready = epoll_wait(epoll_fd, events, 256, 1000);
+        for (int i = 0; i < ready; i++) {
+            BenchConn *conn = events[i].data.ptr;
+            int done = read_replies(conn, self);
+            if (done < 0) {
+                fprintf(stderr, "Connection error\n");
+                exit(EXIT_FAILURE);
+            }
+            if (done == 0) {
+                continue;
+            }
+
+            self->completed += done;
+            conn->in_flight -= done;
+            if (conn->in_flight > 0) {
+                continue;
+            }
+            double now = now_seconds();
+            self->latencies[self->latency_count++] = (now - conn->sent_at) * 1e6;
+            if (issued < self->requests) {
+                conn->in_flight = config.pipeline;
+                conn->sent_at = now;
+                conn->write_offset = 0;
+                issued += config.pipeline;
+                if (send_request(conn) < 0) {
+                    fprintf(stderr, "Write error\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < self->connections; i++) {
+        close(conns[i].fd);
+        free(conns[i].pending);
+    }
+    free(conns);
+    close(epoll_fd);
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// p-th percentile of sorted values
+static double percentile(const double *sorted, long count, double p) {
+    long index = (long)(p / 100.0 * (count - 1) + 0.5);
+    return sorted[index];
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [-h host] [-p port] [-c clients] [-n requests] [-t threads]\n"
+            "          [-T ping|set|get|mget] [-d value_size] [-k keys] [-P pipeline]\n"
+            "          [-s unix_socket] [-m shm_socket] [-B]\n",
+            program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    config.host = "127.0.0.1";
+    config.port = 6379;
+    config.socket_path = NULL;
+    config.shm_path = NULL;
+    config.clients = 50;
+    config.requests = 100000;
+    config.threads = 4;
+    config.test = "ping";
+    config.value_size = 3;
+    config.keys = 100;
+    config.pipeline = 1;
+    config.binary = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:c:n:t:T:d:k:P:s:m:B")) != -1) {
+        switch (opt) {
+        case 'h': config.host = optarg; break;
+        case 'p': config.port = atoi(optarg); break;
+        case 'c': config.clients = atoi(optarg); break;
+        case 'n': config.requests = atol(optarg); break;
+        case 't': config.threads = atoi(optarg); break;
+        case 'T': config.test = optarg; break;
+        case 'd': config.value_size = atoi(optarg); break;
+        case 'k': config.keys = atoi(optarg); break;
+        case 'P': config.pipeline = atoi(optarg); break;
+        case 's': config.socket_path = optarg; break;
+        case 'm': config.shm_path = optarg; break;
+        case 'B': config.binary = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (config.clients <= 0 || config.threads <= 0 || config.requests <= 0 || config.pipeline <= 0 ||
+        config.keys <= 0) {
+        usage(argv[0]);
+    }
+    if (config.threads > config.clients) {
+        config.threads = config.clients;
+    }
+    if (build_request() != 0) {
+        return EXIT_FAILURE;
+    }
+    // The shared-memory transport has no connection to set them up with
+    if (strcmp(config.test, "mget") == 0 && !config.shm_path && populate_keys() != 0) {
+        return EXIT_FAILURE;
+    }
+
+    BenchThread *threads = calloc(config.threads, sizeof(BenchThread));
+    for (int i = 0; i < config.threads; i++) {
+        threads[i].connections = config.clients / config.threads + (i < config.clients % config.threads);
+        threads[i].requests = config.requests / config.threads + (i < config.requests % config.threads);
+    }
+
+    pthread_barrier_init(&connected_barrier, NULL, config.threads);
+    for (int i = 0; i < config.threads; i++) {
+        pthread_create(&threads[i].thread, NULL, config.shm_path ? bench_shm_thread : bench_thread, &threads[i]);
+    }
+
+    long completed = 0;
+    int errors = 0;
+    long latency_count = 0;
+    for (int i = 0; i < config.threads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        completed += threads[i].completed;
+        errors += threads[i].errors;
+        latency_count += threads[i].latency_count;
+    }
+    double elapsed = now_seconds() - start_time;
+
+    double *latencies = malloc((latency_count + 1) * sizeof(double));
+    long merged = 0;
+    for (int i = 0; i < config.threads; i++) {
+        memcpy(latencies + merged, threads[i].latencies, threads[i].latency_count * sizeof(double));
+        merged += threads[i].latency_count;
+        free(threads[i].latencies);
+    }
+    qsort(latencies, latency_count, sizeof(double), compare_double);
+
+    printf("%s%s over %s: %ld requests, %d clients, pipeline %d, %.2f s, %.0f requests/s",
+           config.test, config.binary ? " (binary)" : "", config.shm_path ? "shared memory" : config.socket_path ? "unix socket" : "tcp",
+           completed, config.clients,
+           config.pipeline, elapsed, completed / elapsed);
+    if (errors) {
+        printf(" (%d error replies)", errors);
+    }
+    printf("\n");
+    if (latency_count > 0) {
+        printf("  latency (us): p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+               percentile(latencies, latency_count, 50.0), percentile(latencies, latency_count, 99.0),
+               percentile(latencies, latency_count, 99.9), latencies[latency_count - 1]);
+    }
+
+    free(latencies);
+    free(threads);
+    free(request);
+    return 0;
+}
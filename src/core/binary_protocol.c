@@ -0,0 +1,71 @@
+#include "binary_protocol.h"
+
+static const char *opcode_names[BINARY_OP_COUNT] = {
+    [BINARY_OP_PING] = "PING",
+    [BINARY_OP_ECHO] = "ECHO",
+    [BINARY_OP_GET] = "GET",
+    [BINARY_OP_SET] = "SET",
+    [BINARY_OP_DEL] = "DEL",
+    [BINARY_OP_MGET] = "MGET",
+    [BINARY_OP_INCR] = "INCR",
+    [BINARY_OP_EXPIRE] = "EXPIRE",
+    [BINARY_OP_SETEX] = "SETEX",
+    [BINARY_OP_GETEX] = "GETEX",
+    [BINARY_OP_GETTTL] = "GETTTL",
+    [BINARY_OP_BULK_SET] = "BULK_SET",
+    [BINARY_OP_BULK_GET] = "BULK_GET",
+    [BINARY_OP_SETV] = "SETV",
+    [BINARY_OP_HISTORY] = "HISTORY",
+};
+
+const char *binary_opcode_name(unsigned opcode) {
+    return opcode < BINARY_OP_COUNT ? opcode_names[opcode] : NULL;
+}
+
+long binary_reply_length(const char *buf, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+
+    switch (buf[0]) {
+    case '_':
+        return 1;
+    case '#':
+        return len >= 2 ? 2 : 0;
+    case ':':
+    case ',':
+        return len >= 9 ? 9 : 0;
+    case '+':
+    case '-':
+    case '$': {
+        if (len < 5) {
+            return 0;
+        }
+        size_t total = 5 + (size_t)binary_get_u32(buf + 1);
+        return total <= len ? (long)total : 0;
+    }
+    case '*':
+    case '~':
+    case '>':
+    case '%': {
+        if (len < 5) {
+            return 0;
+        }
+        uint64_t count = binary_get_u32(buf + 1);
+        if (buf[0] == '%') {
+            count *= 2;
+        }
+        size_t total = 5;
+        for (uint64_t i = 0; i < count; i++) {
+            long element = binary_reply_length(buf + total, len - total);
+            if (element <= 0) {
+                return element;
+            }
+            total += element;
+        }
+        return (long)total;
+    }
+    default:
+        return -1;
+    }
+}
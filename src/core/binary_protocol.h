@@ -0,0 +1,106 @@
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+// Length-prefixed binary framing, served on the same ports as RESP for
+// service-to-service traffic. A client that starts with BINARY_MAGIC
+// speaks it for the rest of the connection; anything else is RESP. There
+// is no ASCII to parse and no delimiter to search for: every length is
+// known before the bytes it covers arrive. All integers are little-endian.
+//
+// Request: a 12-byte header, then the body.
+//
+//   0  u8   magic      BINARY_MAGIC
+//   1  u8   version    BINARY_VERSION
+//   2  u16  opcode     BinaryOpcode
+//   4  u32  argc       Arguments in the body
+//   8  u32  body_len   Bytes after the header
+//
+// The body holds argc u32 argument lengths, then the arguments in order,
+// each followed by a zero byte not counted in its length, so the server can
+// pass arguments to commands in place. With BINARY_OP_COMMAND the first
+// argument is the command name; any other opcode names the command itself
+// and the arguments are the ones after the name.
+//
+// Reply: a type byte, using the RESP3 type characters, and then
+//
+//   '+' simple string, '-' error, '$' bulk   u32 length, then the bytes
+//   ':' integer                              i64
+//   ',' double                               IEEE 754 binary64
+//   '#' boolean                              u8, 0 or 1
+//   '_' null                                 nothing
+//   '*' array, '~' set, '>' push             u32 count, then the elements
+//   '%' map                                  u32 pairs, then key, value, ...
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BINARY_MAGIC 0xB5        // Not ASCII, so never the start of a RESP or inline command
+#define BINARY_VERSION 1
+#define BINARY_HEADER_SIZE 12
+#define BINARY_REPLY_HEADER_MAX 9   // Type byte plus the largest fixed field
+
+typedef enum {
+    BINARY_OP_COMMAND = 0,   // Name in the first argument; reaches every command
+    BINARY_OP_PING,
+    BINARY_OP_ECHO,
+    BINARY_OP_GET,
+    BINARY_OP_SET,
+    BINARY_OP_DEL,
+    BINARY_OP_MGET,
+    BINARY_OP_INCR,
+    BINARY_OP_EXPIRE,
+    BINARY_OP_SETEX,
+    BINARY_OP_GETEX,
+    BINARY_OP_GETTTL,
+    BINARY_OP_BULK_SET,
+    BINARY_OP_BULK_GET,
+    BINARY_OP_SETV,
+    BINARY_OP_HISTORY,
+    BINARY_OP_COUNT
+} BinaryOpcode;
+
+static inline void binary_put_u16(char *p, uint16_t value) {
+    p[0] = (char)value;
+    p[1] = (char)(value >> 8);
+}
+
+static inline void binary_put_u32(char *p, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (char)(value >> (8 * i));
+    }
+}
+
+static inline void binary_put_u64(char *p, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (char)(value >> (8 * i));
+    }
+}
+
+static inline uint16_t binary_get_u16(const char *p) {
+    return (uint16_t)((unsigned char)p[0] | (unsigned char)p[1] << 8);
+}
+
+static inline uint32_t binary_get_u32(const char *p) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--) {
+        value = value << 8 | (unsigned char)p[i];
+    }
+    return value;
+}
+
+static inline uint64_t binary_get_u64(const char *p) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = value << 8 | (unsigned char)p[i];
+    }
+    return value;
+}
+
+// Command name of an opcode, NULL for BINARY_OP_COMMAND and unknown ones
+const char *binary_opcode_name(unsigned opcode);
+
+// Length of the first complete reply in buf, aggregates included; 0 if
+// more bytes are needed, -1 if it is malformed
+long binary_reply_length(const char *buf, size_t len);
+
+#endif // BINARY_PROTOCOL_H
@@ -7,20 +7,35 @@
 #include "../replication/replconf.h"
 #include "../replication/buffer.h" 
 #include "../persistence/sdb.h"
+#include "epoch.h"
+#include "key_index.h"
+#include "slab.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <time.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <pthread.h>
 #include "../../include/uthash.h"
 
 
-static pthread_mutex_t set_table_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t versioned_set_table_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t command_table_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// Off when a single thread runs every command (--io threaded, or each
+// thread owning a partition)
+static int keyspace_locking = 1;
+
+void set_keyspace_locking(int enabled) {
+    keyspace_locking = enabled;
+}
+
 #define MAX_DATABASES 16
+#define KEYSPACE_STRIPES 64   // Independently locked slices per partition, at most 64
+#define KEYSPACE_REHASH_CRON_GROUPS 1024   // Index groups a background tick copies per stripe
+#define SET_ENTRY_INLINE_VALUE 64   // Longest value stored inside its entry
+#define COMMAND_NAME_MAX 32         // Longest command name, terminator included
 
 struct SetEntryDB *db_table[MAX_DATABASES] = {NULL};
 
@@ -42,31 +57,64 @@ struct VersionedSetEntryDB {
 };
 // Hashtable entry for commands
 typedef struct CommandEntry {
-    char name[MAX_BULK_LENGTH]; // Command name (key)
+    char name[COMMAND_NAME_MAX]; // Command name (key)
     CommandHandler handler;      // Command handler (value)
+    CommandRoute route;          // Where its keys are
     UT_hash_handle hh;           // Hashtable handle
 } CommandEntry;
 
 static CommandEntry *command_table = NULL; // Global command hashtable
 
-// Hashtable entry for SET key-value pairs
+// Key-value pair in a stripe's index. GET reads entries without a lock, so
+// once an entry is published only its expiration may change (atomically);
+// a new value means a new entry replacing the old one.
+//
+// Key and value are binary-safe and sized to fit, in a single allocation:
+// the key, then a value of up to SET_ENTRY_INLINE_VALUE bytes or else a
+// pointer to one allocated on its own. Both are NUL-terminated for handlers
+// that still parse them as strings.
 struct SetEntry {
-    char key[MAX_BULK_LENGTH];    // Key
-    char value[MAX_BULK_LENGTH];  // Value
+    KeyIndexNode node;            // Hash and key for the index; first, so nodes cast back to entries
     time_t expiration;            // Expiration timestamp (0 if no expiration)
-    UT_hash_handle hh;            // Hashtable handle
+    uint32_t value_len;
+    char key[];
 };
 
-static struct SetEntry *set_table = NULL; // Global key-value hashtable
 
 
+// One version of a SETV key. Key and value are binary-safe and follow the
+// struct in the same allocation.
 struct VersionedSetEntry {
-    char key[MAX_BULK_LENGTH];           // Key of the versioned entry
-    char value[MAX_BULK_LENGTH];         // Value of the versioned entry
     struct VersionedSetEntry *next;      // Linked list to keep version history
     UT_hash_handle hh;                   // Hash handle used by uthash
+    uint32_t key_len;
+    uint32_t value_len;
+    char data[];                         // Key, then value
 };
-struct VersionedSetEntry *versioned_set_table = NULL;
+
+// A slice of the keyspace with its own lock, so commands on keys in
+// different stripes never wait for each other. Cache line aligned to keep
+// neighbouring locks from sharing a line.
+typedef struct KeyspaceStripe {
+    pthread_mutex_t lock;         // Held by writers; GET only enters an epoch
+    KeyIndex set_index;
+    struct VersionedSetEntry *versioned_set_table;
+} __attribute__((aligned(64))) KeyspaceStripe;
+
+// Stripes held by a multi-key command, one bit per stripe index
+typedef uint64_t StripeSet;
+
+// The keyspace is a single partition shared by every thread, or one per
+// event loop with --partitioned-keyspace. Handlers work on the stripes of
+// the partition the calling thread has selected.
+typedef struct KeyspacePartition {
+    KeyspaceStripe stripes[KEYSPACE_STRIPES];
+} KeyspacePartition;
+
+static KeyspacePartition shared_partition;
+static KeyspacePartition *partitions = &shared_partition;
+static int partition_count = 1;
+static __thread KeyspacePartition *current_partition = &shared_partition;
 
 
 // Data structure to store time-series data
@@ -103,36 +151,282 @@ void set_database(int db_id, struct SetEntryDB *new_db) {
 
 
 static int is_key_expired(struct SetEntry *entry);
-static void delete_key(struct SetEntry *entry);
+static void delete_key(KeyspaceStripe *stripe, struct SetEntry *entry);
+
+// FNV-1a, so every thread agrees on where a key lives. The low bits pick
+// the partition and the high bits the stripe within it.
+static uint64_t key_hash(const char *key, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static int stripe_index(uint64_t hash) {
+    return (int)((hash >> 32) % KEYSPACE_STRIPES);
+}
+
+static void init_partition(KeyspacePartition *partition) {
+    for (int i = 0; i < KEYSPACE_STRIPES; i++) {
+        pthread_mutex_init(&partition->stripes[i].lock, NULL);
+        if (key_index_init(&partition->stripes[i].set_index) != 0) {
+            fprintf(stderr, "Error: Failed to allocate keyspace index.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void lock_stripe(KeyspaceStripe *stripe) {
+    if (keyspace_locking) {
+        pthread_mutex_lock(&stripe->lock);
+    }
+}
+
+static void unlock_stripe(KeyspaceStripe *stripe) {
+    if (keyspace_locking) {
+        pthread_mutex_unlock(&stripe->lock);
+    }
+}
+
+// Stripe of a key, without locking it; for commands holding a StripeSet
+static KeyspaceStripe *key_stripe(const RedisString *key) {
+    return &current_partition->stripes[stripe_index(key_hash(key->data, key->length))];
+}
+
+// Lock and return the stripe holding key
+static KeyspaceStripe *lock_key(const RedisString *key) {
+    KeyspaceStripe *stripe = key_stripe(key);
+    lock_stripe(stripe);
+    return stripe;
+}
+
+// Lock the stripes of keys cmd->argv[first], argv[first + step], ... up
+// to argv[last] in ascending stripe order, so two multi-key commands can
+// never deadlock
+static StripeSet lock_keys(RedisCommand *cmd, int first, int last, int step) {
+    StripeSet held = 0;
+    for (int i = first; i <= last; i += step) {
+        held |= (StripeSet)1 << stripe_index(key_hash(cmd->argv[i].data, cmd->argv[i].length));
+    }
+    for (int i = 0; i < KEYSPACE_STRIPES; i++) {
+        if (held & ((StripeSet)1 << i)) {
+            lock_stripe(&current_partition->stripes[i]);
+        }
+    }
+    return held;
+}
+
+static void unlock_keys(StripeSet held) {
+    for (int i = 0; i < KEYSPACE_STRIPES; i++) {
+        if (held & ((StripeSet)1 << i)) {
+            unlock_stripe(&current_partition->stripes[i]);
+        }
+    }
+}
+
+// Lock-free readers need an epoch, unless one thread owns the keyspace
+static inline void read_begin(void) {
+    if (keyspace_locking) {
+        epoch_enter();
+    }
+}
+
+static inline void read_end(void) {
+    if (keyspace_locking) {
+        epoch_exit();
+    }
+}
+
+static char *entry_value(const struct SetEntry *entry) {
+    char *value = (char *)entry->key + entry->node.key_len + 1;
+    if (entry->value_len > SET_ENTRY_INLINE_VALUE) {
+        memcpy(&value, value, sizeof(value));   // Not aligned
+    }
+    return value;
+}
+
+static size_t entry_size(size_t key_len, size_t value_len) {
+    return offsetof(struct SetEntry, key) + key_len + 1 +
+           (value_len <= SET_ENTRY_INLINE_VALUE ? value_len + 1 : sizeof(char *));
+}
+
+static void free_entry(void *ptr) {
+    struct SetEntry *entry = (struct SetEntry *)ptr;
+    if (entry->value_len > SET_ENTRY_INLINE_VALUE) {
+        slab_free(entry_value(entry), entry->value_len + 1);
+    }
+    slab_free(entry, entry_size(entry->node.key_len, entry->value_len));
+}
+
+// Free an unlinked entry once no lock-free reader can still hold it
+static void retire_entry(struct SetEntry *entry) {
+    if (keyspace_locking) {
+        epoch_retire(entry, free_entry);
+    } else {
+        free_entry(entry);
+    }
+}
+
+static struct SetEntry *find_entry(KeyspaceStripe *stripe, const char *key, size_t key_len) {
+    return (struct SetEntry *)key_index_find(&stripe->set_index, key_hash(key, key_len), key, key_len);
+}
+
+// find_entry() for a key whose stripe is not known yet, hashing it once
+// for both; the stripe is returned in *stripe
+static struct SetEntry *find_key(const RedisString *key, KeyspaceStripe **stripe) {
+    uint64_t hash = key_hash(key->data, key->length);
+    *stripe = &current_partition->stripes[stripe_index(hash)];
+    return (struct SetEntry *)key_index_find(&(*stripe)->set_index, hash, key->data, key->length);
+}
+
+// A new, unpublished entry holding copies of key and value
+static struct SetEntry *create_entry(const char *key, size_t key_len, const char *value, size_t value_len) {
+    int inline_value = value_len <= SET_ENTRY_INLINE_VALUE;
+    if (key_len > UINT32_MAX || value_len > UINT32_MAX) {
+        return NULL;
+    }
+    struct SetEntry *entry = slab_alloc(entry_size(key_len, value_len));
+    if (!entry) {
+        return NULL;
+    }
+    char *stored = entry->key + key_len + 1;
+    if (!inline_value) {
+        char *out_of_line = slab_alloc(value_len + 1);
+        if (!out_of_line) {
+            slab_free(entry, entry_size(key_len, value_len));
+            return NULL;
+        }
+        memcpy(stored, &out_of_line, sizeof(out_of_line));
+        stored = out_of_line;
+    }
+    memcpy(entry->key, key, key_len);
+    entry->key[key_len] = '\0';
+    memcpy(stored, value, value_len);
+    stored[value_len] = '\0';
+    entry->value_len = (uint32_t)value_len;
+    entry->expiration = 0;
+    entry->node.hash = key_hash(key, key_len);
+    entry->node.key_len = (uint32_t)key_len;
+    entry->node.key_offset = offsetof(struct SetEntry, key);
+    return entry;
+}
+
+// Publish entry in its stripe, replacing any entry with the same key.
+// Caller holds the stripe lock.
+static void store_entry(KeyspaceStripe *stripe, struct SetEntry *entry) {
+    struct SetEntry *old = (struct SetEntry *)key_index_find(&stripe->set_index, entry->node.hash,
+                                                             entry->key, entry->node.key_len);
+    if (old) {
+        key_index_replace(&stripe->set_index, &old->node, &entry->node);
+        retire_entry(old);
+    } else {
+        key_index_insert(&stripe->set_index, &entry->node);
+    }
+}
+
+static time_t entry_expiration(const struct SetEntry *entry) {
+    return __atomic_load_n(&entry->expiration, __ATOMIC_RELAXED);
+}
+
+static void set_entry_expiration(struct SetEntry *entry, time_t expiration) {
+    __atomic_store_n(&entry->expiration, expiration, __ATOMIC_RELAXED);
+}
+
+static struct VersionedSetEntry *create_versioned_entry(const char *key, size_t key_len,
+                                                        const char *value, size_t value_len) {
+    if (key_len > UINT32_MAX || value_len > UINT32_MAX) {
+        return NULL;
+    }
+    struct VersionedSetEntry *entry = slab_alloc(sizeof(struct VersionedSetEntry) + key_len + value_len);
+    if (!entry) {
+        return NULL;
+    }
+    entry->next = NULL;
+    entry->key_len = (uint32_t)key_len;
+    entry->value_len = (uint32_t)value_len;
+    memcpy(entry->data, key, key_len);
+    memcpy(entry->data + key_len, value, value_len);
+    return entry;
+}
+
+static void free_versioned_entry(struct VersionedSetEntry *entry) {
+    slab_free(entry, sizeof(struct VersionedSetEntry) + entry->key_len + entry->value_len);
+}
 
 
 // extern ReplicationState *repl_state; 
 
-// Register a command
-// Precompute uppercase command names during registration
-void register_command(const char *name, CommandHandler handler) {
+// Split the keyspace into count partitions. Call before serving clients;
+// every thread that runs commands must then select its partition.
+int init_keyspace_partitions(int count) {
+    if (count <= 1) {
+        return 0;
+    }
+    KeyspacePartition *split = aligned_alloc(64, count * sizeof(KeyspacePartition));
+    if (!split) {
+        fprintf(stderr, "Error: Failed to allocate keyspace partitions.\n");
+        return -1;
+    }
+    memset(split, 0, count * sizeof(KeyspacePartition));
+    for (int i = 0; i < count; i++) {
+        init_partition(&split[i]);
+    }
+    partitions = split;
+    partition_count = count;
+    current_partition = &partitions[0];
+    return 0;
+}
+
+int keyspace_partition_count(void) {
+    return partition_count;
+}
+
+// Make the calling thread's handlers work on the given partition
+void keyspace_select_partition(int partition) {
+    current_partition = &partitions[partition];
+}
+
+int keyspace_partition_of(const char *key, size_t len) {
+    return (int)(key_hash(key, len) % (uint64_t)partition_count);
+}
+
+// Register a command whose keys are at argv[first_key], argv[first_key +
+// key_step], ... up to argv[last_key] (-1 for the last argument). A
+// first_key of 0 means the command has no keys. Command names are stored
+// in uppercase.
+void register_keyed_command(const char *name, CommandHandler handler, int first_key, int last_key,
+                            int key_step, GatherMode gather, int broadcast) {
     CommandEntry *entry = malloc(sizeof(CommandEntry));
     if (!entry) {
         fprintf(stderr, "Error: Failed to allocate memory for command '%s'.\n", name);
         exit(EXIT_FAILURE);
     }
-    memset(entry->name, 0, MAX_BULK_LENGTH);  // Ensure the name array is null-terminated
-    for (int i = 0; name[i] && i < MAX_BULK_LENGTH - 1; i++) {
+    memset(entry->name, 0, COMMAND_NAME_MAX);  // Ensure the name array is null-terminated
+    for (int i = 0; name[i] && i < COMMAND_NAME_MAX - 1; i++) {
         entry->name[i] = toupper(name[i]);
     }
     entry->handler = handler;
+    entry->route.first_key = first_key;
+    entry->route.last_key = last_key;
+    entry->route.key_step = key_step;
+    entry->route.gather = gather;
+    entry->route.broadcast = broadcast;
     HASH_ADD_STR(command_table, name, entry);
 }
 
+// Register a command that takes no keys
+void register_command(const char *name, CommandHandler handler) {
+    register_keyed_command(name, handler, 0, 0, 0, GATHER_NONE, 0);
+}
+
 // Command handlers
 void handle_ping(int client_socket, RedisCommand *cmd) {
     if (cmd->argc == 1) {
-        send_redis_string(client_socket, "PONG");
+        send_redis_pong(client_socket);
     } else {
-        char response[MAX_BULK_LENGTH];
-        strncpy(response, cmd->argv[1].data, cmd->argv[1].length);
-        response[cmd->argv[1].length] = '\0';
-        send_redis_bulk_string(client_socket, response);
+        send_redis_bulk(client_socket, cmd->argv[1].data, cmd->argv[1].length);
     }
 }
 
@@ -140,11 +434,48 @@ void handle_echo(int client_socket, RedisCommand *cmd) {
     if (cmd->argc < 2) {
         send_redis_error(client_socket, "wrong number of arguments for 'echo' command");
     } else {
-        char response[MAX_BULK_LENGTH];
-        strncpy(response, cmd->argv[1].data, cmd->argv[1].length);
-        response[cmd->argv[1].length] = '\0';
-        send_redis_bulk_string(client_socket, response);
+        send_redis_bulk(client_socket, cmd->argv[1].data, cmd->argv[1].length);
+    }
+}
+
+// HELLO [protover [AUTH username password] [SETNAME clientname]]: pick the
+// client's reply encoding and describe the server. There are no users or
+// client names, so AUTH and SETNAME are accepted and ignored.
+void handle_hello(int client_socket, RedisCommand *cmd) {
+    long long version = get_reply_protocol();
+    // Binary framing is chosen by the first byte and kept for the connection
+    if (cmd->argc >= 2 && version == RESP_PROTOCOL_BINARY) {
+        send_redis_error_code(client_socket, "NOPROTO", "binary clients cannot switch protocol");
+        return;
+    }
+    if (cmd->argc >= 2 && (redis_string_to_long(&cmd->argv[1], &version) != 0 ||
+                           version < RESP_PROTOCOL_2 || version > RESP_PROTOCOL_3)) {
+        send_redis_error_code(client_socket, "NOPROTO", "unsupported protocol version");
+        return;
     }
+    for (int i = 2; i < cmd->argc; i++) {
+        if (redis_string_equals(&cmd->argv[i], "AUTH") && i + 2 < cmd->argc) {
+            i += 2;
+        } else if (redis_string_equals(&cmd->argv[i], "SETNAME") && i + 1 < cmd->argc) {
+            i++;
+        } else {
+            send_redis_error(client_socket, "syntax error in HELLO option");
+            return;
+        }
+    }
+
+    set_reply_protocol((int)version);
+    send_redis_map(client_socket, 5);
+    send_redis_bulk_string(client_socket, "server");
+    send_redis_bulk_string(client_socket, "swiftdb");
+    send_redis_bulk_string(client_socket, "proto");
+    send_redis_integer(client_socket, version);
+    send_redis_bulk_string(client_socket, "mode");
+    send_redis_bulk_string(client_socket, partition_count > 1 ? "partitioned" : "standalone");
+    send_redis_bulk_string(client_socket, "role");
+    send_redis_bulk_string(client_socket, "master");
+    send_redis_bulk_string(client_socket, "modules");
+    send_redis_array(client_socket, 0);
 }
 
 void handle_set(int client_socket, RedisCommand *cmd) {
@@ -164,22 +495,28 @@ void handle_set(int client_socket, RedisCommand *cmd) {
     const char *value = cmd->argv[2].data;
     size_t key_len = cmd->argv[1].length;
     size_t value_len = cmd->argv[2].length;
-    int expiration = 0;
-    int cas_value = -1; // Default: No CAS
+    long long expiration = 0;
+    long long cas_value = -1; // Default: No CAS
 
     // Check for optional arguments like EX, NX, XX, COND, CAS
     for (int i = 3; i < cmd->argc; i++) {
-        if (strncmp(cmd->argv[i].data, "EX", 2) == 0) {
+        if (redis_string_equals(&cmd->argv[i], "EX")) {
             if (i + 1 < cmd->argc) {
-                expiration = atoi(cmd->argv[i + 1].data);
+                if (redis_string_to_long(&cmd->argv[i + 1], &expiration) != 0) {
+                    send_redis_error(client_socket, "value is not an integer or out of range");
+                    return;
+                }
                 i++; // Skip next argument (expiration time)
             } else {
                 send_redis_error(client_socket, "Missing expiration time for EX");
                 return;
             }
-        } else if (strncmp(cmd->argv[i].data, "CAS", 3) == 0) {
+        } else if (redis_string_equals(&cmd->argv[i], "CAS")) {
             if (i + 1 < cmd->argc) {
-                cas_value = atoi(cmd->argv[i + 1].data);
+                if (redis_string_to_long(&cmd->argv[i + 1], &cas_value) != 0) {
+                    send_redis_error(client_socket, "value is not an integer or out of range");
+                    return;
+                }
                 i++; // Skip the expected value argument
             } else {
                 send_redis_error(client_socket, "CAS requires a value");
@@ -189,49 +526,41 @@ void handle_set(int client_socket, RedisCommand *cmd) {
         // ... other options handling ...
     }
 
-    // Handle CAS: Ensure atomicity
-    pthread_mutex_lock(&set_table_mutex);
-    struct SetEntry *entry;
-    HASH_FIND(hh, set_table, key, key_len, entry);
-    
-    if (cas_value != -1 && (!entry || atoi(entry->value) != cas_value)) {
-        pthread_mutex_unlock(&set_table_mutex);
-        send_redis_error(client_socket, "CAS failed: value does not match");
+    // The replacement is built before taking the lock
+    struct SetEntry *entry = create_entry(key, key_len, value, value_len);
+    if (!entry) {
+        send_redis_error(client_socket, "Out of memory");
         return;
     }
 
-    // Add or update key-value pair
-    if (entry) {
-        strncpy(entry->value, value, MAX_BULK_LENGTH - 1);
-        entry->value[MAX_BULK_LENGTH - 1] = '\0';
-    } else {
-        entry = malloc(sizeof(struct SetEntry));
-        if (!entry) {
-            pthread_mutex_unlock(&set_table_mutex);
-            send_redis_error(client_socket, "Out of memory");
-            return;
-        }
-        strncpy(entry->key, key, key_len);
-        entry->key[key_len] = '\0';
-        strncpy(entry->value, value, value_len);
-        entry->value[value_len] = '\0';
-        entry->expiration = 0;
-        HASH_ADD_KEYPTR(hh, set_table, entry->key, key_len, entry);
+    // Handle CAS: Ensure atomicity. The entry already carries the key's hash.
+    KeyspaceStripe *stripe = &current_partition->stripes[stripe_index(entry->node.hash)];
+    lock_stripe(stripe);
+    struct SetEntry *old = (struct SetEntry *)key_index_find(&stripe->set_index, entry->node.hash, key, key_len);
+
+    if (cas_value != -1 && (!old || atoi(entry_value(old)) != cas_value)) {
+        unlock_stripe(stripe);
+        free_entry(entry);
+        send_redis_error(client_socket, "CAS failed: value does not match");
+        return;
     }
 
-    // Handle expiration (EX)
+    // Add or replace the key-value pair, keeping any TTL unless EX is given
     if (expiration > 0) {
         entry->expiration = time(NULL) + expiration;
+    } else if (old) {
+        entry->expiration = entry_expiration(old);
     }
+    store_entry(stripe, entry);
 
-    pthread_mutex_unlock(&set_table_mutex);
+    unlock_stripe(stripe);
 
     // If we're the master, propagate to slaves
     // if (repl_state && repl_state->role == ROLE_MASTER) {
     //     propagate_command_to_slaves(cmd);
     // }
 
-    send_redis_string(client_socket, "OK");
+    send_redis_ok(client_socket);
 }
 
 
@@ -241,47 +570,47 @@ void handle_get(int client_socket, RedisCommand *cmd) {
         return;
     }
 
-    char key[MAX_BULK_LENGTH];
-    strncpy(key, cmd->argv[1].data, cmd->argv[1].length);
-    key[cmd->argv[1].length] = '\0';
+    const RedisString *arg = &cmd->argv[1];
+    uint64_t hash = key_hash(arg->data, arg->length);
+    KeyspaceStripe *stripe = &current_partition->stripes[stripe_index(hash)];
 
-    pthread_mutex_lock(&set_table_mutex);
-
-    struct SetEntry *entry;
-    HASH_FIND_STR(set_table, key, entry);
-
-    // Check if the key is expired
-    if (entry && is_key_expired(entry)) {
-        HASH_DEL(set_table, entry);
-        free(entry);
-        entry = NULL;
-    }
-
-    // Return value if found in memory
-    if (entry) {
-        send_redis_bulk_string(client_socket, entry->value);
-        pthread_mutex_unlock(&set_table_mutex);
+    // No lock: the entry's value cannot change and it is not freed before
+    // read_end()
+    read_begin();
+    struct SetEntry *entry = (struct SetEntry *)key_index_find(&stripe->set_index, hash, arg->data, arg->length);
+    int expired = entry && is_key_expired(entry);
+    if (entry && !expired) {
+        send_redis_bulk(client_socket, entry_value(entry), entry->value_len);
+        read_end();
         return;
     }
+    read_end();
 
-    pthread_mutex_unlock(&set_table_mutex);
+    // Drop the expired entry, unless a writer replaced it meanwhile
+    if (expired) {
+        lock_stripe(stripe);
+        entry = find_entry(stripe, arg->data, arg->length);
+        if (entry && is_key_expired(entry)) {
+            delete_key(stripe, entry);
+        }
+        unlock_stripe(stripe);
+    }
 
     // If not found in memory, try reading from SDB
     SDBEntry sdb_entry;
-    if (read_from_sdb(key, &sdb_entry) == 0) {
+    if (read_from_sdb(arg->data, &sdb_entry) == 0) {
         // Add to in-memory cache
-        entry = malloc(sizeof(struct SetEntry));
+        entry = create_entry(sdb_entry.key, strnlen(sdb_entry.key, sizeof(sdb_entry.key)),
+                             sdb_entry.value, strnlen(sdb_entry.value, sizeof(sdb_entry.value)));
         if (entry) {
-            strncpy(entry->key, sdb_entry.key, MAX_BULK_LENGTH);
-            strncpy(entry->value, sdb_entry.value, MAX_BULK_LENGTH);
             entry->expiration = sdb_entry.ttl ? time(NULL) + sdb_entry.ttl : 0; // Calculate expiration
-            pthread_mutex_lock(&set_table_mutex);
-            HASH_ADD_STR(set_table, key, entry);
-            pthread_mutex_unlock(&set_table_mutex);
+            lock_stripe(stripe);
+            store_entry(stripe, entry);
+            unlock_stripe(stripe);
         }
         send_redis_bulk_string(client_socket, sdb_entry.value);
     } else {
-        send_redis_bulk_string(client_socket, "nil");
+        send_redis_null(client_socket);
     }
 }
 
@@ -294,52 +623,35 @@ void handle_setex(int client_socket, RedisCommand *cmd) {
         return;
     }
 
-    char key[MAX_BULK_LENGTH], value[MAX_BULK_LENGTH];
     int expiration_time;
 
-    // Extract key, value, and expiration time from the command
-    strncpy(key, cmd->argv[1].data, cmd->argv[1].length);
-    key[cmd->argv[1].length] = '\0';
-
-    strncpy(value, cmd->argv[2].data, cmd->argv[2].length);
-    value[cmd->argv[2].length] = '\0';
-
+    // Extract expiration time from the command
     expiration_time = atoi(cmd->argv[3].data);  // Convert expiration time to integer
 
     // Get current time and calculate expiration time
     time_t current_time = time(NULL);
     time_t expiration_timestamp = current_time + expiration_time;
 
-    struct SetEntry *entry;
-    HASH_FIND_STR(set_table, key, entry);
-
-    if (entry && is_key_expired(entry)) {
-        delete_key(entry);
-        send_redis_bulk_string(client_socket, "nil");
-        strncpy(entry->value, value, MAX_BULK_LENGTH);
-        entry->expiration = expiration_timestamp;  // Update expiration time
-        return;
-    } else {
-        entry = malloc(sizeof(struct SetEntry));
-        if (!entry) {
-            fprintf(stderr, "Error: Memory allocation failed for command registration.\n");
-            exit(EXIT_FAILURE);  // Exit gracefully or handle the error appropriately
-        }
-        strncpy(entry->key, key, MAX_BULK_LENGTH);
-        strncpy(entry->value, value, MAX_BULK_LENGTH);
-        entry->expiration = expiration_timestamp;
-
-        HASH_ADD_STR(set_table, key, entry);
+    // Replaces any existing entry, expired or not
+    struct SetEntry *entry = create_entry(cmd->argv[1].data, cmd->argv[1].length,
+                                          cmd->argv[2].data, cmd->argv[2].length);
+    if (!entry) {
+        fprintf(stderr, "Error: Memory allocation failed for command registration.\n");
+        exit(EXIT_FAILURE);  // Exit gracefully or handle the error appropriately
     }
+    entry->expiration = expiration_timestamp;
 
+    KeyspaceStripe *stripe = lock_key(&cmd->argv[1]);
+    store_entry(stripe, entry);
+    unlock_stripe(stripe);
 
         // Save to SDB
-    if (save_to_sdb(key, value, expiration_time) != 0) {
+    if (save_to_sdb(cmd->argv[1].data, cmd->argv[2].data, expiration_time) != 0) {
         send_redis_error(client_socket, "Failed to persist data");
         return;
     }
 
-    send_redis_string(client_socket, "OK");
+    send_redis_ok(client_socket);
 }
 
 
@@ -351,34 +663,38 @@ void handle_expire(int client_socket, RedisCommand *cmd) {
         return;
     }
 
-    char key[MAX_BULK_LENGTH];
+    const RedisString *key = &cmd->argv[1];
     int expiration_time;
 
-    // Extract key and expiration time
-    strncpy(key, cmd->argv[1].data, cmd->argv[1].length);
-    key[cmd->argv[1].length] = '\0';
-
+    // Extract expiration time
     expiration_time = atoi(cmd->argv[2].data);  // Convert expiration time to integer
 
+    KeyspaceStripe *stripe = lock_key(key);
     struct SetEntry *entry;
-    HASH_FIND_STR(set_table, key, entry);
+    entry = find_entry(stripe, key->data, key->length);
     if (entry && is_key_expired(entry)) {
+        delete_key(stripe, entry);
+        entry = NULL;
+    }
 
-        delete_key(entry);
-        send_redis_bulk_string(client_socket, "nil");
-        
+    if (entry) {
         // Update expiration time
         time_t current_time = time(NULL);
-        entry->expiration = current_time + expiration_time;
+        set_entry_expiration(entry, current_time + expiration_time);
+
+        // As much of the value as an SDB record holds
+        char value[MAX_VALUE_LENGTH];
+        snprintf(value, sizeof(value), "%s", entry_value(entry));
+        unlock_stripe(stripe);
 
-        if (save_to_sdb(key, entry->value, expiration_time) != 0) {
+        if (save_to_sdb(key->data, value, expiration_time) != 0) {
             send_redis_error(client_socket, "Failed to persist expiration");
             return;
         }
 
         send_redis_integer(client_socket, 1);  // Return 1 for successful expiration update
-        return;
     } else {
+        unlock_stripe(stripe);
         send_redis_integer(client_socket, 0);  // Return 0 if key does not exist
     }
 }
@@ -390,20 +706,26 @@ void handle_incr(int client_socket, RedisCommand *cmd) {
         return;
     }
 
-    char key[MAX_BULK_LENGTH];
-    strncpy(key, cmd->argv[1].data, cmd->argv[1].length);
-    key[cmd->argv[1].length] = '\0';
-
+    KeyspaceStripe *stripe = lock_key(&cmd->argv[1]);
     struct SetEntry *entry;
-    HASH_FIND_STR(set_table, key, entry);
-
-    if (entry) {
-        long value = atol(entry->value);  // Convert value to long
-        value++;  // Increment the value
-        snprintf(entry->value, MAX_BULK_LENGTH, "%ld", value);  // Store back the incremented value
+    entry = find_entry(stripe, cmd->argv[1].data, cmd->argv[1].length);
+
+    long value = entry ? atol(entry_value(entry)) + 1 : 0;  // Increment the value
+    char digits[32];
+    int digits_len = snprintf(digits, sizeof(digits), "%ld", value);
+    struct SetEntry *updated = entry ? create_entry(entry->key, entry->node.key_len, digits, digits_len) : NULL;
+    if (entry && !updated) {
+        unlock_stripe(stripe);
+        send_redis_error(client_socket, "Out of memory");
+    } else if (entry) {
+        // Store the incremented value in a copy
+        updated->expiration = entry_expiration(entry);
+        store_entry(stripe, updated);
+        unlock_stripe(stripe);
 
         send_redis_integer(client_socket, value);  // Return the new incremented value
     } else {
+        unlock_stripe(stripe);
         send_redis_error(client_socket, "key does not exist");
     }
 }
@@ -414,28 +736,27 @@ void handle_mget(int client_socket, RedisCommand *cmd) {
         return;
     }
 
+    StripeSet held = lock_keys(cmd, 1, cmd->argc - 1, 1);
+    begin_reply_batch();
+    send_redis_array(client_socket, cmd->argc - 1);
     for (int i = 1; i < cmd->argc; i++) {
-        char key[MAX_BULK_LENGTH];
-        strncpy(key, cmd->argv[i].data, cmd->argv[i].length);
-        key[cmd->argv[i].length] = '\0';
-
-        struct SetEntry *entry;
-        HASH_FIND_STR(set_table, key, entry);
+        KeyspaceStripe *stripe;
+        struct SetEntry *entry = find_key(&cmd->argv[i], &stripe);
 
         if (entry && is_key_expired(entry)) {
             // Check if the key is expired
-            delete_key(entry);
-            send_redis_bulk_string(client_socket, "nil");
-            
-
+            delete_key(stripe, entry);
+            send_redis_null(client_socket);
+        } else if (entry) {
             // Key exists and is not expired
-            send_redis_bulk_string(client_socket, entry->value);
-            return;
+            send_redis_bulk(client_socket, entry_value(entry), entry->value_len);
         } else {
             // Key does not exist
-            send_redis_bulk_string(client_socket, "nil");
+            send_redis_null(client_socket);
         }
     }
+    end_reply_batch(client_socket);
+    unlock_keys(held);
 }
 
 
@@ -445,27 +766,23 @@ void handle_getex(int client_socket, RedisCommand *cmd) {
         return;
     }
 
-    char key[MAX_BULK_LENGTH];
-    strncpy(key, cmd->argv[1].data, cmd->argv[1].length);
-    key[cmd->argv[1].length] = '\0';
-
+    KeyspaceStripe *stripe = lock_key(&cmd->argv[1]);
     struct SetEntry *entry;
-    HASH_FIND_STR(set_table, key, entry);
+    entry = find_entry(stripe, cmd->argv[1].data, cmd->argv[1].length);
 
     if (entry && is_key_expired(entry)) {
         // Check if the key is expired
-        delete_key(entry);
-        send_redis_bulk_string(client_socket, "nil");
-             
-
+        delete_key(stripe, entry);
+        send_redis_null(client_socket);
+    } else if (entry) {
         // Key exists and is not expired
-        entry->expiration = time(NULL) + 3600; // Reset TTL (e.g., 1 hour)
-        send_redis_bulk_string(client_socket, entry->value);
-        return; 
+        set_entry_expiration(entry, time(NULL) + 3600); // Reset TTL (e.g., 1 hour)
+        send_redis_bulk(client_socket, entry_value(entry), entry->value_len);
     } else {
         // Key does not exist
-        send_redis_bulk_string(client_socket, "nil");
+        send_redis_null(client_socket);
     }
+    unlock_stripe(stripe);
 }
 
 
@@ -476,34 +793,35 @@ void handle_del(int client_socket, RedisCommand *cmd) {
     }
 
     int deleted_count = 0;
+    StripeSet held = lock_keys(cmd, 1, cmd->argc - 1, 1);
     for (int i = 1; i < cmd->argc; i++) {
-        char key[MAX_BULK_LENGTH];
-        strncpy(key, cmd->argv[i].data, cmd->argv[i].length);
-        key[cmd->argv[i].length] = '\0';
-
+        KeyspaceStripe *stripe = key_stripe(&cmd->argv[i]);
         struct SetEntry *entry;
-        HASH_FIND_STR(set_table, key, entry);
+        entry = find_entry(stripe, cmd->argv[i].data, cmd->argv[i].length);
         if (entry) {
             // Optional: Handle DEL_IF (delete based on a condition)
-            if (cmd->argc > 2 && strncmp(cmd->argv[1].data, "DEL_IF", 6) == 0) {
+            if (cmd->argc > 2 && redis_string_equals(&cmd->argv[1], "DEL_IF")) {
                 // Example: DEL_IF key > 10
                 // Here we would parse the condition, e.g., key-value comparison
                 int condition_met = 1; // Placeholder condition check
                 if (condition_met) {
-                    HASH_DEL(set_table, entry);
-                    free(entry);
+                    delete_key(stripe, entry);
                     deleted_count++;
                 } else {
+                    unlock_keys(held);
                     send_redis_error(client_socket, "Condition not met for DEL_IF");
                     return;
                 }
             } else {
-                HASH_DEL(set_table, entry);
-                free(entry);
+                delete_key(stripe, entry);
                 deleted_count++;
             }
         }
-        save_to_sdb(key, "", 1);
+    }
+    unlock_keys(held);
+
+    for (int i = 1; i < cmd->argc; i++) {
+        save_to_sdb(cmd->argv[i].data, "", 1);
     }
 
     send_redis_integer(client_socket, deleted_count);  // Return the number of deleted keys
@@ -515,21 +833,31 @@ void handle_getttl(int client_socket, RedisCommand *cmd) {
         return;
     }
 
-    char key[MAX_BULK_LENGTH];
-    strncpy(key, cmd->argv[1].data, cmd->argv[1].length);
-    key[cmd->argv[1].length] = '\0';
-
+    KeyspaceStripe *stripe = lock_key(&cmd->argv[1]);
     struct SetEntry *entry;
-    HASH_FIND_STR(set_table, key, entry);
+    entry = find_entry(stripe, cmd->argv[1].data, cmd->argv[1].length);
+    // The value and its TTL: a map for typed clients, a two-element array
+    // for RESP2 ones
+    int typed = typed_replies();
+    begin_reply_batch();
+    if (typed) {
+        send_redis_map(client_socket, 2);
+        send_redis_bulk_string(client_socket, "value");
+    } else {
+        send_redis_array(client_socket, 2);
+    }
     if (entry) {
-        send_redis_bulk_string(client_socket, entry->value);
-
-        // Simulate TTL logic (e.g., placeholder TTL of 3600 seconds or expiration timestamp logic)
-        send_redis_integer(client_socket, 3600);  // Placeholder TTL value (1 hour)
+        send_redis_bulk(client_socket, entry_value(entry), entry->value_len);
     } else {
-        send_redis_bulk_string(client_socket, "nil");
-        send_redis_integer(client_socket, -1);  // No TTL if the key doesn't exist
+        send_redis_null(client_socket);
+    }
+    if (typed) {
+        send_redis_bulk_string(client_socket, "ttl");
     }
+    // Simulate TTL logic (e.g., placeholder TTL of 3600 seconds or expiration timestamp logic)
+    send_redis_integer(client_socket, entry ? 3600 : -1);  // Placeholder TTL value (1 hour), -1 without a key
+    end_reply_batch(client_socket);
+    unlock_stripe(stripe);
 }
 
 
@@ -539,33 +867,31 @@ void handle_copy(int client_socket, RedisCommand *cmd) {
         return;
     }
 
-    char key[MAX_BULK_LENGTH], new_key[MAX_BULK_LENGTH];
-    int expiration = 0;
-
-    strncpy(key, cmd->argv[1].data, cmd->argv[1].length);
-    key[cmd->argv[1].length] = '\0';
-    strncpy(new_key, cmd->argv[2].data, cmd->argv[2].length);
-    new_key[cmd->argv[2].length] = '\0';
+    long long expiration = 0;
 
     // Optional EX argument for expiration time
-    if (cmd->argc > 3 && strncmp(cmd->argv[3].data, "EX", 2) == 0 && cmd->argc > 4) {
-        expiration = atoi(cmd->argv[4].data);
+    if (cmd->argc > 4 && redis_string_equals(&cmd->argv[3], "EX") &&
+        redis_string_to_long(&cmd->argv[4], &expiration) != 0) {
+        send_redis_error(client_socket, "value is not an integer or out of range");
+        return;
     }
 
+    StripeSet held = lock_keys(cmd, 1, 2, 1);
     struct SetEntry *entry;
-    HASH_FIND_STR(set_table, key, entry);
+    entry = find_entry(key_stripe(&cmd->argv[1]), cmd->argv[1].data, cmd->argv[1].length);
     if (entry) {
-        struct SetEntry *new_entry = malloc(sizeof(struct SetEntry));
+        struct SetEntry *new_entry = create_entry(cmd->argv[2].data, cmd->argv[2].length,
+                                                  entry_value(entry), entry->value_len);
         if (!new_entry) {
             fprintf(stderr, "Error: Memory allocation failed for command registration.\n");
             exit(EXIT_FAILURE);  // Exit gracefully or handle the error appropriately
         }
-        strncpy(new_entry->key, new_key, MAX_BULK_LENGTH);
-        strncpy(new_entry->value, entry->value, MAX_BULK_LENGTH);
         // Implement expiration (EX) here if needed
-        HASH_ADD_STR(set_table, key, new_entry);
-        send_redis_string(client_socket, "OK");
+        store_entry(key_stripe(&cmd->argv[2]), new_entry);
+        unlock_keys(held);
+        send_redis_ok(client_socket);
     } else {
+        unlock_keys(held);
         send_redis_error(client_socket, "Source key does not exist");
     }
 }
@@ -576,25 +902,20 @@ void handle_aggregate(int client_socket, RedisCommand *cmd) {
         return;
     }
 
-    char operation[MAX_BULK_LENGTH];
-    strncpy(operation, cmd->argv[1].data, cmd->argv[1].length);
-    operation[cmd->argv[1].length] = '\0';
-
     int result = 0;
+    StripeSet held = lock_keys(cmd, 2, cmd->argc - 1, 1);
     for (int i = 2; i < cmd->argc; i++) {
-        char key[MAX_BULK_LENGTH];
-        strncpy(key, cmd->argv[i].data, cmd->argv[i].length);
-        key[cmd->argv[i].length] = '\0';
-
         struct SetEntry *entry;
-        HASH_FIND_STR(set_table, key, entry);
+        entry = find_entry(key_stripe(&cmd->argv[i]), cmd->argv[i].data, cmd->argv[i].length);
         if (entry) {
-            result += atoi(entry->value);
+            result += atoi(entry_value(entry));
         } else {
+            unlock_keys(held);
             send_redis_error(client_socket, "One or more keys do not exist");
             return;
         }
     }
+    unlock_keys(held);
 
     // Return the result of aggregation (e.g., SUM)
     send_redis_integer(client_socket, result);
@@ -606,23 +927,17 @@ void handle_query(int client_socket, RedisCommand *cmd) {
         return;
     }
 
-    char key[MAX_BULK_LENGTH];
-    strncpy(key, cmd->argv[1].data, cmd->argv[1].length);
-    key[cmd->argv[1].length] = '\0';
-
-    char condition[MAX_BULK_LENGTH];
-    strncpy(condition, cmd->argv[2].data, cmd->argv[2].length);
-    condition[cmd->argv[2].length] = '\0';
-
     // In a real implementation, this would involve parsing the condition and querying a structured dataset (e.g., hash fields)
+    KeyspaceStripe *stripe = lock_key(&cmd->argv[1]);
     struct SetEntry *entry;
-    HASH_FIND_STR(set_table, key, entry);
+    entry = find_entry(stripe, cmd->argv[1].data, cmd->argv[1].length);
     if (entry) {
         // If condition matches (for simplicity, we assume it’s always true)
-        send_redis_bulk_string(client_socket, entry->value);
+        send_redis_bulk(client_socket, entry_value(entry), entry->value_len);
     } else {
-        send_redis_bulk_string(client_socket, "nil");
+        send_redis_null(client_socket);
     }
+    unlock_stripe(stripe);
 }
 
 
@@ -632,22 +947,20 @@ void handle_stream(int client_socket, RedisCommand *cmd) {
         return;
     }
 
-    char key[MAX_BULK_LENGTH];
-    strncpy(key, cmd->argv[1].data, cmd->argv[1].length);
-    key[cmd->argv[1].length] = '\0';
-
     int start = atoi(cmd->argv[2].data);
     int count = atoi(cmd->argv[3].data);
 
     // Simulate streaming logic (in a real implementation, this would fetch ranges from a sorted set or list)
+    KeyspaceStripe *stripe = lock_key(&cmd->argv[1]);
     struct SetEntry *entry;
-    HASH_FIND_STR(set_table, key, entry);
+    entry = find_entry(stripe, cmd->argv[1].data, cmd->argv[1].length);
     if (entry) {
         // Simulate streaming by splitting the value into chunks
-        send_redis_bulk_string(client_socket, entry->value);  // Placeholder for actual stream logic
+        send_redis_bulk(client_socket, entry_value(entry), entry->value_len);  // Placeholder for actual stream logic
     } else {
-        send_redis_bulk_string(client_socket, "nil");
+        send_redis_null(client_socket);
     }
+    unlock_stripe(stripe);
 }
 
 
@@ -657,22 +970,16 @@ void handle_hsearch(int client_socket, RedisCommand *cmd) {
         return;
     }
 
-    char key[MAX_BULK_LENGTH];
-    strncpy(key, cmd->argv[1].data, cmd->argv[1].length);
-    key[cmd->argv[1].length] = '\0';
-
-    char pattern[MAX_BULK_LENGTH];
-    strncpy(pattern, cmd->argv[2].data, cmd->argv[2].length);
-    pattern[cmd->argv[2].length] = '\0';
-
     // Simulate hash field search (e.g., use pattern matching on key fields)
+    KeyspaceStripe *stripe = lock_key(&cmd->argv[1]);
     struct SetEntry *entry;
-    HASH_FIND_STR(set_table, key, entry);
+    entry = find_entry(stripe, cmd->argv[1].data, cmd->argv[1].length);
     if (entry) {
-        send_redis_bulk_string(client_socket, entry->value);  // Return matched value
+        send_redis_bulk(client_socket, entry_value(entry), entry->value_len);  // Return matched value
     } else {
-        send_redis_bulk_string(client_socket, "nil");
+        send_redis_null(client_socket);
     }
+    unlock_stripe(stripe);
 }
 
 void handle_setv(int client_socket, RedisCommand *cmd) {
@@ -681,40 +988,36 @@ void handle_setv(int client_socket, RedisCommand *cmd) {
         return;
     }
 
-    char key[MAX_BULK_LENGTH], value[MAX_BULK_LENGTH];
-    strncpy(key, cmd->argv[1].data, cmd->argv[1].length);
-    key[cmd->argv[1].length] = '\0';
-    strncpy(value, cmd->argv[2].data, cmd->argv[2].length);
-    value[cmd->argv[2].length] = '\0';
+    const RedisString *key = &cmd->argv[1];
+    const RedisString *value = &cmd->argv[2];
 
     // Check if the key already exists in versioned set
+    KeyspaceStripe *stripe = lock_key(key);
     struct VersionedSetEntry *entry;
-    HASH_FIND_STR(versioned_set_table, key, entry);
+    HASH_FIND(hh, stripe->versioned_set_table, key->data, key->length, entry);
 
     if (entry) {
         // Create a new version and add it to the linked list
-        struct VersionedSetEntry *new_entry = malloc(sizeof(struct VersionedSetEntry));
+        struct VersionedSetEntry *new_entry = create_versioned_entry(key->data, key->length,
+                                                                     entry->data + entry->key_len, entry->value_len);
         if (!new_entry) {
             fprintf(stderr, "Error: Memory allocation failed for command registration.\n");
             exit(EXIT_FAILURE);  // Exit gracefully or handle the error appropriately
         }
-        strncpy(new_entry->key, key, MAX_BULK_LENGTH);
-        strncpy(new_entry->value, entry->value, MAX_BULK_LENGTH);
         new_entry->next = entry;  // Point to previous version
-        HASH_ADD_STR(versioned_set_table, key, new_entry);  // Add new version to hash table
+        HASH_ADD_KEYPTR(hh, stripe->versioned_set_table, new_entry->data, new_entry->key_len, new_entry);  // Add new version to hash table
     } else {
-        struct VersionedSetEntry *new_entry = malloc(sizeof(struct VersionedSetEntry));
+        struct VersionedSetEntry *new_entry = create_versioned_entry(key->data, key->length,
+                                                                     value->data, value->length);
         if (!new_entry) {
             fprintf(stderr, "Error: Memory allocation failed for command registration.\n");
             exit(EXIT_FAILURE);  // Exit gracefully or handle the error appropriately
         }
-        strncpy(new_entry->key, key, MAX_BULK_LENGTH);
-        strncpy(new_entry->value, value, MAX_BULK_LENGTH);
-        new_entry->next = NULL;
-        HASH_ADD_STR(versioned_set_table, key, new_entry);  // Add first version
+        HASH_ADD_KEYPTR(hh, stripe->versioned_set_table, new_entry->data, new_entry->key_len, new_entry);  // Add first version
     }
+    unlock_stripe(stripe);
 
-    send_redis_string(client_socket, "OK");
+    send_redis_ok(client_socket);
 }
 
 // Handle the HISTORY command to retrieve the history of a key
@@ -724,23 +1027,30 @@ void handle_history(int client_socket, RedisCommand *cmd) {
         return;
     }
 
-    char key[MAX_BULK_LENGTH];
-    strncpy(key, cmd->argv[1].data, cmd->argv[1].length);
-    key[cmd->argv[1].length] = '\0';
-
+    const RedisString *key = &cmd->argv[1];
+    KeyspaceStripe *stripe = lock_key(key);
     struct VersionedSetEntry *entry;
-    HASH_FIND_STR(versioned_set_table, key, entry);
+    HASH_FIND(hh, stripe->versioned_set_table, key->data, key->length, entry);
     
-    if (!entry) {
-        send_redis_bulk_string(client_socket, "nil");
+    // Every version of the key. A key without history is a null for typed
+    // clients and an empty array for RESP2 ones.
+    if (!entry && typed_replies()) {
+        unlock_stripe(stripe);
+        send_redis_null(client_socket);
         return;
     }
-
-    // Iterate through the version history
+    long long versions = 0;
+    for (struct VersionedSetEntry *version = entry; version; version = version->next) {
+        versions++;
+    }
+    begin_reply_batch();
+    send_redis_array(client_socket, versions);
     while (entry) {
-        send_redis_bulk_string(client_socket, entry->value);
+        send_redis_bulk(client_socket, entry->data + entry->key_len, entry->value_len);
         entry = entry->next;
     }
+    end_reply_batch(client_socket);
+    unlock_stripe(stripe);
 }
 
 
@@ -750,25 +1060,20 @@ void handle_bulk_set(int client_socket, RedisCommand *cmd) {
         return;
     }
 
+    StripeSet held = lock_keys(cmd, 1, cmd->argc - 2, 2);
     for (int i = 1; i < cmd->argc; i += 2) {
-        char key[MAX_BULK_LENGTH], value[MAX_BULK_LENGTH];
-        strncpy(key, cmd->argv[i].data, cmd->argv[i].length);
-        key[cmd->argv[i].length] = '\0';
-        strncpy(value, cmd->argv[i + 1].data, cmd->argv[i + 1].length);
-        value[cmd->argv[i + 1].length] = '\0';
-
-        struct SetEntry *entry = malloc(sizeof(struct SetEntry));
+        struct SetEntry *entry = create_entry(cmd->argv[i].data, cmd->argv[i].length,
+                                              cmd->argv[i + 1].data, cmd->argv[i + 1].length);
         if (!entry) {
             fprintf(stderr, "Error: Memory allocation failed for command registration.\n");
             exit(EXIT_FAILURE);  // Exit gracefully or handle the error appropriately
         }
-        strncpy(entry->key, key, MAX_BULK_LENGTH);
-        strncpy(entry->value, value, MAX_BULK_LENGTH);
 
-        HASH_ADD_STR(set_table, key, entry);
+        store_entry(key_stripe(&cmd->argv[i]), entry);
     }
+    unlock_keys(held);
 
-    send_redis_string(client_socket, "OK");
+    send_redis_ok(client_socket);
 }
 
 void handle_bulk_get(int client_socket, RedisCommand *cmd) {
@@ -778,53 +1083,85 @@ void handle_bulk_get(int client_socket, RedisCommand *cmd) {
     }
 
     // Iterate over the keys provided in the command
+    StripeSet held = lock_keys(cmd, 1, cmd->argc - 1, 1);
+    begin_reply_batch();
+    send_redis_array(client_socket, cmd->argc - 1);
     for (int i = 1; i < cmd->argc; i++) {
-        char key[MAX_BULK_LENGTH];
-        strncpy(key, cmd->argv[i].data, cmd->argv[i].length);
-        key[cmd->argv[i].length] = '\0';
-
-        struct SetEntry *entry;
-        HASH_FIND_STR(set_table, key, entry);
+        KeyspaceStripe *stripe;
+        struct SetEntry *entry = find_key(&cmd->argv[i], &stripe);
         if (entry) {
-            send_redis_bulk_string(client_socket, entry->value);
+            send_redis_bulk(client_socket, entry_value(entry), entry->value_len);
         } else {
-            send_redis_bulk_string(client_socket, "nil");
+            send_redis_null(client_socket);
         }
     }
+    end_reply_batch(client_socket);
+    unlock_keys(held);
 }
 
 // Handle the FLUSHALL command to remove all keys
-void handle_flushall(int client_socket, RedisCommand *cmd) {
-    // Iterate through all the databases and clear them.
-    // Assuming you have a global or database-specific structure to track the data
-    // e.g., a hash table of key-value pairs for each database.
+static int delete_every_key(KeyIndexNode *node, void *arg) {
+    delete_key((KeyspaceStripe *)arg, (struct SetEntry *)node);
+    return 0;
+}
 
-    struct VersionedSetEntry *entry, *tmp;
-    HASH_ITER(hh, versioned_set_table, entry, tmp) {
-        HASH_DEL(versioned_set_table, entry);  // Remove entry from hash table
-        free(entry);  // Free the memory allocated for the entry
+void handle_flushall(int client_socket, RedisCommand *cmd) {
+    // Iterate through all the databases and clear them: the keyspace, whose
+    // entries go back to their slabs once no reader holds them, and the
+    // versioned keys
+
+    for (int i = 0; i < KEYSPACE_STRIPES; i++) {
+        KeyspaceStripe *stripe = &current_partition->stripes[i];
+        lock_stripe(stripe);
+        key_index_foreach(&stripe->set_index, delete_every_key, stripe);
+        struct VersionedSetEntry *entry, *tmp;
+        HASH_ITER(hh, stripe->versioned_set_table, entry, tmp) {
+            HASH_DEL(stripe->versioned_set_table, entry);  // Remove entry from hash table
+            free_versioned_entry(entry);  // Free the memory allocated for the entry
+        }
+        unlock_stripe(stripe);
     }
 
-    send_redis_string(client_socket, "OK");
+    send_redis_ok(client_socket);
+}
+
+// One record per key: key length, key, value length, value (lengths as
+// uint32_t), then the expiration as int64_t
+static int backup_entry(KeyIndexNode *node, void *arg) {
+    struct SetEntry *entry = (struct SetEntry *)node;
+    FILE *backup_file = (FILE *)arg;
+    uint32_t key_len = (uint32_t)entry->node.key_len;
+    uint32_t value_len = (uint32_t)entry->value_len;
+    int64_t expiration = entry_expiration(entry);
+    fwrite(&key_len, sizeof(key_len), 1, backup_file);
+    fwrite(entry->key, 1, key_len, backup_file);
+    fwrite(&value_len, sizeof(value_len), 1, backup_file);
+    fwrite(entry_value(entry), 1, value_len, backup_file);
+    fwrite(&expiration, sizeof(expiration), 1, backup_file);
+    return 0;
 }
 
 // Handle the BACKUP command to trigger a backup
 void handle_backup(int client_socket, RedisCommand *cmd) {
+    // Other threads own the rest of a partitioned keyspace
+    if (partition_count > 1) {
+        send_redis_error(client_socket, "BACKUP is not available with a partitioned keyspace");
+        return;
+    }
+
     FILE *backup_file = fopen("backup.rdb", "wb");
     if (!backup_file) {
         send_redis_error(client_socket, "failed to open backup file");
         return;
     }
 
-    pthread_mutex_lock(&set_table_mutex);
-
-    struct SetEntry *entry, *tmp;
-    HASH_ITER(hh, set_table, entry, tmp) {
-        fwrite(entry, sizeof(struct SetEntry), 1, backup_file);
+    for (int i = 0; i < KEYSPACE_STRIPES; i++) {
+        KeyspaceStripe *stripe = &current_partition->stripes[i];
+        lock_stripe(stripe);
+        key_index_foreach(&stripe->set_index, backup_entry, backup_file);
+        unlock_stripe(stripe);
     }
 
-    pthread_mutex_unlock(&set_table_mutex);
-
     fclose(backup_file);
     send_redis_string(client_socket, "Backup completed");
 }
@@ -866,7 +1203,7 @@ void handle_swapdb(int client_socket, RedisCommand *cmd) {
     set_database(db1, db2_table);  // Swap contents of db1 with db2
     set_database(db2, db1_table);  // Swap contents of db2 with db1
 
-    send_redis_string(client_socket, "OK");
+    send_redis_ok(client_socket);
 }
 */
 
@@ -889,7 +1226,77 @@ void handle_select(int client_socket, RedisCommand *cmd) {
     // Set the current database for this client session
     // current_db = db;
 
-    send_redis_string(client_socket, "OK");
+    send_redis_ok(client_socket);
+}
+
+// Handle the INFO command: key count, how far index rehashing has got and
+// keyspace memory, summed over every partition
+void handle_info(int client_socket, RedisCommand *cmd) {
+    (void)cmd;
+    size_t keys = 0, rehashing = 0, groups_done = 0, groups_total = 0;
+    SlabStats slab;
+    slab_stats(&slab);
+
+    for (int p = 0; p < partition_count; p++) {
+        for (int s = 0; s < KEYSPACE_STRIPES; s++) {
+            const KeyIndex *index = &partitions[p].stripes[s].set_index;
+            size_t done, total;
+            keys += __atomic_load_n(&index->count, __ATOMIC_RELAXED);
+            key_index_rehash_progress(index, &done, &total);
+            if (total) {
+                rehashing++;
+                groups_done += done;
+                groups_total += total;
+            }
+        }
+    }
+
+    // Reserved slab space per byte asked for; slab space not handed out
+    // is free for reuse but not returned to the system
+    double fragmentation = slab.requested ? (double)slab.reserved / slab.requested : 0;
+
+    // A section starts at each field that names one
+    const struct {
+        const char *section;
+        const char *name;
+        size_t value;
+    } fields[] = {
+        {"Keyspace", "keys", keys},
+        {NULL, "rehashing_stripes", rehashing},
+        {NULL, "rehash_groups_done", groups_done},
+        {NULL, "rehash_groups_total", groups_total},
+        {"Memory", "slab_reserved_bytes", slab.reserved},
+        {NULL, "slab_allocated_bytes", slab.allocated},
+        {NULL, "slab_used_bytes", slab.requested},
+        {NULL, "slab_free_bytes", slab.reserved > slab.allocated ? slab.reserved - slab.allocated : 0},
+        {NULL, "large_allocated_bytes", slab.large},
+    };
+    size_t field_count = sizeof(fields) / sizeof(fields[0]);
+
+    // Typed clients get a map of every field, RESP2 ones the usual text
+    if (typed_replies()) {
+        begin_reply_batch();
+        send_redis_map(client_socket, (long long)field_count + 1);
+        for (size_t i = 0; i < field_count; i++) {
+            send_redis_bulk_string(client_socket, fields[i].name);
+            send_redis_integer(client_socket, (long long)fields[i].value);
+        }
+        send_redis_bulk_string(client_socket, "slab_fragmentation_ratio");
+        send_redis_double(client_socket, fragmentation);
+        end_reply_batch(client_socket);
+        return;
+    }
+
+    char info[1024];
+    size_t len = 0;
+    for (size_t i = 0; i < field_count; i++) {
+        if (fields[i].section) {
+            len += snprintf(info + len, sizeof(info) - len, "# %s\r\n", fields[i].section);
+        }
+        len += snprintf(info + len, sizeof(info) - len, "%s:%zu\r\n", fields[i].name, fields[i].value);
+    }
+    snprintf(info + len, sizeof(info) - len, "slab_fragmentation_ratio:%.2f\r\n", fragmentation);
+    send_redis_bulk_string(client_socket, info);
 }
 
 // TODO:Time-Series add command (TS.ADD)
@@ -916,7 +1323,7 @@ void handle_select(int client_socket, RedisCommand *cmd) {
 //     // Add the timestamp and value to the ZSet
 //     redisZAdd(zset, series_name, timestamp);  // You may want to store timestamp and value in separate places
 
-//     send_redis_string(client_socket, "OK");  // Send success response
+//     send_redis_ok(client_socket);  // Send success response
 // }
 
 //TODO: Time-Series range command (TS.RANGE)
@@ -940,7 +1347,7 @@ void handle_select(int client_socket, RedisCommand *cmd) {
 //     // Simplified example: get range from sorted set
 //     redisZRange(series_name, start_timestamp, end_timestamp, aggregation_type); // Example
 
-//     send_redis_string(client_socket, "OK");
+//     send_redis_ok(client_socket);
 // }
 
 //TODO: Implement GEOFILTER
@@ -961,7 +1368,7 @@ void handle_select(int client_socket, RedisCommand *cmd) {
 //     // Filter geo-data (simplified example)
 //     redisGeoFilter(key, radius, condition); // This would filter the geo-data from the sorted set
 
-//     send_redis_string(client_socket, "OK");
+//     send_redis_ok(client_socket);
 // }
 
 // TODO: Handle the ZADD command to add a member to a sorted set.
@@ -1039,7 +1446,7 @@ void handle_select(int client_socket, RedisCommand *cmd) {
 //     // Retrieve members in the specified score range.
 //     ZSetEntry *entry = redisZRange(zset, min_score, max_score);
 //     if (entry == NULL) {
-//         send_redis_bulk_string(client_socket, "nil");
+//         send_redis_null(client_socket);
 //         return;
 //     }
 
@@ -1065,39 +1472,49 @@ void handle_select(int client_socket, RedisCommand *cmd) {
 
 
 void register_commands() {
+    init_partition(&shared_partition);
+
     register_command("PING", handle_ping);
     register_command("ECHO", handle_echo);
-    register_command("SET", handle_set);
-    register_command("GET", handle_get);
-    register_command("SETEX", handle_setex);
-    register_command("GETEX", handle_getex);  
-    register_command("DEL", handle_del);      
-    register_command("EXPIRE", handle_expire); 
-    register_command("INCR", handle_incr);    
-    register_command("MGET", handle_mget);
-    register_command("GETTTL", handle_getttl);  
-    register_command("COPY", handle_copy);      
-    register_command("AGGREGATE", handle_aggregate); 
-    register_command("QUERY", handle_query);    
-    register_command("STREAM", handle_stream);  
-    register_command("HSEARCH", handle_hsearch);
-    register_command("SETV", handle_setv);
-    register_command("HISTORY", handle_history);  
-    register_command("BULK_SET", handle_bulk_set);
-    register_command("BULK_GET", handle_bulk_get);
-    register_command("FLUSHALL", handle_flushall);  
+    register_command("HELLO", handle_hello);
+    register_keyed_command("SET", handle_set, 1, 1, 1, GATHER_NONE, 0);
+    register_keyed_command("GET", handle_get, 1, 1, 1, GATHER_NONE, 0);
+    register_keyed_command("SETEX", handle_setex, 1, 1, 1, GATHER_NONE, 0);
+    register_keyed_command("GETEX", handle_getex, 1, 1, 1, GATHER_NONE, 0);
+    register_keyed_command("DEL", handle_del, 1, -1, 1, GATHER_SUM, 0);
+    register_keyed_command("EXPIRE", handle_expire, 1, 1, 1, GATHER_NONE, 0);
+    register_keyed_command("INCR", handle_incr, 1, 1, 1, GATHER_NONE, 0);
+    register_keyed_command("MGET", handle_mget, 1, -1, 1, GATHER_CONCAT, 0);
+    register_keyed_command("GETTTL", handle_getttl, 1, 1, 1, GATHER_NONE, 0);
+    register_keyed_command("COPY", handle_copy, 1, 2, 1, GATHER_NONE, 0);
+    register_keyed_command("AGGREGATE", handle_aggregate, 2, -1, 1, GATHER_SUM, 0);
+    register_keyed_command("QUERY", handle_query, 1, 1, 1, GATHER_NONE, 0);
+    register_keyed_command("STREAM", handle_stream, 1, 1, 1, GATHER_NONE, 0);
+    register_keyed_command("HSEARCH", handle_hsearch, 1, 1, 1, GATHER_NONE, 0);
+    register_keyed_command("SETV", handle_setv, 1, 1, 1, GATHER_NONE, 0);
+    register_keyed_command("HISTORY", handle_history, 1, 1, 1, GATHER_NONE, 0);
+    register_keyed_command("BULK_SET", handle_bulk_set, 1, -1, 2, GATHER_ALL_OK, 0);
+    register_keyed_command("BULK_GET", handle_bulk_get, 1, -1, 1, GATHER_CONCAT, 0);
+    register_keyed_command("FLUSHALL", handle_flushall, 0, 0, 0, GATHER_ALL_OK, 1);
     register_command("BACKUP", handle_backup);
     // register_command("SYNC", handle_sync);
     // register_command("PSYNC", handle_psync);
     // register_command("REPLCONF", handle_replconf);
     // register_command("SWAPDB", handle_swapdb);
     register_command("SELECT", handle_select);
+    register_command("INFO", handle_info);
     // register_command("TS.ADD", handle_ts_add);
     // register_command("TS.RANGE", handle_ts_range);
     // register_command("GEOFILTER", handle_geo_filter);
 }
 
 
+static int free_index_entry(KeyIndexNode *node, void *arg) {
+    (void)arg;
+    free_entry(node);
+    return 0;
+}
+
 // Cleanup commands
 void cleanup_commands() {
     // Cleanup command table
@@ -1110,24 +1527,25 @@ void cleanup_commands() {
         command_table = NULL;  // Clear global pointer
     }
 
-    // Cleanup set table
-    struct SetEntry *set_entry, *set_tmp;
-    if (set_table) {
-        HASH_ITER(hh, set_table, set_entry, set_tmp) {
-            HASH_DEL(set_table, set_entry);
-            free(set_entry);  // Free set entry
-        }
-        set_table = NULL;  // Clear global pointer
-    }
+    for (int i = 0; i < partition_count; i++) {
+        keyspace_select_partition(i);
+
+        // Cleanup set table
+        for (int s = 0; s < KEYSPACE_STRIPES; s++) {
+            KeyspaceStripe *stripe = &current_partition->stripes[s];
+            key_index_foreach(&stripe->set_index, free_index_entry, NULL);
+            key_index_destroy(&stripe->set_index);
 
-    // Cleanup versioned set table
-    struct VersionedSetEntry *ver_entry, *ver_tmp;
-    if (versioned_set_table) {
-        HASH_ITER(hh, versioned_set_table, ver_entry, ver_tmp) {
-            HASH_DEL(versioned_set_table, ver_entry);
-            free(ver_entry);  // Free versioned set entry
+            // Cleanup versioned set table
+            struct VersionedSetEntry *ver_entry, *ver_tmp;
+            if (stripe->versioned_set_table) {
+                HASH_ITER(hh, stripe->versioned_set_table, ver_entry, ver_tmp) {
+                    HASH_DEL(stripe->versioned_set_table, ver_entry);
+                    free_versioned_entry(ver_entry);  // Free versioned set entry
+                }
+                stripe->versioned_set_table = NULL;  // Clear global pointer
+            }
         }
-        versioned_set_table = NULL;  // Clear global pointer
     }
 
     // Cleanup db_table
@@ -1141,15 +1559,15 @@ void cleanup_commands() {
     printf("All commands and data structures have been cleaned up.\n");
 }
 
-void execute_command(int client_socket, RedisCommand *cmd) {
-    if (cmd->argc == 0) {
-        send_redis_error(client_socket, "empty command");
-        return;
+static CommandEntry *lookup_command(RedisCommand *cmd) {
+    // No command has a longer name
+    if (cmd->argv[0].length >= COMMAND_NAME_MAX) {
+        return NULL;
     }
 
     // Extract command name
-    char command[MAX_BULK_LENGTH];
-    strncpy(command, cmd->argv[0].data, cmd->argv[0].length);
+    char command[COMMAND_NAME_MAX];
+    memcpy(command, cmd->argv[0].data, cmd->argv[0].length);
     command[cmd->argv[0].length] = '\0';
 
     // Convert to uppercase
@@ -1160,6 +1578,25 @@ void execute_command(int client_socket, RedisCommand *cmd) {
     // Lookup the command in the hashtable
     CommandEntry *entry;
     HASH_FIND_STR(command_table, command, entry);
+    return entry;
+}
+
+// Key positions of the command, NULL if it is unknown
+const CommandRoute *lookup_command_route(RedisCommand *cmd) {
+    if (cmd->argc == 0) {
+        return NULL;
+    }
+    CommandEntry *entry = lookup_command(cmd);
+    return entry ? &entry->route : NULL;
+}
+
+void execute_command(int client_socket, RedisCommand *cmd) {
+    if (cmd->argc == 0) {
+        send_redis_error(client_socket, "empty command");
+        return;
+    }
+
+    CommandEntry *entry = lookup_command(cmd);
 
     if (entry) {
         entry->handler(client_socket, cmd);
@@ -1169,62 +1606,117 @@ void execute_command(int client_socket, RedisCommand *cmd) {
 }
 
 
-void cleanup_expired_keys() {
-    pthread_mutex_lock(&set_table_mutex);
+typedef struct StripeScan {
+    KeyspaceStripe *stripe;
+    time_t now;
+    size_t remaining;   // Entries to skip before evicting
+} StripeScan;
+
+static int delete_if_expired(KeyIndexNode *node, void *arg) {
+    StripeScan *scan = (StripeScan *)arg;
+    struct SetEntry *entry = (struct SetEntry *)node;
+    time_t expiration = entry_expiration(entry);
+    if (expiration > 0 && expiration <= scan->now) {
+        delete_key(scan->stripe, entry);
+    }
+    return 0;
+}
 
-    struct SetEntry *entry, *tmp;
+// Scans one stripe at a time, so commands only wait for a slice of it
+void cleanup_expired_keys() {
     time_t now = time(NULL);
 
-    HASH_ITER(hh, set_table, entry, tmp) {
-        if (entry->expiration > 0 && entry->expiration <= now) {
-            HASH_DEL(set_table, entry);
-            free(entry);
-        }
-    }
+    for (int i = 0; i < KEYSPACE_STRIPES; i++) {
+        KeyspaceStripe *stripe = &current_partition->stripes[i];
+        lock_stripe(stripe);
 
-    pthread_mutex_unlock(&set_table_mutex);
+        StripeScan scan = { .stripe = stripe, .now = now };
+        key_index_foreach(&stripe->set_index, delete_if_expired, &scan);
+
+        unlock_stripe(stripe);
+    }
     printf("Expired keys cleaned up.\n");
 }
 
+// Background share of index rehashing, so a stripe that stops receiving
+// writes still finishes its rehash and frees the previous table
+void rehash_keyspace() {
+    for (int i = 0; i < KEYSPACE_STRIPES; i++) {
+        KeyspaceStripe *stripe = &current_partition->stripes[i];
+        lock_stripe(stripe);
+        key_index_rehash(&stripe->set_index, KEYSPACE_REHASH_CRON_GROUPS);
+        unlock_stripe(stripe);
+    }
+    epoch_collect();
+}
+
+static int count_keys(void) {
+    int key_count = 0;
+    for (int i = 0; i < KEYSPACE_STRIPES; i++) {
+        KeyspaceStripe *stripe = &current_partition->stripes[i];
+        lock_stripe(stripe);
+        key_count += stripe->set_index.count;
+        unlock_stripe(stripe);
+    }
+    return key_count;
+}
+
+static int evict_nth(KeyIndexNode *node, void *arg) {
+    StripeScan *scan = (StripeScan *)arg;
+    if (scan->remaining-- > 0) {
+        return 0;
+    }
+    delete_key(scan->stripe, (struct SetEntry *)node);
+    printf("Evicted a random key.\n");
+    return 1;
+}
+
 void evict_random_key() {
-    struct SetEntry *entry, *tmp;
-    int key_count = HASH_COUNT(set_table);
+    int key_count = count_keys();
 
     if (key_count == 0) return;  // Nothing to evict
 
     int random_index = rand() % key_count;  // Pick a random key index
-    int i = 0;
 
-    HASH_ITER(hh, set_table, entry, tmp) {
-        if (i == random_index) {
-            HASH_DEL(set_table, entry);
-            free(entry);
-            printf("Evicted a random key.\n");
-            return;
+    for (int s = 0; s < KEYSPACE_STRIPES; s++) {
+        KeyspaceStripe *stripe = &current_partition->stripes[s];
+        lock_stripe(stripe);
+
+        int stripe_count = stripe->set_index.count;
+        if (random_index >= stripe_count) {
+            random_index -= stripe_count;
+            unlock_stripe(stripe);
+            continue;
         }
-        i++;
+
+        StripeScan scan = { .stripe = stripe, .remaining = random_index };
+        key_index_foreach(&stripe->set_index, evict_nth, &scan);
+        unlock_stripe(stripe);
+        return;
     }
 }
 
 void check_memory_and_evict() {
-    int key_count = HASH_COUNT(set_table);
+    int key_count = count_keys();
     const int MAX_KEYS = 1000;  // Example threshold
 
     while (key_count > MAX_KEYS) {
         evict_random_key();
-        key_count = HASH_COUNT(set_table);
+        key_count = count_keys();
     }
 }
 
 
 int is_key_expired(struct SetEntry *entry) {
-    if (entry->expiration > 0 && time(NULL) > entry->expiration) {
+    time_t expiration = entry_expiration(entry);
+    if (expiration > 0 && time(NULL) > expiration) {
         return 1; // Expired
     }
     return 0; // Not expired
 }
 
-void delete_key(struct SetEntry *entry) {
-    HASH_DEL(set_table, entry);
-    free(entry);
+// Caller holds the stripe lock
+void delete_key(KeyspaceStripe *stripe, struct SetEntry *entry) {
+    key_index_remove(&stripe->set_index, &entry->node);
+    retire_entry(entry);
 }
\ No newline at end of file
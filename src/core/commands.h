@@ -3,11 +3,36 @@
 
 #include "protocol.h"
 
+// How the replies of a command split across keyspace partitions are merged
+typedef enum {
+    GATHER_NONE,     // All keys must live in one partition
+    GATHER_CONCAT,   // One array element per key, in key order (MGET)
+    GATHER_SUM,      // Integer replies are added up (DEL)
+    GATHER_ALL_OK    // +OK once every part succeeded (BULK_SET)
+} GatherMode;
+
+// Key positions of a command, used to route it to the owning partition
+typedef struct CommandRoute {
+    int first_key;    // argv index of the first key, 0 for none
+    int last_key;     // Last argv index covered by the keys, -1 for the last argument
+    int key_step;     // Arguments per key, e.g. 2 for key/value pairs
+    GatherMode gather;
+    int broadcast;    // Keyless command that runs on every partition
+} CommandRoute;
+
 void register_commands();
 void cleanup_commands();
 void execute_command(int client_socket, RedisCommand *cmd);
 void cleanup_expired_keys();
+void rehash_keyspace();
 void check_memory_and_evict();
+void set_keyspace_locking(int enabled);
+
+int init_keyspace_partitions(int count);
+int keyspace_partition_count(void);
+void keyspace_select_partition(int partition);
+int keyspace_partition_of(const char *key, size_t len);
+const CommandRoute *lookup_command_route(RedisCommand *cmd);
 
 
 #endif // COMMANDS_H
@@ -0,0 +1,239 @@
+#include "config.h"
+#include "protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+
+ServerConfig server_config;
+
+void init_server_config(ServerConfig *config) {
+    config->port = 6379;
+    config->backlog = 511;
+    config->io_mode = IO_MODE_EPOLL;
+    config->event_loops = 0;
+    config->reuseport = 0;
+    config->partitioned = 0;
+    config->io_threads = 0;
+    config->workers = 64;
+    config->worker_queue = 1024;
+    config->unixsocket = NULL;
+    config->unixsocketperm = 0;
+    config->shmsocket = NULL;
+
+    config->client_obuf_limits[CLIENT_CLASS_NORMAL].hard_limit = 256ULL * 1024 * 1024;
+    config->client_obuf_limits[CLIENT_CLASS_NORMAL].soft_limit = 64ULL * 1024 * 1024;
+    config->client_obuf_limits[CLIENT_CLASS_NORMAL].soft_seconds = 60;
+    config->client_obuf_limits[CLIENT_CLASS_REPLICA].hard_limit = 256ULL * 1024 * 1024;
+    config->client_obuf_limits[CLIENT_CLASS_REPLICA].soft_limit = 64ULL * 1024 * 1024;
+    config->client_obuf_limits[CLIENT_CLASS_REPLICA].soft_seconds = 60;
+    config->proto_max_bulk_len = RESP_DEFAULT_MAX_BULK;
+}
+
+static void print_usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --port <port>               TCP port to listen on (default 6379)\n"
+            "  --backlog <n>               Listen backlog (default 511)\n"
+            "  --io <threads|epoll|uring|threaded>\n"
+            "                              Connection model (default epoll)\n"
+            "  --event-loops <n>           Event loop threads for epoll/uring (default: one per core)\n"
+            "  --io-threads <n>            Socket I/O threads for --io threaded, including the\n"
+            "                              thread running commands (default: one per core)\n"
+            "  --reuseport <yes|no>        One SO_REUSEPORT listener per event loop (default no)\n"
+            "  --partitioned-keyspace <yes|no>\n"
+            "                              Give each epoll event loop its own share of the keys\n"
+            "                              and run commands without locks (default no)\n"
+            "  --workers <n>               Worker threads for --io threads (default 64)\n"
+            "  --worker-queue <n>          Clients waiting for a worker before rejecting (default 1024)\n"
+            "  --unixsocket <path>         Also accept clients on this Unix domain socket\n"
+            "  --unixsocketperm <mode>     Octal permissions for the socket file, e.g. 770\n"
+            "  --shm-socket <path>         Serve same-host clients over shared memory rings,\n"
+            "                              handed out on this Unix socket\n"
+            "  --client-output-buffer-limit <normal|replica> <hard> <soft> <seconds>\n"
+            "                              Disconnect clients whose pending replies reach <hard>\n"
+            "                              bytes or stay above <soft> for <seconds>; sizes accept\n"
+            "                              kb/mb/gb, 0 disables (default 256mb 64mb 60)\n"
+            "  --proto-max-bulk-len <size> Longest bulk string a client may send, e.g. 64mb\n"
+            "                              (default 512mb, at most 1gb)\n",
+            program);
+}
+
+static int parse_yes_no(const char *value) {
+    if (strcmp(value, "yes") == 0) {
+        return 1;
+    }
+    if (strcmp(value, "no") == 0) {
+        return 0;
+    }
+    return -1;
+}
+
+// Parse a byte count such as "64mb". Returns -1 on malformed input or a
+// count that does not fit a long long.
+static long long parse_memory(const char *value) {
+    char *end;
+    errno = 0;
+    long long bytes = strtoll(value, &end, 10);
+    if (end == value || bytes < 0 || errno == ERANGE) {
+        return -1;
+    }
+
+    long long unit = 1;
+    if (strcasecmp(end, "kb") == 0 || strcasecmp(end, "k") == 0) {
+        unit = 1024;
+    } else if (strcasecmp(end, "mb") == 0 || strcasecmp(end, "m") == 0) {
+        unit = 1024 * 1024;
+    } else if (strcasecmp(end, "gb") == 0 || strcasecmp(end, "g") == 0) {
+        unit = 1024 * 1024 * 1024;
+    } else if (*end != '\0' && strcasecmp(end, "b") != 0) {
+        return -1;
+    }
+    if (bytes > LLONG_MAX / unit) {
+        return -1;
+    }
+    return bytes * unit;
+}
+
+static int parse_client_class(const char *value) {
+    if (strcmp(value, "normal") == 0) {
+        return CLIENT_CLASS_NORMAL;
+    }
+    if (strcmp(value, "replica") == 0 || strcmp(value, "slave") == 0) {
+        return CLIENT_CLASS_REPLICA;
+    }
+    return -1;
+}
+
+// Parse command line options into config. Returns 0 on success, -1 on error.
+int parse_server_args(ServerConfig *config, int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        int has_value = i + 1 < argc;
+
+        if (strcmp(arg, "--port") == 0 && has_value) {
+            config->port = atoi(argv[++i]);
+        } else if (strcmp(arg, "--io") == 0 && has_value) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "threads") == 0) {
+                config->io_mode = IO_MODE_THREADS;
+            } else if (strcmp(mode, "epoll") == 0) {
+                config->io_mode = IO_MODE_EPOLL;
+            } else if (strcmp(mode, "uring") == 0) {
+                config->io_mode = IO_MODE_URING;
+            } else if (strcmp(mode, "threaded") == 0) {
+                config->io_mode = IO_MODE_THREADED;
+            } else {
+                fprintf(stderr, "Error: Unknown io mode '%s'.\n", mode);
+                return -1;
+            }
+        } else if (strcmp(arg, "--backlog") == 0 && has_value) {
+            config->backlog = atoi(argv[++i]);
+        } else if (strcmp(arg, "--event-loops") == 0 && has_value) {
+            config->event_loops = atoi(argv[++i]);
+        } else if (strcmp(arg, "--io-threads") == 0 && has_value) {
+            config->io_threads = atoi(argv[++i]);
+        } else if (strcmp(arg, "--reuseport") == 0 && has_value) {
+            config->reuseport = parse_yes_no(argv[++i]);
+            if (config->reuseport < 0) {
+                fprintf(stderr, "Error: --reuseport expects yes or no.\n");
+                return -1;
+            }
+        } else if (strcmp(arg, "--partitioned-keyspace") == 0 && has_value) {
+            config->partitioned = parse_yes_no(argv[++i]);
+            if (config->partitioned < 0) {
+                fprintf(stderr, "Error: --partitioned-keyspace expects yes or no.\n");
+                return -1;
+            }
+        } else if (strcmp(arg, "--workers") == 0 && has_value) {
+            config->workers = atoi(argv[++i]);
+        } else if (strcmp(arg, "--worker-queue") == 0 && has_value) {
+            config->worker_queue = atoi(argv[++i]);
+        } else if (strcmp(arg, "--unixsocket") == 0 && has_value) {
+            config->unixsocket = argv[++i];
+        } else if (strcmp(arg, "--shm-socket") == 0 && has_value) {
+            config->shmsocket = argv[++i];
+        } else if (strcmp(arg, "--unixsocketperm") == 0 && has_value) {
+            char *end;
+            config->unixsocketperm = (int)strtol(argv[++i], &end, 8);
+            if (*end != '\0' || config->unixsocketperm < 0 || config->unixsocketperm > 07777) {
+                fprintf(stderr, "Error: --unixsocketperm expects octal permissions.\n");
+                return -1;
+            }
+        } else if (strcmp(arg, "--client-output-buffer-limit") == 0 && i + 4 < argc) {
+            int client_class = parse_client_class(argv[i + 1]);
+            long long hard = parse_memory(argv[i + 2]);
+            long long soft = parse_memory(argv[i + 3]);
+            char *end;
+            long seconds = strtol(argv[i + 4], &end, 10);
+            if (client_class < 0 || hard < 0 || soft < 0 || *end != '\0' || seconds < 0) {
+                fprintf(stderr, "Error: --client-output-buffer-limit expects <normal|replica> <hard> <soft> <seconds>.\n");
+                return -1;
+            }
+            config->client_obuf_limits[client_class].hard_limit = (unsigned long long)hard;
+            config->client_obuf_limits[client_class].soft_limit = (unsigned long long)soft;
+            config->client_obuf_limits[client_class].soft_seconds = (int)seconds;
+            i += 4;
+        } else if (strcmp(arg, "--proto-max-bulk-len") == 0 && has_value) {
+            config->proto_max_bulk_len = parse_memory(argv[++i]);
+            // A frame must fit in a client's input buffer, which stops at 1gb
+            if (config->proto_max_bulk_len <= 0 || config->proto_max_bulk_len > 1024LL * 1024 * 1024 - RESP_MAX_LINE) {
+                fprintf(stderr, "Error: --proto-max-bulk-len expects a size between 1b and 1gb.\n");
+                return -1;
+            }
+        } else {
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (config->port <= 0 || config->port > 65535) {
+        fprintf(stderr, "Error: Invalid port %d.\n", config->port);
+        return -1;
+    }
+
+    if (config->backlog <= 0) {
+        fprintf(stderr, "Error: Invalid backlog %d.\n", config->backlog);
+        return -1;
+    }
+
+    if (config->reuseport && (config->io_mode == IO_MODE_THREADS || config->io_mode == IO_MODE_THREADED)) {
+        fprintf(stderr, "Error: --reuseport requires --io epoll or uring.\n");
+        return -1;
+    }
+
+    if (config->partitioned && config->io_mode != IO_MODE_EPOLL) {
+        fprintf(stderr, "Error: --partitioned-keyspace requires --io epoll.\n");
+        return -1;
+    }
+
+    // Keys are only reachable from the event loop owning their partition
+    if (config->partitioned && config->shmsocket) {
+        fprintf(stderr, "Error: --shm-socket cannot be combined with --partitioned-keyspace.\n");
+        return -1;
+    }
+
+    // The shared-memory thread would run commands next to the main thread
+    if (config->shmsocket && config->io_mode == IO_MODE_THREADED) {
+        fprintf(stderr, "Error: --shm-socket cannot be combined with --io threaded.\n");
+        return -1;
+    }
+
+    if (config->workers <= 0 || config->worker_queue <= 0) {
+        fprintf(stderr, "Error: --workers and --worker-queue must be positive.\n");
+        return -1;
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (config->event_loops <= 0) {
+        config->event_loops = cores > 0 ? (int)cores : 1;
+    }
+    if (config->io_threads <= 0) {
+        config->io_threads = cores > 0 ? (int)cores : 1;
+    }
+
+    return 0;
+}
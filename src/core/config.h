@@ -0,0 +1,50 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// How client connections are served
+typedef enum {
+    IO_MODE_THREADS,   // One blocking thread per connection (legacy model)
+    IO_MODE_EPOLL,     // Fixed set of epoll event loops
+    IO_MODE_URING,     // io_uring rings, one per event loop thread
+    IO_MODE_THREADED   // One executing thread, socket I/O spread over I/O threads
+} IoMode;
+
+// Output buffer limits are configured per class of client
+typedef enum {
+    CLIENT_CLASS_NORMAL,
+    CLIENT_CLASS_REPLICA,
+    CLIENT_CLASS_COUNT
+} ClientClass;
+
+// A client is disconnected once its unsent replies reach hard_limit bytes,
+// or stay at or above soft_limit bytes for more than soft_seconds. A limit
+// of 0 disables that check.
+typedef struct ClientBufferLimit {
+    unsigned long long hard_limit;
+    unsigned long long soft_limit;
+    int soft_seconds;
+} ClientBufferLimit;
+
+typedef struct ServerConfig {
+    int port;
+    int backlog;       // listen() backlog, capped by net.core.somaxconn
+    IoMode io_mode;
+    int event_loops;   // Number of event loop threads (0 = one per core)
+    int reuseport;     // Give every event loop its own SO_REUSEPORT listener
+    int partitioned;   // Split the keyspace so each event loop owns one partition
+    int io_threads;    // Threads doing socket I/O for --io threaded, main included (0 = one per core)
+    int workers;       // Worker threads for --io threads
+    int worker_queue;  // Accepted sockets waiting for a worker before new ones are rejected
+    const char *unixsocket;   // Path of the AF_UNIX listener, NULL for none
+    int unixsocketperm;       // Mode bits for the socket file (0 = leave to umask)
+    const char *shmsocket;    // Control socket of the shared-memory transport, NULL for none
+    ClientBufferLimit client_obuf_limits[CLIENT_CLASS_COUNT];
+    long long proto_max_bulk_len;   // Longest bulk string a client may send
+} ServerConfig;
+
+extern ServerConfig server_config;
+
+void init_server_config(ServerConfig *config);
+int parse_server_args(ServerConfig *config, int argc, char *argv[]);
+
+#endif // CONFIG_H
@@ -0,0 +1,169 @@
+#include "epoch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+// An object waiting for its grace period
+typedef struct EpochRetired {
+    struct EpochRetired *next;
+    void *ptr;
+    EpochFree free_fn;
+    uint64_t epoch;   // Global epoch when it was unlinked
+} EpochRetired;
+
+// Per-thread state. Records are never freed; a thread that exits gives its
+// record (and anything still in limbo) to the next thread that needs one.
+typedef struct EpochRecord {
+    uint64_t epoch;     // Epoch seen on entering a read section, 0 outside one
+    int in_use;
+    int depth;          // Nesting of read sections
+    EpochRetired *limbo_head;   // Oldest first
+    EpochRetired *limbo_tail;
+    int limbo_count;
+    EpochRetired *spare;        // Limbo entries to reuse, so retiring does not allocate
+    int spare_count;
+    struct EpochRecord *next;
+} EpochRecord;
+
+static uint64_t global_epoch = 1;
+static EpochRecord *records = NULL;
+static pthread_key_t record_key;
+static pthread_once_t record_key_once = PTHREAD_ONCE_INIT;
+static __thread EpochRecord *self = NULL;
+
+static void release_record(void *arg) {
+    EpochRecord *record = (EpochRecord *)arg;
+    __atomic_store_n(&record->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&record->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void create_record_key(void) {
+    pthread_key_create(&record_key, release_record);
+}
+
+static EpochRecord *acquire_record(void) {
+    pthread_once(&record_key_once, create_record_key);
+
+    EpochRecord *record;
+    for (record = __atomic_load_n(&records, __ATOMIC_ACQUIRE); record; record = record->next) {
+        int unused = 0;
+        if (__atomic_compare_exchange_n(&record->in_use, &unused, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (!record) {
+        record = calloc(1, sizeof(EpochRecord));
+        if (!record) {
+            fprintf(stderr, "Error: Failed to allocate epoch record.\n");
+            exit(EXIT_FAILURE);
+        }
+        record->in_use = 1;
+        EpochRecord *head = __atomic_load_n(&records, __ATOMIC_RELAXED);
+        do {
+            record->next = head;
+        } while (!__atomic_compare_exchange_n(&records, &head, record, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+    pthread_setspecific(record_key, record);
+    return record;
+}
+
+static inline EpochRecord *current_record(void) {
+    if (!self) {
+        self = acquire_record();
+    }
+    return self;
+}
+
+void epoch_enter(void) {
+    EpochRecord *record = current_record();
+    if (record->depth++ == 0) {
+        // Sequentially consistent so the store is visible before any of the
+        // reader's loads; a reclaimer then either sees us or we see its unlink
+        __atomic_store_n(&record->epoch, __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE), __ATOMIC_SEQ_CST);
+    }
+}
+
+void epoch_exit(void) {
+    EpochRecord *record = self;
+    if (--record->depth == 0) {
+        __atomic_store_n(&record->epoch, 0, __ATOMIC_RELEASE);
+    }
+}
+
+// Move the global epoch on if every active reader has caught up with it
+static uint64_t try_advance(void) {
+    uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    for (EpochRecord *record = __atomic_load_n(&records, __ATOMIC_ACQUIRE); record; record = record->next) {
+        uint64_t seen = __atomic_load_n(&record->epoch, __ATOMIC_SEQ_CST);
+        if (seen != 0 && seen != epoch) {
+            return epoch;
+        }
+    }
+    if (__atomic_compare_exchange_n(&global_epoch, &epoch, epoch + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return epoch + 1;
+    }
+    return epoch;   // Someone else advanced it
+}
+
+void epoch_collect(void) {
+    EpochRecord *record = current_record();
+    uint64_t epoch = try_advance();
+
+    // Readers active now entered at epoch - 1 or later, so anything
+    // unlinked two epochs ago is unreachable
+    while (record->limbo_head && record->limbo_head->epoch + 2 <= epoch) {
+        EpochRetired *retired = record->limbo_head;
+        record->limbo_head = retired->next;
+        record->limbo_count--;
+        retired->free_fn(retired->ptr);
+        if (record->spare_count < EPOCH_SPARE_ENTRIES) {
+            retired->next = record->spare;
+            record->spare = retired;
+            record->spare_count++;
+        } else {
+            free(retired);
+        }
+    }
+    if (!record->limbo_head) {
+        record->limbo_tail = NULL;
+    }
+}
+
+void epoch_synchronize(void) {
+    uint64_t target = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST) + 2;
+    while (try_advance() < target) {
+        sched_yield();
+    }
+}
+
+void epoch_retire(void *ptr, EpochFree free_fn) {
+    EpochRecord *record = current_record();
+    EpochRetired *retired = record->spare;
+    if (retired) {
+        record->spare = retired->next;
+        record->spare_count--;
+    } else {
+        retired = malloc(sizeof(EpochRetired));
+        if (!retired) {
+            fprintf(stderr, "Error: Failed to allocate epoch limbo entry.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    retired->next = NULL;
+    retired->ptr = ptr;
+    retired->free_fn = free_fn;
+    retired->epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+
+    if (record->limbo_tail) {
+        record->limbo_tail->next = retired;
+    } else {
+        record->limbo_head = retired;
+    }
+    record->limbo_tail = retired;
+
+    if (++record->limbo_count >= EPOCH_COLLECT_THRESHOLD) {
+        epoch_collect();
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+// Epoch-based reclamation for data read without locks. Readers bracket
+// their accesses with epoch_enter()/epoch_exit(); writers unlink an object
+// first and then hand it to epoch_retire(), which frees it once every
+// thread that might still see it has left its read section.
+
+#define EPOCH_COLLECT_THRESHOLD 64   // Retired objects per thread before trying to free some
+#define EPOCH_SPARE_ENTRIES 128      // Limbo entries per thread kept for reuse once freed
+
+typedef void (*EpochFree)(void *ptr);
+
+// Read sections nest and must not block for long: retired objects pile up
+// until the oldest reader leaves.
+void epoch_enter(void);
+void epoch_exit(void);
+
+// Free ptr with free_fn once no reader can hold a reference to it
+void epoch_retire(void *ptr, EpochFree free_fn);
+
+// Wait until every read section active at the call has ended. The caller
+// must not be inside one.
+void epoch_synchronize(void);
+
+// Free whatever the calling thread retired that is no longer visible
+void epoch_collect(void);
+
+#endif // EPOCH_H
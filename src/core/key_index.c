@@ -0,0 +1,348 @@
+#include "key_index.h"
+#include "epoch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Control bytes: a full slot has the high bit set and holds the top 7 bits
+// of its node's hash. Empty is zero, so a zeroed table is an empty one.
+#define CTRL_EMPTY   0x00
+#define CTRL_DELETED 0x01   // Removed, but probes must continue past it
+#define CTRL_FULL    0x80
+
+static inline int ctrl_is_full(uint8_t ctrl) {
+    return ctrl & CTRL_FULL;
+}
+
+static inline uint8_t hash_tag(uint64_t hash) {
+    return CTRL_FULL | (uint8_t)(hash >> 57);
+}
+
+// Skips the low bits of the hash, which choose the keyspace partition
+static inline size_t first_group(const KeyIndexTable *table, uint64_t hash) {
+    return (size_t)(hash >> 12) & table->group_mask;
+}
+
+static inline size_t table_capacity(const KeyIndexTable *table) {
+    return (table->group_mask + 1) * KEY_INDEX_GROUP_WIDTH;
+}
+
+#ifdef __SSE2__
+typedef __m128i Group;
+
+static inline Group group_load(const uint8_t *ctrl) {
+    return _mm_loadu_si128((const __m128i *)ctrl);
+}
+
+// Bit i set for each slot i of the group whose control byte is ctrl
+static inline uint32_t group_match(Group group, uint8_t ctrl) {
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)ctrl)));
+}
+
+// Empty or deleted slots
+static inline uint32_t group_match_free(Group group) {
+    return ~(uint32_t)_mm_movemask_epi8(group) & 0xFFFF;
+}
+#else
+typedef struct Group {
+    uint8_t ctrl[KEY_INDEX_GROUP_WIDTH];
+} Group;
+
+static inline Group group_load(const uint8_t *ctrl) {
+    Group group;
+    for (int i = 0; i < KEY_INDEX_GROUP_WIDTH; i++) {
+        group.ctrl[i] = __atomic_load_n(&ctrl[i], __ATOMIC_RELAXED);
+    }
+    return group;
+}
+
+static inline uint32_t group_match(Group group, uint8_t ctrl) {
+    uint32_t mask = 0;
+    for (int i = 0; i < KEY_INDEX_GROUP_WIDTH; i++) {
+        mask |= (uint32_t)(group.ctrl[i] == ctrl) << i;
+    }
+    return mask;
+}
+
+static inline uint32_t group_match_free(Group group) {
+    uint32_t mask = 0;
+    for (int i = 0; i < KEY_INDEX_GROUP_WIDTH; i++) {
+        mask |= (uint32_t)!ctrl_is_full(group.ctrl[i]) << i;
+    }
+    return mask;
+}
+#endif
+
+// calloc hands large tables out as fresh zero pages, so creating one costs
+// nothing up front and its pages are faulted in as the rehash fills them
+static KeyIndexTable *table_create(size_t groups) {
+    size_t capacity = groups * KEY_INDEX_GROUP_WIDTH;
+    KeyIndexTable *table = calloc(1, sizeof(KeyIndexTable) + capacity + capacity * sizeof(KeyIndexNode *));
+    if (!table) {
+        return NULL;
+    }
+    table->group_mask = groups - 1;
+    table->growth_left = capacity * KEY_INDEX_MAX_LOAD_NUM / KEY_INDEX_MAX_LOAD_DEN;
+    table->slots = (KeyIndexNode **)(table->ctrl + capacity);
+    return table;
+}
+
+int key_index_init(KeyIndex *index) {
+    index->count = 0;
+    index->rehash_cursor = 0;
+    index->rehash_groups = 0;
+    index->table = table_create(KEY_INDEX_INITIAL_GROUPS);
+    return index->table ? 0 : -1;
+}
+
+void key_index_destroy(KeyIndex *index) {
+    free(index->table->previous);
+    free(index->table);
+    index->table = NULL;
+    index->count = 0;
+    index->rehash_cursor = 0;
+    index->rehash_groups = 0;
+}
+
+// Groups are probed quadratically. A table always keeps some empty slots,
+// so every probe ends at a group with one.
+static KeyIndexNode *table_find(KeyIndexTable *table, uint64_t hash, const char *key, size_t key_len) {
+    uint8_t tag = hash_tag(hash);
+    size_t g = first_group(table, hash);
+
+    for (size_t step = 1; step <= table->group_mask + 1; step++) {
+        const uint8_t *ctrl = &table->ctrl[g * KEY_INDEX_GROUP_WIDTH];
+        // Fetch the group's slots alongside its control bytes
+        __builtin_prefetch(&table->slots[g * KEY_INDEX_GROUP_WIDTH]);
+        __builtin_prefetch(&table->slots[g * KEY_INDEX_GROUP_WIDTH + KEY_INDEX_GROUP_WIDTH / 2]);
+        Group group = group_load(ctrl);
+        // A full control byte is stored after its slot
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        for (uint32_t match = group_match(group, tag); match; match &= match - 1) {
+            size_t pos = g * KEY_INDEX_GROUP_WIDTH + __builtin_ctz(match);
+            KeyIndexNode *node = __atomic_load_n(&table->slots[pos], __ATOMIC_ACQUIRE);
+            if (node && node->hash == hash && node->key_len == key_len && memcmp(key_index_node_key(node), key, key_len) == 0) {
+                return node;
+            }
+        }
+        if (group_match(group, CTRL_EMPTY)) {
+            return NULL;
+        }
+        g = (g + step) & table->group_mask;
+    }
+    return NULL;
+}
+
+// Copying leaves nodes in the previous table, so a node missed in the new
+// table because it is not copied yet is still found there. The previous
+// table is read first: once it is gone, everything is in the new one.
+KeyIndexNode *key_index_find(KeyIndex *index, uint64_t hash, const char *key, size_t key_len) {
+    KeyIndexTable *table = __atomic_load_n(&index->table, __ATOMIC_ACQUIRE);
+    KeyIndexTable *previous = __atomic_load_n(&table->previous, __ATOMIC_ACQUIRE);
+    KeyIndexNode *node = table_find(table, hash, key, key_len);
+    if (!node && previous) {
+        node = table_find(previous, hash, key, key_len);
+    }
+    return node;
+}
+
+// Slot holding node in table, or -1
+static long find_slot(KeyIndexTable *table, KeyIndexNode *node) {
+    uint8_t tag = hash_tag(node->hash);
+    size_t g = first_group(table, node->hash);
+
+    for (size_t step = 1; step <= table->group_mask + 1; step++) {
+        Group group = group_load(&table->ctrl[g * KEY_INDEX_GROUP_WIDTH]);
+        for (uint32_t match = group_match(group, tag); match; match &= match - 1) {
+            size_t pos = g * KEY_INDEX_GROUP_WIDTH + __builtin_ctz(match);
+            if (table->slots[pos] == node) {
+                return (long)pos;
+            }
+        }
+        if (group_match(group, CTRL_EMPTY)) {
+            return -1;
+        }
+        g = (g + step) & table->group_mask;
+    }
+    return -1;
+}
+
+// First empty or deleted slot on hash's probe sequence
+static size_t find_free_slot(KeyIndexTable *table, uint64_t hash) {
+    size_t g = first_group(table, hash);
+    for (size_t step = 1;; step++) {
+        uint32_t free_slots = group_match_free(group_load(&table->ctrl[g * KEY_INDEX_GROUP_WIDTH]));
+        if (free_slots) {
+            return g * KEY_INDEX_GROUP_WIDTH + __builtin_ctz(free_slots);
+        }
+        g = (g + step) & table->group_mask;
+    }
+}
+
+// The slot first, so a reader that sees the control byte finds the node
+static void fill_slot(KeyIndexTable *table, size_t pos, KeyIndexNode *node) {
+    __atomic_store_n(&table->slots[pos], node, __ATOMIC_RELEASE);
+    __atomic_store_n(&table->ctrl[pos], hash_tag(node->hash), __ATOMIC_RELEASE);
+}
+
+// Link a node copied from the previous table
+static void place_node(KeyIndexTable *table, KeyIndexNode *node) {
+    size_t pos = find_free_slot(table, node->hash);
+    if (table->ctrl[pos] == CTRL_EMPTY) {
+        table->growth_left--;
+    }
+    fill_slot(table, pos, node);
+}
+
+// The previous table stays readable until every lookup that might still be
+// probing it has finished
+static void finish_rehash(KeyIndex *index) {
+    KeyIndexTable *previous = index->table->previous;
+    __atomic_store_n(&index->table->previous, NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&index->rehash_groups, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&index->rehash_cursor, 0, __ATOMIC_RELAXED);
+    // Tables are big; don't let them wait for a batch of retired entries
+    epoch_retire(previous, free);
+    epoch_collect();
+}
+
+int key_index_rehash(KeyIndex *index, size_t groups) {
+    KeyIndexTable *table = index->table;
+    KeyIndexTable *previous = table->previous;
+    if (!previous) {
+        return 0;
+    }
+
+    size_t cursor = index->rehash_cursor;
+    for (; groups > 0 && cursor <= previous->group_mask; groups--, cursor++) {
+        for (size_t pos = cursor * KEY_INDEX_GROUP_WIDTH; pos < (cursor + 1) * KEY_INDEX_GROUP_WIDTH; pos++) {
+            if (ctrl_is_full(previous->ctrl[pos])) {
+                place_node(table, previous->slots[pos]);
+            }
+        }
+    }
+    __atomic_store_n(&index->rehash_cursor, cursor, __ATOMIC_RELAXED);
+
+    if (cursor > previous->group_mask) {
+        finish_rehash(index);
+        return 0;
+    }
+    return 1;
+}
+
+void key_index_rehash_progress(const KeyIndex *index, size_t *done, size_t *total) {
+    *total = __atomic_load_n(&index->rehash_groups, __ATOMIC_RELAXED);
+    *done = *total ? __atomic_load_n(&index->rehash_cursor, __ATOMIC_RELAXED) : 0;
+}
+
+// Start copying into a fresh table, twice the size if the live nodes would
+// fill more than half of it; deleted slots are dropped on the way. The new
+// table has room for everything in the old one plus the inserts made while
+// the copy runs, since each of those copies at least one group.
+static void start_rehash(KeyIndex *index) {
+    if (index->table->previous) {
+        key_index_rehash(index, SIZE_MAX);
+    }
+
+    KeyIndexTable *old = index->table;
+    size_t groups = old->group_mask + 1;
+    while ((index->count + 1) * 2 * KEY_INDEX_MAX_LOAD_DEN >
+           groups * KEY_INDEX_GROUP_WIDTH * KEY_INDEX_MAX_LOAD_NUM) {
+        groups *= 2;
+    }
+
+    KeyIndexTable *table = table_create(groups);
+    if (!table) {
+        fprintf(stderr, "Error: Failed to grow the key index.\n");
+        exit(EXIT_FAILURE);
+    }
+    table->previous = old;
+    index->rehash_cursor = 0;
+    __atomic_store_n(&index->rehash_groups, old->group_mask + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&index->table, table, __ATOMIC_RELEASE);
+}
+
+void key_index_insert(KeyIndex *index, KeyIndexNode *node) {
+    KeyIndexTable *table = index->table;
+    size_t pos = find_free_slot(table, node->hash);
+
+    // Reusing a deleted slot costs nothing; filling an empty one brings
+    // the next rehash closer
+    if (table->ctrl[pos] == CTRL_EMPTY && table->growth_left == 0) {
+        start_rehash(index);
+        table = index->table;
+        pos = find_free_slot(table, node->hash);
+    }
+    if (table->ctrl[pos] == CTRL_EMPTY) {
+        table->growth_left--;
+    }
+    fill_slot(table, pos, node);
+    __atomic_store_n(&index->count, index->count + 1, __ATOMIC_RELAXED);
+
+    key_index_rehash(index, KEY_INDEX_REHASH_STEP);
+}
+
+// During a rehash a node may be linked in both tables
+void key_index_replace(KeyIndex *index, KeyIndexNode *old, KeyIndexNode *node) {
+    for (KeyIndexTable *table = index->table; table; table = table->previous) {
+        long pos = find_slot(table, old);
+        if (pos >= 0) {
+            __atomic_store_n(&table->slots[pos], node, __ATOMIC_RELEASE);
+        }
+    }
+    key_index_rehash(index, KEY_INDEX_REHASH_STEP);
+}
+
+static int unlink_node(KeyIndexTable *table, KeyIndexNode *node) {
+    long pos = find_slot(table, node);
+    if (pos < 0) {
+        return 0;
+    }
+
+    // A group that still has an empty slot has never been full, so no probe
+    // went past it and the slot can become empty again
+    size_t g = (size_t)pos / KEY_INDEX_GROUP_WIDTH;
+    if (group_match(group_load(&table->ctrl[g * KEY_INDEX_GROUP_WIDTH]), CTRL_EMPTY)) {
+        __atomic_store_n(&table->ctrl[pos], CTRL_EMPTY, __ATOMIC_RELEASE);
+        table->growth_left++;
+    } else {
+        __atomic_store_n(&table->ctrl[pos], CTRL_DELETED, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&table->slots[pos], NULL, __ATOMIC_RELEASE);
+    return 1;
+}
+
+void key_index_remove(KeyIndex *index, KeyIndexNode *node) {
+    int found = unlink_node(index->table, node);
+    if (index->table->previous) {
+        found |= unlink_node(index->table->previous, node);
+    }
+    if (found) {
+        __atomic_store_n(&index->count, index->count - 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Nodes of the previous table before the cursor are already in the new one
+void key_index_foreach(KeyIndex *index, KeyIndexVisitor visit, void *arg) {
+    KeyIndexTable *table = index->table;
+    KeyIndexTable *previous = table->previous;
+    if (previous) {
+        size_t end = table_capacity(previous);
+        for (size_t pos = index->rehash_cursor * KEY_INDEX_GROUP_WIDTH; pos < end; pos++) {
+            if (ctrl_is_full(previous->ctrl[pos]) && visit(previous->slots[pos], arg)) {
+                return;
+            }
+        }
+    }
+
+    size_t capacity = table_capacity(table);
+    for (size_t pos = 0; pos < capacity; pos++) {
+        if (ctrl_is_full(table->ctrl[pos]) && visit(table->slots[pos], arg)) {
+            return;
+        }
+    }
+}
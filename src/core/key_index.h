@@ -0,0 +1,80 @@
+#ifndef KEY_INDEX_H
+#define KEY_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Open-addressing hash index that readers probe without locks while a
+// single writer at a time (the caller holds a lock) changes it. Slots come
+// in groups of 16 with a control byte each holding 7 bits of the key's
+// hash, so a lookup matches a whole group at once and only follows the
+// pointer of a likely hit.
+//
+// Writers never modify a node that is linked: they link a new one in its
+// place and retire the old one through the epoch reclaimer, so readers must
+// stay inside epoch_enter()/epoch_exit() while they hold a node.
+//
+// Growing the table is incremental. The new table keeps a pointer to the
+// previous one and every write copies a group of it across, so no single
+// write pays for the whole rehash. Copied nodes stay in the previous table
+// until it is retired, and lookups search the new table first, so a reader
+// racing with the copy always finds the node in one of them.
+
+#define KEY_INDEX_GROUP_WIDTH 16   // Slots probed together
+#define KEY_INDEX_INITIAL_GROUPS 1
+#define KEY_INDEX_MAX_LOAD_NUM 7   // Rebuild once 7/8 of the slots have been used
+#define KEY_INDEX_MAX_LOAD_DEN 8
+#define KEY_INDEX_REHASH_STEP 1    // Groups of the previous table copied per write
+
+// Embedded in each indexed object, whose key must be stored in the same
+// allocation so an offset can find it
+typedef struct KeyIndexNode {
+    uint64_t hash;
+    uint32_t key_len;
+    uint32_t key_offset;   // Bytes from the start of the node to its key
+} KeyIndexNode;
+
+static inline const char *key_index_node_key(const KeyIndexNode *node) {
+    return (const char *)node + node->key_offset;
+}
+
+typedef struct KeyIndexTable {
+    size_t group_mask;    // Number of groups - 1
+    size_t growth_left;   // Empty slots that may still be filled before a rebuild
+    struct KeyIndexTable *previous;   // Still being copied into this one, or NULL
+    KeyIndexNode **slots;
+    uint8_t ctrl[] __attribute__((aligned(KEY_INDEX_GROUP_WIDTH)));   // One per slot
+} KeyIndexTable;
+
+typedef struct KeyIndex {
+    KeyIndexTable *table;
+    size_t count;
+    size_t rehash_cursor;   // Next group of table->previous to copy
+    size_t rehash_groups;   // Groups in table->previous, 0 when not rehashing
+} KeyIndex;
+
+// Called for each node; may remove that node. Returns 1 to stop.
+typedef int (*KeyIndexVisitor)(KeyIndexNode *node, void *arg);
+
+int key_index_init(KeyIndex *index);
+void key_index_destroy(KeyIndex *index);
+
+// Safe without the writer lock inside an epoch read section
+KeyIndexNode *key_index_find(KeyIndex *index, uint64_t hash, const char *key, size_t key_len);
+
+// Writers only. node->hash, key_len and key_offset must be set; the key must not
+// be present. Inserting and replacing also advance a rehash in progress.
+void key_index_insert(KeyIndex *index, KeyIndexNode *node);
+void key_index_replace(KeyIndex *index, KeyIndexNode *old, KeyIndexNode *node);
+void key_index_remove(KeyIndex *index, KeyIndexNode *node);
+void key_index_foreach(KeyIndex *index, KeyIndexVisitor visit, void *arg);
+
+// Writers only. Copy up to groups groups of the previous table; returns 1
+// while a rehash is still in progress.
+int key_index_rehash(KeyIndex *index, size_t groups);
+
+// Any thread. Groups copied so far and in total for the current rehash,
+// both 0 when there is none.
+void key_index_rehash_progress(const KeyIndex *index, size_t *done, size_t *total);
+
+#endif // KEY_INDEX_H
@@ -1,145 +1,1044 @@
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <limits.h>
+#include <stdint.h>
+#include <math.h>
 #include "protocol.h"
+#include "binary_protocol.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESP_SIMD
+#endif
 
-static int parse_length(char **ptr) {
-    char *endptr;
-    long length = strtol(*ptr, &endptr, 10);
-    if (endptr == *ptr || length < 0 || length > MAX_BULK_LENGTH) {
+// Longest bulk string a client may send
+static long long proto_max_bulk_len = RESP_DEFAULT_MAX_BULK;
+
+void set_proto_max_bulk_len(long long bytes) {
+    proto_max_bulk_len = bytes;
+}
+
+// Parse the decimal digits in [start, end). Returns -1 on malformed input.
+static long parse_length(const char *start, const char *end) {
+    if (start == end || end - start > 18) {
+        return -1;
+    }
+    long value = 0;
+    for (const char *p = start; p < end; p++) {
+        if (*p < '0' || *p > '9') {
+            return -1;
+        }
+        value = value * 10 + (*p - '0');
+    }
+    return value;
+}
+
+// Bit i set where p[i] is a CR, for the RESP_SCAN_BLOCK bytes at p
+typedef uint64_t (*CrScanner)(const char *p);
+
+#ifdef RESP_SIMD
+__attribute__((target("sse4.2")))
+static uint64_t cr_mask_sse42(const char *p) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    uint64_t mask = 0;
+    for (int i = 0; i < RESP_SCAN_BLOCK; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        mask |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, cr)) << i;
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64_t cr_mask_avx2(const char *p) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    __m256i low = _mm256_loadu_si256((const __m256i *)p);
+    __m256i high = _mm256_loadu_si256((const __m256i *)(p + 32));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, cr)) |
+           (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, cr)) << 32;
+}
+
+// Shuffle control moving the first k bytes of a vector to its end, read
+// from offset k; -1 clears a byte
+static const int8_t align_right[32] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+// Value of the k (1 to 16) decimal digits at p, which must have 16
+// readable bytes, or -1. The digits are right-aligned with leading zeros
+// and combined pairwise: 2-digit, then 4-digit, then 8-digit lanes.
+__attribute__((target("sse4.2")))
+static long parse_digits_sse42(const char *p, size_t k) {
+    __m128i digits = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)p), _mm_set1_epi8('0'));
+    uint32_t valid = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits));
+    uint32_t wanted = (1u << k) - 1;
+    if ((valid & wanted) != wanted) {
+        return -1;
+    }
+
+    digits = _mm_shuffle_epi8(digits, _mm_loadu_si128((const __m128i *)(align_right + k)));
+    __m128i pairs = _mm_maddubs_epi16(digits, _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1));
+    __m128i quads = _mm_madd_epi16(pairs, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+    quads = _mm_packus_epi32(quads, quads);
+    __m128i octets = _mm_madd_epi16(quads, _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+    return (long)(uint32_t)_mm_cvtsi128_si32(octets) * 100000000L +
+           (uint32_t)_mm_extract_epi32(octets, 1);
+}
+#endif
+
+static uint64_t cr_mask_resolve(const char *p);
+static CrScanner cr_scanner = cr_mask_resolve;   // NULL for the scalar level
+static int scan_level = -1;   // RespScanLevel, -1 until first used
+
+static int scan_level_supported(RespScanLevel level) {
+#ifdef RESP_SIMD
+    __builtin_cpu_init();
+    switch (level) {
+    case RESP_SCAN_AVX2: return __builtin_cpu_supports("avx2");
+    case RESP_SCAN_SSE42: return __builtin_cpu_supports("sse4.2");
+    default: return level == RESP_SCAN_SCALAR;
+    }
+#else
+    return level == RESP_SCAN_SCALAR;
+#endif
+}
+
+// Use level for header scanning. Returns -1 if the CPU lacks it.
+int set_resp_scan_level(RespScanLevel level) {
+    if (!scan_level_supported(level)) {
+        return -1;
+    }
+    CrScanner scanner = NULL;
+#ifdef RESP_SIMD
+    if (level == RESP_SCAN_AVX2) {
+        scanner = cr_mask_avx2;
+    } else if (level == RESP_SCAN_SSE42) {
+        scanner = cr_mask_sse42;
+    }
+#endif
+    __atomic_store_n(&scan_level, (int)level, __ATOMIC_RELAXED);
+    __atomic_store_n(&cr_scanner, scanner, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// Best level the CPU supports, unless one was set
+RespScanLevel resp_scan_level(void) {
+    int level = __atomic_load_n(&scan_level, __ATOMIC_RELAXED);
+    if (level >= 0) {
+        return (RespScanLevel)level;
+    }
+    for (level = RESP_SCAN_AVX2; level > RESP_SCAN_SCALAR; level--) {
+        if (scan_level_supported((RespScanLevel)level)) {
+            break;
+        }
+    }
+    set_resp_scan_level((RespScanLevel)level);
+    return (RespScanLevel)level;
+}
+
+// First call from any thread picks the scanner for the CPU. The scalar
+// level has none, so report no CR and let memchr() look.
+static uint64_t cr_mask_resolve(const char *p) {
+    resp_scan_level();
+    CrScanner scanner = __atomic_load_n(&cr_scanner, __ATOMIC_RELAXED);
+    return scanner ? scanner(p) : 0;
+}
+
+// Offset of the first CR at or after from, or len if there is none yet.
+// One vector compare covers the next RESP_SCAN_BLOCK bytes, and the mask is
+// kept so the following headers of a small command are found without
+// looking at the input again.
+static size_t find_cr(RespParser *parser, const char *buf, size_t from, size_t len) {
+    CrScanner scanner = __atomic_load_n(&cr_scanner, __ATOMIC_RELAXED);
+    if (scanner) {
+        size_t offset = from - parser->cr_base;
+        uint64_t bits = offset < RESP_SCAN_BLOCK ? parser->cr_mask >> offset : 0;
+        if (bits) {
+            return from + __builtin_ctzll(bits);
+        }
+        if (len - from >= RESP_SCAN_BLOCK) {
+            parser->cr_base = from;
+            parser->cr_mask = scanner(buf + from);
+            if (parser->cr_mask) {
+                return from + __builtin_ctzll(parser->cr_mask);
+            }
+            from += RESP_SCAN_BLOCK;
+        }
+    }
+    const char *cr = memchr(buf + from, '\r', len - from);
+    return cr ? (size_t)(cr - buf) : len;
+}
+
+// Parse the digits in [start, end), with input readable up to limit.
+// Lengths are mostly a digit or two, which the plain loop handles faster
+// than setting up vectors.
+static long parse_digits(const char *start, const char *end, const char *limit) {
+#ifdef RESP_SIMD
+    size_t k = end - start;
+    if (k > 4 && k <= 16 && limit - start >= 16 &&
+        __atomic_load_n(&scan_level, __ATOMIC_RELAXED) >= RESP_SCAN_SSE42) {
+        return parse_digits_sse42(start, k);
+    }
+#else
+    (void)limit;
+#endif
+    return parse_length(start, end);
+}
+
+// Parse a "<type><digits>\r\n" header at parser->pos.
+// Returns 1 with *value set, 0 if more input is needed, -1 on error.
+static int parse_header(RespParser *parser, char *buf, size_t len, char type, long *value) {
+    if (parser->pos >= len) {
+        return 0;
+    }
+    if (buf[parser->pos] != type) {
+        return -1;
+    }
+
+    // Resume the CRLF search where the previous attempt gave up
+    size_t start = parser->pos + 1;
+    size_t cr = find_cr(parser, buf, parser->scan > start ? parser->scan : start, len);
+    if (cr + 1 >= len) {
+        parser->scan = cr;
+        return parser->scan - parser->pos > RESP_MAX_LINE ? -1 : 0;
+    }
+    if (buf[cr + 1] != '\n') {
+        return -1;
+    }
+
+    *value = parse_digits(buf + start, buf + cr, buf + len);
+    if (*value < 0) {
         return -1;
     }
-    *ptr = endptr;
-    return length;
+    parser->pos = cr + 2;
+    parser->scan = parser->pos;
+    return 1;
 }
 
-static int skip_crlf(char **ptr) {
-    if (**ptr == '\r' && *(*ptr + 1) == '\n') {
-        *ptr += 2;
-        return 1;
+static int reserve_args(RespParser *parser, int count) {
+    if (count <= parser->args_capacity) {
+        return 0;
+    }
+    RedisString *args = realloc(parser->args, (size_t)count * sizeof(RedisString));
+    if (!args) {
+        return -1;
     }
+    parser->args = args;
+    parser->args_capacity = count;
     return 0;
 }
 
-static RedisString parse_bulk_string(char **ptr) {
-    RedisString result = {NULL, 0};
-    
-    if (**ptr != '$') {
-        return result;
+static void release_args(RespParser *parser) {
+    free(parser->args);
+    parser->args = NULL;
+    parser->args_capacity = 0;
+}
+
+// Take count contiguous argv slots from the arena. When the current chunk
+// is full, the next one is twice its size, and the first is sized for what
+// the previous batch needed, so a connection soon parses every batch into
+// a single chunk.
+static RedisString *arena_alloc(RespParser *parser, size_t count) {
+    RespArgvChunk *chunk = parser->arena_chunk;
+    if (chunk && chunk->capacity - chunk->used >= count) {
+        chunk->used += count;
+        return chunk->slots + chunk->used - count;
     }
-    (*ptr)++;
 
-    int length = parse_length(ptr);
-    if (length < 0 || !skip_crlf(ptr)) {
-        return result;
+    size_t capacity = chunk ? chunk->capacity * 2 : parser->arena_hint;
+    if (capacity < RESP_ARGV_CHUNK) {
+        capacity = RESP_ARGV_CHUNK;
+    }
+    if (capacity < count) {
+        capacity = count;
+    }
+    RespArgvChunk *fresh = malloc(sizeof(RespArgvChunk) + capacity * sizeof(RedisString));
+    if (!fresh) {
+        return NULL;
     }
+    fresh->next = NULL;
+    fresh->capacity = capacity;
+    fresh->used = count;
+    if (chunk) {
+        chunk->next = fresh;
+    } else {
+        parser->arena = fresh;
+    }
+    parser->arena_chunk = fresh;
+    return fresh->slots;
+}
 
-    result.data = *ptr;
-    result.length = length;
-    *ptr += length;
+// Hand the parsed arguments out as a command pointing into buf
+static long complete_command(RespParser *parser, char *buf, RedisCommand *cmd) {
+    long consumed = parser->pos;
 
-    if (!skip_crlf(ptr)) {
-        result.data = NULL;
-        result.length = 0;
+    if (parser->argc > 0) {
+        cmd->argv = arena_alloc(parser, parser->argc);
+        if (!cmd->argv) {
+            return -1;
+        }
+        for (int i = 0; i < parser->argc; i++) {
+            // While parsing, data holds the offset into the frame
+            cmd->argv[i].data = buf + (size_t)parser->args[i].data;
+            cmd->argv[i].length = parser->args[i].length;
+        }
+        cmd->argc = parser->argc;
     }
+    // Give back the slots of an unusually long command
+    if (parser->args_capacity > RESP_ARGS_PREALLOC) {
+        release_args(parser);
+    }
+
+    parser->state = RESP_STATE_START;
+    parser->pos = 0;
+    parser->scan = 0;
+    parser->argc = 0;
+    return consumed;
+}
+
+static int is_inline_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
 
-    return result;
+// Byte written for the escape at p[0..end) inside double quotes, which
+// takes *used bytes: \xHH, \n, \r, \t, \b, \a, or any other character as
+// itself
+static char unescape(const char *p, const char *end, size_t *used) {
+    if (p[0] == 'x' && end - p >= 3 && hex_digit(p[1]) >= 0 && hex_digit(p[2]) >= 0) {
+        *used = 3;
+        return (char)(hex_digit(p[1]) * 16 + hex_digit(p[2]));
+    }
+    *used = 1;
+    switch (p[0]) {
+    case 'n': return '\n';
+    case 'r': return '\r';
+    case 't': return '\t';
+    case 'b': return '\b';
+    case 'a': return '\a';
+    default: return p[0];
+    }
 }
 
-RedisCommand parse_redis_array(char *input) {
-    RedisCommand cmd = {NULL, 0};
-    char *ptr = input;
-    
-    // Handle simple text commands
-    if (*ptr != '*') {
-        // Remove trailing \r\n
-        size_t len = strlen(ptr);
-        while (len > 0 && (ptr[len-1] == '\r' || ptr[len-1] == '\n')) {
-            ptr[--len] = '\0';
+// Split buf[0..line_len) into arguments in one pass, the way redis-cli
+// quotes them: words are separated by blanks, "double quotes" take the
+// escapes above and 'single quotes' only \'. A closing quote must end
+// its word. Arguments are unquoted in place, which never needs more room
+// than the quoted text, and NUL-terminated.
+static int split_inline(RespParser *parser, char *buf, size_t line_len) {
+    char *p = buf;
+    char *end = buf + line_len;
+
+    for (;;) {
+        while (p < end && is_inline_space(*p)) {
+            p++;
+        }
+        if (p == end) {
+            return 0;
+        }
+
+        char *start = p;
+        char *out = p;
+        char quote = 0;
+        while (p < end) {
+            if (quote == '"' && *p == '\\' && p + 1 < end) {
+                size_t used;
+                *out++ = unescape(p + 1, end, &used);
+                p += 1 + used;
+            } else if (quote == '\'' && *p == '\\' && p + 1 < end && p[1] == '\'') {
+                *out++ = '\'';
+                p += 2;
+            } else if (quote && *p == quote) {
+                if (++p < end && !is_inline_space(*p)) {
+                    return -1;
+                }
+                quote = 0;
+                break;
+            } else if (!quote && (*p == '"' || *p == '\'')) {
+                quote = *p++;
+            } else if (!quote && is_inline_space(*p)) {
+                break;
+            } else {
+                *out++ = *p++;
+            }
+        }
+        if (quote) {
+            return -1;   // Unbalanced quotes
         }
-        
-        if (len == 0) return cmd;
-        
-        // Count words
-        int word_count = 1;
-        for (size_t i = 0; i < len; i++) {
-            if (ptr[i] == ' ') word_count++;
+
+        if (parser->argc == parser->args_capacity &&
+            reserve_args(parser, parser->args_capacity ? parser->args_capacity * 2 : 8) != 0) {
+            return -1;
         }
-        
-        if (word_count > MAX_ARGS) return cmd;
-        
-        cmd.argv = malloc(word_count * sizeof(RedisString));
-        if (!cmd.argv) return cmd;
-        cmd.argc = word_count;
-        
-        // Parse words
-        char *word = strtok(ptr, " \r\n");
-        int i = 0;
-        while (word && i < word_count) {
-            cmd.argv[i].data = word;
-            cmd.argv[i].length = strlen(word);
-            word = strtok(NULL, " \r\n");
-            i++;
+        parser->args[parser->argc].data = (char *)(start - buf);
+        parser->args[parser->argc].length = out - start;
+        parser->argc++;
+        if (p < end) {
+            p++;   // The separator, which the terminator may overwrite
         }
-        
-        return cmd;
+        *out = '\0';
+    }
+}
+
+// Plain-text command terminated by a newline, e.g. "PING\r\n" from telnet
+static long parse_inline(RespParser *parser, char *buf, size_t len, RedisCommand *cmd) {
+    char *newline = parser->scan < len ? memchr(buf + parser->scan, '\n', len - parser->scan) : NULL;
+    if (!newline) {
+        parser->scan = len;
+        return len > RESP_MAX_LINE ? -1 : 0;
     }
-    
-    // Original RESP parsing code
-    ptr++;
-    int length = parse_length(&ptr);
-    if (length < 0 || length > MAX_ARGS || !skip_crlf(&ptr)) {
-        return cmd;
+
+    size_t line_len = newline - buf;
+    parser->pos = line_len + 1;
+    *newline = '\0';
+    if (split_inline(parser, buf, line_len) != 0) {
+        return -1;
     }
+    return complete_command(parser, buf, cmd);
+}
 
-    cmd.argv = malloc(length * sizeof(RedisString));
-    if (!cmd.argv) {
-        return cmd;
+// A binary frame, parsed in one go once all of it is in buf: the header
+// gives its length up front, so nothing is searched for and nothing is
+// parsed twice. Arguments stay in place, each terminated by the zero byte
+// the client sent after it.
+static long parse_binary(RespParser *parser, char *buf, size_t len, RedisCommand *cmd) {
+    if (len < BINARY_HEADER_SIZE) {
+        return 0;
+    }
+    if ((unsigned char)buf[0] != BINARY_MAGIC || buf[1] != BINARY_VERSION) {
+        return -1;
+    }
+    unsigned opcode = binary_get_u16(buf + 2);
+    uint32_t count = binary_get_u32(buf + 4);
+    size_t body_len = binary_get_u32(buf + 8);
+    const char *name = binary_opcode_name(opcode);
+    // Every argument takes at least its length and its terminator
+    if ((opcode != BINARY_OP_COMMAND && !name) || count >= INT_MAX || body_len < (size_t)count * 5) {
+        return -1;
+    }
+    parser->binary_len = BINARY_HEADER_SIZE + body_len;
+    if (len < parser->binary_len) {
+        return 0;
     }
-    cmd.argc = length;
 
-    for (int i = 0; i < length; i++) {
-        cmd.argv[i] = parse_bulk_string(&ptr);
-        if (!cmd.argv[i].data) {
-            free(cmd.argv);
-            cmd.argv = NULL;
-            cmd.argc = 0;
-            return cmd;
+    // As for RESP, slots beyond the first RESP_ARGS_PREALLOC are reserved
+    // as arguments turn up rather than for the count the header announces
+    int argc = (int)count + (name != NULL);
+    if (reserve_args(parser, argc < RESP_ARGS_PREALLOC ? argc : RESP_ARGS_PREALLOC) != 0) {
+        return -1;
+    }
+    parser->argc = 0;
+    if (name) {
+        parser->args[parser->argc].data = NULL;   // Filled in once the command is complete
+        parser->args[parser->argc].length = strlen(name);
+        parser->argc++;
+    }
+    const char *lengths = buf + BINARY_HEADER_SIZE;
+    size_t pos = BINARY_HEADER_SIZE + (size_t)count * 4;
+    for (uint32_t i = 0; i < count; i++) {
+        size_t arg_len = binary_get_u32(lengths + 4 * (size_t)i);
+        if ((long long)arg_len > proto_max_bulk_len || parser->binary_len - pos < arg_len + 1 ||
+            buf[pos + arg_len] != '\0') {
+            return -1;
+        }
+        if (parser->argc == parser->args_capacity &&
+            reserve_args(parser, parser->args_capacity < argc / 2 ? parser->args_capacity * 2 : argc) != 0) {
+            return -1;
         }
+        parser->args[parser->argc].data = (char *)pos;
+        parser->args[parser->argc].length = arg_len;
+        parser->argc++;
+        pos += arg_len + 1;
+    }
+    if (pos != parser->binary_len) {
+        return -1;
     }
 
-    return cmd;
+    parser->pos = pos;
+    long consumed = complete_command(parser, buf, cmd);
+    if (consumed > 0 && name) {
+        cmd->argv[0].data = (char *)name;   // Commands only read their arguments
+    }
+    return consumed;
+}
+
+void init_resp_parser(RespParser *parser) {
+    memset(parser, 0, sizeof(*parser));
+    parser->state = RESP_STATE_START;
 }
 
-void free_command(RedisCommand *cmd) {
-    if (cmd->argv) {
-        free(cmd->argv);
-        cmd->argv = NULL;
-        cmd->argc = 0;
+void free_resp_parser(RespParser *parser) {
+    release_args(parser);
+    while (parser->arena) {
+        RespArgvChunk *next = parser->arena->next;
+        free(parser->arena);
+        parser->arena = next;
     }
+    parser->arena_chunk = NULL;
 }
 
-void send_redis_string(int socket, const char *str) {
-    char response[MAX_BULK_LENGTH];
-    snprintf(response, sizeof(response), "+%s\r\n", str);
-    write(socket, response, strlen(response));
+// Recycle the argv of every command handed out so far; they must not be
+// used afterwards. A batch that spilled over several chunks frees them all
+// and the next gets one large enough for it, up to RESP_ARGV_KEPT slots.
+void reset_resp_arena(RespParser *parser) {
+    RespArgvChunk *chunk = parser->arena;
+    if (!chunk) {
+        return;
+    }
+    if (!chunk->next && chunk->capacity <= RESP_ARGV_KEPT) {
+        chunk->used = 0;
+        parser->arena_chunk = chunk;
+        return;
+    }
+
+    size_t needed = 0;
+    while (chunk) {
+        RespArgvChunk *next = chunk->next;
+        needed += chunk->used;
+        free(chunk);
+        chunk = next;
+    }
+    parser->arena = NULL;
+    parser->arena_chunk = NULL;
+    parser->arena_hint = needed < RESP_ARGV_KEPT ? needed : RESP_ARGV_KEPT;
 }
 
-void send_redis_bulk_string(int socket, const char *str) {
-    char response[MAX_BULK_LENGTH];
+// Incrementally parse one command from buf, which holds len bytes starting at
+// the beginning of the current frame. Progress is kept in the parser, so a
+// frame split across reads is resumed rather than rescanned, and the buffer
+// may move between calls. Arguments point into buf; nothing is copied, and
+// cmd->argv comes from the parser's arena, so a command costs no allocation.
+//
+// Returns the frame length once a command is complete (cmd->argc may be 0
+// for empty frames), 0 if more input is needed and -1 on a protocol error.
+long parse_redis_command(RespParser *parser, char *buf, size_t len, RedisCommand *cmd) {
+    long value;
+    int ret;
+
+    cmd->argv = NULL;
+    cmd->argc = 0;
+
+    if (parser->state == RESP_STATE_START) {
+        if (len == 0) {
+            return 0;
+        }
+        if (parser->binary == 0) {
+            parser->binary = (unsigned char)buf[0] == BINARY_MAGIC ? 1 : -1;
+        }
+        if (parser->binary > 0) {
+            parser->state = RESP_STATE_BINARY;
+        } else {
+            parser->state = buf[0] == '*' ? RESP_STATE_MULTIBULK_LEN : RESP_STATE_INLINE;
+        }
+        parser->pos = 0;
+        parser->scan = 0;
+        parser->argc = 0;
+        parser->cr_mask = 0;
+        parser->binary_len = 0;
+    }
+
+    if (parser->state == RESP_STATE_BINARY) {
+        return parse_binary(parser, buf, len, cmd);
+    }
+
+    if (parser->state == RESP_STATE_INLINE) {
+        return parse_inline(parser, buf, len, cmd);
+    }
+
+    if (parser->state == RESP_STATE_MULTIBULK_LEN) {
+        ret = parse_header(parser, buf, len, '*', &value);
+        if (ret <= 0) {
+            return ret;
+        }
+        // Slots beyond the first few are added as arguments arrive, so a
+        // huge count alone cannot make the server allocate
+        if (value > INT_MAX || reserve_args(parser, value < RESP_ARGS_PREALLOC ? (int)value : RESP_ARGS_PREALLOC) != 0) {
+            return -1;
+        }
+        parser->multibulk_len = (int)value;
+        parser->state = RESP_STATE_BULK_LEN;
+    }
+
+    while (parser->argc < parser->multibulk_len) {
+        if (parser->state == RESP_STATE_BULK_LEN) {
+            ret = parse_header(parser, buf, len, '$', &value);
+            if (ret <= 0) {
+                return ret;
+            }
+            if (value > proto_max_bulk_len) {
+                return -1;
+            }
+            parser->bulk_len = value;
+            parser->state = RESP_STATE_BULK_DATA;
+        }
+
+        if (len - parser->pos < (size_t)parser->bulk_len + 2) {
+            return 0;
+        }
+        if (buf[parser->pos + parser->bulk_len] != '\r' || buf[parser->pos + parser->bulk_len + 1] != '\n') {
+            return -1;
+        }
+        if (parser->argc == parser->args_capacity &&
+            reserve_args(parser, parser->args_capacity < parser->multibulk_len / 2 ?
+                                 parser->args_capacity * 2 : parser->multibulk_len) != 0) {
+            return -1;
+        }
+        buf[parser->pos + parser->bulk_len] = '\0';   // The CR is not needed any more
+        parser->args[parser->argc].data = (char *)parser->pos;
+        parser->args[parser->argc].length = parser->bulk_len;
+        parser->argc++;
+        parser->pos += parser->bulk_len + 2;
+        parser->scan = parser->pos;
+        parser->state = RESP_STATE_BULK_LEN;
+    }
+
+    return complete_command(parser, buf, cmd);
+}
+
+// Length the current frame must reach before parsing can go on, or 0 when
+// that is not known yet. Set while the payload of a bulk string or the
+// body of a binary frame is awaited, so a transport can size its buffer
+// for all of it at once.
+size_t resp_frame_needed(const RespParser *parser) {
+    if (parser->state == RESP_STATE_BINARY) {
+        return parser->binary_len;
+    }
+    if (parser->state != RESP_STATE_BULK_DATA) {
+        return 0;
+    }
+    return parser->pos + (size_t)parser->bulk_len + 2;
+}
+
+// Compare an argument with a keyword such as an option name, ignoring case
+int redis_string_equals(const RedisString *str, const char *keyword) {
+    size_t len = strlen(keyword);
+    return str->length == len && strncasecmp(str->data, keyword, len) == 0;
+}
+
+// Parse an argument that must be a decimal integer in full. Returns 0 with
+// *value set, -1 if it is not one or does not fit.
+int redis_string_to_long(const RedisString *str, long long *value) {
+    const char *p = str->data;
+    const char *end = str->data + str->length;
+    int negative = p < end && *p == '-';
+    if (negative) {
+        p++;
+    }
+    if (p == end) {
+        return -1;
+    }
+
+    unsigned long long magnitude = 0;
+    unsigned long long limit = negative ? (unsigned long long)LLONG_MAX + 1 : LLONG_MAX;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9') {
+            return -1;
+        }
+        unsigned digit = *p - '0';
+        if (magnitude > (limit - digit) / 10) {
+            return -1;
+        }
+        magnitude = magnitude * 10 + digit;
+    }
+    *value = negative ? (long long)(0 - magnitude) : (long long)magnitude;
+    return 0;
+}
+
+// Write the whole response to a blocking socket. Non-blocking sockets
+// belong to transports, which install a ReplyWriter that buffers instead:
+// waiting here for one to drain would stall every client of the thread
+// behind one slow reader. If such a socket is full anyway, the client is
+// cut off rather than sent a reply with a piece missing.
+static void write_all(int socket, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(socket, data, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                fprintf(stderr, "Client %d cannot take its reply without blocking, disconnecting.\n", socket);
+                shutdown(socket, SHUT_RDWR);
+            }
+            return;
+        }
+        data += written;
+        len -= written;
+    }
+}
+
+// Replies go straight to the socket unless the transport running on this
+// thread installed its own writer (e.g. to batch sends)
+static __thread ReplyWriter reply_writer = NULL;
+
+void set_reply_writer(ReplyWriter writer) {
+    reply_writer = writer;
+}
+
+static __thread int reply_protocol = RESP_PROTOCOL_2;
+
+void set_reply_protocol(int version) {
+    reply_protocol = version;
+}
+
+int get_reply_protocol(void) {
+    return reply_protocol;
+}
+
+static void pass_reply(int socket, const char *data, size_t len) {
+    if (reply_writer) {
+        reply_writer(socket, data, len);
+    } else {
+        write_all(socket, data, len);
+    }
+}
+
+// Replies collected between begin_reply_batch() and end_reply_batch(). The
+// buffer is allocated once per thread and reused by every batch.
+static __thread char *reply_batch = NULL;
+static __thread size_t reply_batch_len = 0;
+static __thread int reply_batching = 0;
+
+void begin_reply_batch(void) {
+    if (!reply_batch) {
+        reply_batch = malloc(REPLY_BATCH_LIMIT);
+    }
+    reply_batching = reply_batch != NULL;   // Without a buffer, replies simply go out one by one
+    reply_batch_len = 0;
+}
+
+void end_reply_batch(int socket) {
+    if (reply_batching && reply_batch_len > 0) {
+        pass_reply(socket, reply_batch, reply_batch_len);
+    }
+    reply_batching = 0;
+    reply_batch_len = 0;
+}
+
+// Pass large replies on rather than copy them twice: a full batch goes
+// first, then anything that would not fit an empty one
+static void write_reply(int socket, const char *data, size_t len) {
+    if (!reply_batching) {
+        pass_reply(socket, data, len);
+        return;
+    }
+    if (reply_batch_len + len > REPLY_BATCH_LIMIT) {
+        if (reply_batch_len > 0) {
+            pass_reply(socket, reply_batch, reply_batch_len);
+            reply_batch_len = 0;
+        }
+        if (len > REPLY_BATCH_LIMIT / 2) {
+            pass_reply(socket, data, len);
+            return;
+        }
+    }
+    memcpy(reply_batch + reply_batch_len, data, len);
+    reply_batch_len += len;
+}
+
+// Pre-encoded replies shared by every client
+static const char shared_ok[] = "+OK\r\n";
+static const char shared_pong[] = "+PONG\r\n";
+static const char shared_null_bulk[] = "$-1\r\n";
+static const char shared_null[] = "_\r\n";
+static const char shared_crlf[] = "\r\n";
+static const char shared_binary_ok[] = "+\x02\0\0\0OK";
+static const char shared_binary_pong[] = "+\x04\0\0\0PONG";
+
+// RESP3 and binary clients get maps, sets, push messages and nulls as such
+int typed_replies(void) {
+    return reply_protocol != RESP_PROTOCOL_2;
+}
+
+// Bytes after a string's data: CRLF, or nothing when its length was given
+static size_t reply_trailer(void) {
+    return reply_protocol == RESP_PROTOCOL_BINARY ? 0 : 2;
+}
+
+#define REPLY_INLINE_LIMIT 256   // Smaller replies are assembled on the stack
+
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Write value in decimal to buf, which must hold REPLY_INTEGER_MAX bytes.
+// Returns the number of characters written (no terminator).
+size_t format_integer(char *buf, long long value) {
+    char digits[REPLY_INTEGER_MAX];
+    char *p = digits + sizeof(digits);
+    unsigned long long v = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+
+    while (v >= 100) {
+        unsigned int pair = (unsigned int)(v % 100) * 2;
+        v /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (v >= 10) {
+        *--p = digit_pairs[v * 2 + 1];
+        *--p = digit_pairs[v * 2];
+    } else {
+        *--p = (char)('0' + v);
+    }
+    if (value < 0) {
+        *--p = '-';
+    }
+
+    size_t len = digits + sizeof(digits) - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+// "<type><value>\r\n" into buf, or the type byte and value as a u32 for
+// binary clients; returns the length
+static size_t format_header(char *buf, char type, long long value) {
+    buf[0] = type;
+    if (reply_protocol == RESP_PROTOCOL_BINARY) {
+        binary_put_u32(buf + 1, (uint32_t)value);
+        return 5;
+    }
+    size_t len = 1 + format_integer(buf + 1, value);
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    return len;
+}
+
+// "<type><str>\r\n", with a prefix for errors
+static void send_line(int socket, char type, const char *prefix, const char *str) {
+    size_t prefix_len = strlen(prefix);
     size_t len = strlen(str);
-    snprintf(response, sizeof(response), "$%zu\r\n%s\r\n", len, str);
-    write(socket, response, strlen(response));
+    char response[REPLY_INLINE_LIMIT];
+    size_t header = 1;
+    response[0] = type;
+    if (reply_protocol == RESP_PROTOCOL_BINARY) {
+        header = format_header(response, type, (long long)(prefix_len + len));
+    }
+    size_t trailer = reply_trailer();
+    if (header + prefix_len + len + trailer <= REPLY_INLINE_LIMIT) {
+        memcpy(response + header, prefix, prefix_len);
+        memcpy(response + header + prefix_len, str, len);
+        memcpy(response + header + prefix_len + len, shared_crlf, trailer);
+        write_reply(socket, response, header + prefix_len + len + trailer);
+        return;
+    }
+    write_reply(socket, response, header);
+    write_reply(socket, prefix, prefix_len);
+    write_reply(socket, str, len);
+    if (trailer) {
+        write_reply(socket, shared_crlf, trailer);
+    }
+}
+
+void send_redis_ok(int socket) {
+    if (reply_protocol == RESP_PROTOCOL_BINARY) {
+        write_reply(socket, shared_binary_ok, sizeof(shared_binary_ok) - 1);
+    } else {
+        write_reply(socket, shared_ok, sizeof(shared_ok) - 1);
+    }
+}
+
+void send_redis_pong(int socket) {
+    if (reply_protocol == RESP_PROTOCOL_BINARY) {
+        write_reply(socket, shared_binary_pong, sizeof(shared_binary_pong) - 1);
+    } else {
+        write_reply(socket, shared_pong, sizeof(shared_pong) - 1);
+    }
+}
+
+void send_redis_null(int socket) {
+    if (reply_protocol == RESP_PROTOCOL_BINARY) {
+        write_reply(socket, shared_null, 1);
+    } else if (reply_protocol >= RESP_PROTOCOL_3) {
+        write_reply(socket, shared_null, sizeof(shared_null) - 1);
+    } else {
+        write_reply(socket, shared_null_bulk, sizeof(shared_null_bulk) - 1);
+    }
+}
+
+void send_redis_string(int socket, const char *str) {
+    send_line(socket, '+', "", str);
 }
 
 void send_redis_error(int socket, const char *str) {
-    char response[MAX_BULK_LENGTH];
-    snprintf(response, sizeof(response), "-ERR %s\r\n", str);
-    write(socket, response, strlen(response));
+    send_line(socket, '-', "ERR ", str);
+}
+
+// Error with its own code in place of ERR, e.g. NOPROTO
+void send_redis_error_code(int socket, const char *code, const char *str) {
+    char prefix[32];
+    size_t len = strnlen(code, sizeof(prefix) - 2);
+    memcpy(prefix, code, len);
+    prefix[len] = ' ';
+    prefix[len + 1] = '\0';
+    send_line(socket, '-', prefix, str);
+}
+
+void send_redis_integer(int socket, long long value) {
+    char response[REPLY_INTEGER_MAX + 3];
+    if (reply_protocol == RESP_PROTOCOL_BINARY) {
+        response[0] = ':';
+        binary_put_u64(response + 1, (uint64_t)value);
+        write_reply(socket, response, 9);
+        return;
+    }
+    write_reply(socket, response, format_header(response, ':', value));
+}
+
+void send_redis_double(int socket, double value) {
+    if (reply_protocol == RESP_PROTOCOL_BINARY) {
+        char response[9];
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        response[0] = ',';
+        binary_put_u64(response + 1, bits);
+        write_reply(socket, response, sizeof(response));
+        return;
+    }
+    char digits[REPLY_DOUBLE_MAX];
+    if (isinf(value)) {
+        strcpy(digits, value > 0 ? "inf" : "-inf");
+    } else if (isnan(value)) {
+        strcpy(digits, "nan");
+    } else {
+        snprintf(digits, sizeof(digits), "%.17g", value);
+    }
+    if (reply_protocol >= RESP_PROTOCOL_3) {
+        send_line(socket, ',', "", digits);
+    } else {
+        send_redis_bulk_string(socket, digits);
+    }
+}
+
+void send_redis_bool(int socket, int value) {
+    if (reply_protocol == RESP_PROTOCOL_BINARY) {
+        write_reply(socket, value ? "#\x01" : "#\0", 2);
+    } else if (reply_protocol >= RESP_PROTOCOL_3) {
+        write_reply(socket, value ? "#t\r\n" : "#f\r\n", 4);
+    } else {
+        send_redis_integer(socket, value != 0);
+    }
+}
+
+void send_redis_array(int socket, long long count) {
+    char response[REPLY_INTEGER_MAX + 3];
+    write_reply(socket, response, format_header(response, '*', count));
 }
 
-void send_redis_integer(int socket, int value) {
-    char response[MAX_BULK_LENGTH];
-    snprintf(response, sizeof(response), ":%d\r\n", value); // Format as Redis integer
-    write(socket, response, strlen(response));  // Send to the client
-}
\ No newline at end of file
+// Header of pairs key/value pairs
+void send_redis_map(int socket, long long pairs) {
+    char response[REPLY_INTEGER_MAX + 3];
+    if (typed_replies()) {
+        write_reply(socket, response, format_header(response, '%', pairs));
+    } else {
+        write_reply(socket, response, format_header(response, '*', pairs * 2));
+    }
+}
+
+void send_redis_set(int socket, long long count) {
+    char response[REPLY_INTEGER_MAX + 3];
+    write_reply(socket, response, format_header(response, typed_replies() ? '~' : '*', count));
+}
+
+// Out-of-band message, such as an invalidation; RESP2 clients get an array
+void send_redis_push(int socket, long long count) {
+    char response[REPLY_INTEGER_MAX + 3];
+    write_reply(socket, response, format_header(response, typed_replies() ? '>' : '*', count));
+}
+
+// Bulk string of len bytes; data may contain anything, including NULs
+void send_redis_bulk(int socket, const char *data, size_t len) {
+    char response[REPLY_INLINE_LIMIT];
+    size_t header = format_header(response, '$', (long long)len);
+    size_t trailer = reply_trailer();
+    if (header + len + trailer <= sizeof(response)) {
+        memcpy(response + header, data, len);
+        memcpy(response + header + len, shared_crlf, trailer);
+        write_reply(socket, response, header + len + trailer);
+        return;
+    }
+    write_reply(socket, response, header);
+    write_reply(socket, data, len);
+    if (trailer) {
+        write_reply(socket, shared_crlf, trailer);
+    }
+}
+
+void send_redis_bulk_string(int socket, const char *str) {
+    send_redis_bulk(socket, str, strlen(str));
+}
+
+size_t reply_length(int protocol, const char *buf, size_t len) {
+    if (protocol == RESP_PROTOCOL_BINARY) {
+        long total = binary_reply_length(buf, len);
+        return total > 0 ? (size_t)total : 0;
+    }
+    const char *newline = len > 0 ? memchr(buf, '\n', len) : NULL;
+    if (!newline) {
+        return 0;
+    }
+    size_t line = (size_t)(newline - buf) + 1;
+    if (buf[0] != '$') {
+        return line;
+    }
+    long bulk = strtol(buf + 1, NULL, 10);
+    if (bulk < 0) {
+        return line;
+    }
+    size_t total = line + (size_t)bulk + 2;
+    return total <= len ? total : 0;
+}
+
+// Length of the header of an aggregate of the given type (e.g. '*') at the
+// start of buf, with its element count; 0 if buf does not start with one
+size_t reply_aggregate_header(int protocol, const char *buf, size_t len, char type, long long *count) {
+    if (len == 0 || buf[0] != type) {
+        return 0;
+    }
+    if (protocol == RESP_PROTOCOL_BINARY) {
+        if (len < 5) {
+            return 0;
+        }
+        *count = binary_get_u32(buf + 1);
+        return 5;
+    }
+    const char *newline = memchr(buf, '\n', len);
+    if (!newline) {
+        return 0;
+    }
+    *count = strtoll(buf + 1, NULL, 10);
+    return (size_t)(newline - buf) + 1;
+}
+
+// 0 with the value if buf starts with an integer reply, -1 otherwise
+int reply_to_integer(int protocol, const char *buf, size_t len, long long *value) {
+    if (len == 0 || buf[0] != ':') {
+        return -1;
+    }
+    if (protocol == RESP_PROTOCOL_BINARY) {
+        if (len < 9) {
+            return -1;
+        }
+        *value = (long long)binary_get_u64(buf + 1);
+        return 0;
+    }
+    *value = strtoll(buf + 1, NULL, 10);
+    return 0;
+}
+
+// Whether buf holds exactly one +OK
+int reply_is_ok(int protocol, const char *buf, size_t len) {
+    if (protocol == RESP_PROTOCOL_BINARY) {
+        return len == sizeof(shared_binary_ok) - 1 && memcmp(buf, shared_binary_ok, len) == 0;
+    }
+    return len == sizeof(shared_ok) - 1 && memcmp(buf, shared_ok, len) == 0;
+}
@@ -2,28 +2,147 @@
 #define PROTOCOL_H
 
 #include <stdlib.h>
+#include <stdint.h>
 
-#define MAX_BULK_LENGTH 512
-#define MAX_ARGS 32
+#define RESP_MAX_LINE (64 * 1024)   // Longest header or inline command line
+#define RESP_DEFAULT_MAX_BULK (512LL * 1024 * 1024)   // Longest bulk string unless configured
+#define RESP_ARGS_PREALLOC 1024     // Argument slots reserved up front, however many are announced
+#define RESP_ARGV_CHUNK 64          // Smallest argv arena chunk, in slots
+#define RESP_ARGV_KEPT 4096         // Largest argv arena chunk kept between batches
+#define RESP_SCAN_BLOCK 64          // Input bytes searched for CRs at once
+#define REPLY_INTEGER_MAX 21        // Longest decimal long long, sign included
+#define REPLY_DOUBLE_MAX 32         // Longest double as "%.17g", sign and exponent included
+#define REPLY_BATCH_LIMIT (64 * 1024)   // Batched replies are passed on before growing past this
 
+// Reply encodings a client can pick with HELLO
+#define RESP_PROTOCOL_2 2
+#define RESP_PROTOCOL_3 3           // Typed replies: null, maps, sets, doubles, booleans, push
+#define RESP_PROTOCOL_BINARY 1      // Typed replies in the framing of binary_protocol.h
+
+// An argument. data may hold any bytes; the parser also terminates it with
+// a NUL not counted in length, so it can be read as a C string when it
+// contains no NUL of its own.
 typedef struct {
     char *data;
     size_t length;
 } RedisString;
 
+// argv belongs to the parser's arena and stays valid until reset_resp_arena()
 typedef struct {
     RedisString *argv;
     int argc;
 } RedisCommand;
 
+// Slots handed out as argv arrays. Chunks never move, so commands parsed
+// ahead of execution keep their argv while more are parsed.
+typedef struct RespArgvChunk {
+    struct RespArgvChunk *next;
+    size_t capacity;
+    size_t used;
+    RedisString slots[];
+} RespArgvChunk;
+
+typedef enum {
+    RESP_STATE_START,          // Waiting for the first byte of a frame
+    RESP_STATE_INLINE,         // Plain-text command, waiting for the newline
+    RESP_STATE_MULTIBULK_LEN,  // Waiting for "*<argc>\r\n"
+    RESP_STATE_BULK_LEN,       // Waiting for "$<len>\r\n"
+    RESP_STATE_BULK_DATA,      // Waiting for <len> bytes plus CRLF
+    RESP_STATE_BINARY          // Waiting for a whole binary frame
+} RespState;
+
+// Resumable parser state for one connection. Offsets are relative to the
+// start of the frame being parsed.
+typedef struct {
+    RespState state;
+    size_t pos;           // Next unparsed byte
+    size_t scan;          // Where to resume searching for a line terminator
+    int multibulk_len;    // Expected argument count
+    long bulk_len;        // Length of the bulk string being read
+    int argc;             // Arguments completed so far
+    RedisString *args;    // Completed arguments (data holds the frame offset)
+    int args_capacity;
+    size_t cr_base;       // CRs found among the RESP_SCAN_BLOCK bytes from cr_base:
+    uint64_t cr_mask;     // bit i for byte cr_base + i, 0 when none are known
+    RespArgvChunk *arena;         // argv storage, reused once the commands have run
+    RespArgvChunk *arena_chunk;   // Chunk being handed out
+    size_t arena_hint;            // Slots the last batch needed, to size the next chunk
+    int binary;           // Set by the connection's first byte: 1 binary frames, -1 RESP, 0 unknown yet
+    size_t binary_len;    // Length of the binary frame being read, 0 until its header is in
+} RespParser;
+
+// Instruction sets for finding and parsing RESP headers, picked at run
+// time from what the CPU supports
+typedef enum {
+    RESP_SCAN_SCALAR,
+    RESP_SCAN_SSE42,
+    RESP_SCAN_AVX2
+} RespScanLevel;
+
+// Transports that do not write replies to the socket directly
+typedef void (*ReplyWriter)(int socket, const char *data, size_t len);
+
 // Protocol parsing functions
-RedisCommand parse_redis_array(char *input);
-void free_command(RedisCommand *cmd);
+void init_resp_parser(RespParser *parser);
+void free_resp_parser(RespParser *parser);
+long parse_redis_command(RespParser *parser, char *buf, size_t len, RedisCommand *cmd);
+size_t resp_frame_needed(const RespParser *parser);
+void set_proto_max_bulk_len(long long bytes);
+RespScanLevel resp_scan_level(void);
+int set_resp_scan_level(RespScanLevel level);
+void reset_resp_arena(RespParser *parser);
+
+// Argument helpers, so handlers read arguments in place without copying
+int redis_string_equals(const RedisString *str, const char *keyword);
+int redis_string_to_long(const RedisString *str, long long *value);
 
-// Response functions
+// Response functions. Replies are appended to the client's output buffer
+// by the transport's ReplyWriter and, doubles aside, never formatted with
+// printf. Types RESP2 lacks fall back to what Redis sends RESP2 clients:
+// maps become arrays of key/value pairs, doubles bulk strings, booleans
+// 1 or 0. An aggregate header is followed by its elements' replies. Binary
+// clients get every type in binary_protocol.h's encoding.
+void send_redis_ok(int socket);
+void send_redis_pong(int socket);
+void send_redis_null(int socket);
 void send_redis_string(int socket, const char *str);
+void send_redis_bulk(int socket, const char *data, size_t len);
 void send_redis_bulk_string(int socket, const char *str);
 void send_redis_error(int socket, const char *str);
-void send_redis_integer(int socket, int value);
+void send_redis_error_code(int socket, const char *code, const char *str);
+void send_redis_integer(int socket, long long value);
+void send_redis_double(int socket, double value);
+void send_redis_bool(int socket, int value);
+void send_redis_array(int socket, long long count);
+void send_redis_map(int socket, long long pairs);
+void send_redis_set(int socket, long long count);
+void send_redis_push(int socket, long long count);
+size_t format_integer(char *buf, long long value);
+void set_reply_writer(ReplyWriter writer);
+
+// Collect the replies sent on this thread until end_reply_batch(), which
+// hands them to the writer in one piece, so an aggregate costs one write
+// rather than one per element
+void begin_reply_batch(void);
+void end_reply_batch(int socket);
+
+// Encoding of the replies of the command running on this thread. The
+// transport sets it from the client before each command and keeps what
+// it is afterwards, which HELLO may have changed.
+void set_reply_protocol(int version);
+int get_reply_protocol(void);
+
+// Whether this thread's client takes typed replies (RESP3 or binary), for
+// commands whose reply differs in shape from what RESP2 clients get
+int typed_replies(void);
+
+// Replies captured by a ReplyWriter, read back in the encoding of protocol.
+// reply_length handles the replies of single-key commands: simple types and
+// bulk strings, plus any aggregate for binary clients. It returns 0 when
+// buf does not start with a whole one.
+size_t reply_length(int protocol, const char *buf, size_t len);
+size_t reply_aggregate_header(int protocol, const char *buf, size_t len, char type, long long *count);
+int reply_to_integer(int protocol, const char *buf, size_t len, long long *value);
+int reply_is_ok(int protocol, const char *buf, size_t len);
 
 #endif // PROTOCOL_H
\ No newline at end of file
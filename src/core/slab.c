@@ -0,0 +1,218 @@
+#include "slab.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// 16-byte steps up to 256, then eight classes per doubling, so rounding
+// up wastes at most 1/8 of an object
+static const size_t class_sizes[] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 144, 160, 176, 192, 208, 224, 240, 256,
+    288, 320, 352, 384, 416, 448, 480, 512,
+    576, 640, 704, 768, 832, 896, 960, 1024,
+    1152, 1280, 1408, 1536, 1664, 1792, 1920, 2048
+};
+#define SLAB_CLASSES ((int)(sizeof(class_sizes) / sizeof(class_sizes[0])))
+
+// Objects of one size class that no thread has cached
+typedef struct SlabClass {
+    pthread_mutex_t lock;
+    void *free_list;    // Linked through each object's first word
+    char *bump;         // Not yet carved part of the newest slab
+    char *bump_end;
+} SlabClass;
+
+// Per-thread state. Like epoch records these are never freed: a thread
+// that exits hands its cached objects back and leaves the record, counters
+// included, to the next thread that needs one.
+typedef struct SlabCache {
+    void *free[SLAB_CLASSES];
+    int count[SLAB_CLASSES];
+    // Written only by the owning thread. Objects freed by another thread
+    // are subtracted there, so a single record can go negative.
+    long allocated;
+    long requested;
+    long large;
+    int in_use;
+    struct SlabCache *next;
+} SlabCache;
+
+static SlabClass classes[SLAB_CLASSES] = {
+    [0 ... SLAB_CLASSES - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+static size_t reserved = 0;
+static SlabCache *caches = NULL;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static __thread SlabCache *self = NULL;
+
+static inline int size_class(size_t size) {
+    if (size <= 256) {
+        return size ? (int)((size - 1) >> 4) : 0;
+    }
+    int shift = 63 - __builtin_clzl(size - 1);   // 8 for 257..512
+    return 16 + (shift - 8) * 8 + (int)((size - 1 - ((size_t)1 << shift)) >> (shift - 3));
+}
+
+static inline void add_count(long *counter, long delta) {
+    __atomic_store_n(counter, *counter + delta, __ATOMIC_RELAXED);
+}
+
+// Hand a thread's cached objects of class c back to the class until keep
+// are left: the ones at the head of its list, which are the most recently
+// freed, so only those are walked. keep 0 hands back all of them.
+static void flush_cache(SlabCache *cache, int c, int keep) {
+    if (cache->count[c] <= keep) {
+        return;
+    }
+    void *head = cache->free[c];
+    void *tail = head;
+    for (int i = 1; i < cache->count[c] - keep; i++) {
+        tail = *(void **)tail;
+    }
+    cache->free[c] = *(void **)tail;
+    cache->count[c] = keep;
+
+    SlabClass *slab_class = &classes[c];
+    pthread_mutex_lock(&slab_class->lock);
+    *(void **)tail = slab_class->free_list;
+    slab_class->free_list = head;
+    pthread_mutex_unlock(&slab_class->lock);
+}
+
+static void release_cache(void *arg) {
+    SlabCache *cache = (SlabCache *)arg;
+    for (int c = 0; c < SLAB_CLASSES; c++) {
+        flush_cache(cache, c, 0);
+    }
+    self = NULL;
+    __atomic_store_n(&cache->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void create_cache_key(void) {
+    pthread_key_create(&cache_key, release_cache);
+}
+
+static SlabCache *acquire_cache(void) {
+    pthread_once(&cache_key_once, create_cache_key);
+
+    SlabCache *cache;
+    for (cache = __atomic_load_n(&caches, __ATOMIC_ACQUIRE); cache; cache = cache->next) {
+        int unused = 0;
+        if (__atomic_compare_exchange_n(&cache->in_use, &unused, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (!cache) {
+        cache = calloc(1, sizeof(SlabCache));
+        if (!cache) {
+            fprintf(stderr, "Error: Failed to allocate slab cache.\n");
+            exit(EXIT_FAILURE);
+        }
+        cache->in_use = 1;
+        SlabCache *head = __atomic_load_n(&caches, __ATOMIC_RELAXED);
+        do {
+            cache->next = head;
+        } while (!__atomic_compare_exchange_n(&caches, &head, cache, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+    pthread_setspecific(cache_key, cache);
+    return cache;
+}
+
+static inline SlabCache *current_cache(void) {
+    if (!self) {
+        self = acquire_cache();
+    }
+    return self;
+}
+
+// Fill an empty thread cache with half a cache's worth, from the class's
+// free list first and then from fresh slab space
+static void refill_cache(SlabCache *cache, int c) {
+    SlabClass *slab_class = &classes[c];
+    size_t size = class_sizes[c];
+    int wanted = SLAB_CACHE_OBJECTS / 2;
+
+    pthread_mutex_lock(&slab_class->lock);
+    while (cache->count[c] < wanted) {
+        void *obj = slab_class->free_list;
+        if (obj) {
+            slab_class->free_list = *(void **)obj;
+        } else {
+            if (slab_class->bump + size > slab_class->bump_end) {
+                char *page = malloc(SLAB_PAGE_SIZE);
+                if (!page) {
+                    break;
+                }
+                __atomic_add_fetch(&reserved, SLAB_PAGE_SIZE, __ATOMIC_RELAXED);
+                slab_class->bump = page;
+                slab_class->bump_end = page + SLAB_PAGE_SIZE;
+            }
+            obj = slab_class->bump;
+            slab_class->bump += size;
+        }
+        *(void **)obj = cache->free[c];
+        cache->free[c] = obj;
+        cache->count[c]++;
+    }
+    pthread_mutex_unlock(&slab_class->lock);
+}
+
+void *slab_alloc(size_t size) {
+    SlabCache *cache = current_cache();
+    if (size > SLAB_MAX_SIZE) {
+        void *ptr = malloc(size);
+        if (ptr) {
+            add_count(&cache->large, (long)size);
+        }
+        return ptr;
+    }
+
+    int c = size_class(size);
+    if (!cache->free[c]) {
+        refill_cache(cache, c);
+        if (!cache->free[c]) {
+            return NULL;
+        }
+    }
+    void *obj = cache->free[c];
+    cache->free[c] = *(void **)obj;
+    cache->count[c]--;
+    add_count(&cache->allocated, (long)class_sizes[c]);
+    add_count(&cache->requested, (long)size);
+    return obj;
+}
+
+void slab_free(void *ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    SlabCache *cache = current_cache();
+    if (size > SLAB_MAX_SIZE) {
+        free(ptr);
+        add_count(&cache->large, -(long)size);
+        return;
+    }
+
+    int c = size_class(size);
+    *(void **)ptr = cache->free[c];
+    cache->free[c] = ptr;
+    add_count(&cache->allocated, -(long)class_sizes[c]);
+    add_count(&cache->requested, -(long)size);
+    if (++cache->count[c] > SLAB_CACHE_OBJECTS) {
+        flush_cache(cache, c, SLAB_CACHE_OBJECTS / 2);
+    }
+}
+
+void slab_stats(SlabStats *stats) {
+    long allocated = 0, requested = 0, large = 0;
+    for (SlabCache *cache = __atomic_load_n(&caches, __ATOMIC_ACQUIRE); cache; cache = cache->next) {
+        allocated += __atomic_load_n(&cache->allocated, __ATOMIC_RELAXED);
+        requested += __atomic_load_n(&cache->requested, __ATOMIC_RELAXED);
+        large += __atomic_load_n(&cache->large, __ATOMIC_RELAXED);
+    }
+    stats->reserved = __atomic_load_n(&reserved, __ATOMIC_RELAXED);
+    stats->allocated = allocated > 0 ? (size_t)allocated : 0;
+    stats->requested = requested > 0 ? (size_t)requested : 0;
+    stats->large = large > 0 ? (size_t)large : 0;
+}
@@ -0,0 +1,30 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+// Size-class allocator for keyspace objects. Objects are carved out of
+// 64 KB slabs, one size class per slab, and freed objects go back to a
+// per-thread cache so the common path takes no lock. Callers pass the
+// allocation size back to slab_free(), which spares every object a header.
+// Requests above SLAB_MAX_SIZE go to malloc.
+
+#define SLAB_PAGE_SIZE (64 * 1024)
+#define SLAB_MAX_SIZE 2048
+#define SLAB_CACHE_OBJECTS 64   // Per class and thread before half is handed back
+
+typedef struct SlabStats {
+    size_t reserved;    // Slab pages obtained from the system
+    size_t allocated;   // Size-class bytes of live objects
+    size_t requested;   // Bytes callers asked for, live objects only
+    size_t large;       // Live allocations above SLAB_MAX_SIZE
+} SlabStats;
+
+void *slab_alloc(size_t size);
+void slab_free(void *ptr, size_t size);
+
+// Totals over every thread; a consistent snapshot only when the keyspace
+// is idle
+void slab_stats(SlabStats *stats);
+
+#endif // SLAB_H
@@ -9,8 +9,17 @@
 #include <sys/types.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/time.h>
 #include <pthread.h>
 #include "./networking/Server.h"
+#include "./networking/event_loop.h"
+#include "./networking/uring.h"
+#include "./networking/connection.h"
+#include "./networking/worker_pool.h"
+#include "./networking/shm.h"
+#include "./networking/partition.h"
+#include "./networking/io_threads.h"
+#include "./core/config.h"
 #include "./core/protocol.h"
 #include "./core/commands.h"
 #include "./persistence/sdb.h"
@@ -45,7 +54,6 @@ void handle_shutdown(int sig) {
 }
 
 void handle_client(int client_socket) {
-    char buffer[30000];
     ssize_t bytes_read;
 
     printf("Handling client (PID: %d)\n", getpid());
@@ -56,9 +64,19 @@ void handle_client(int client_socket) {
     //     return;
     // }
 
+    Connection *conn = connection_create(client_socket);
+    if (!conn) {
+        close(client_socket);
+        return;
+    }
+
+    // The socket is blocking; the send timeout makes a stalled flush come
+    // back periodically so the output buffer limits can be enforced
+    struct timeval timeout = { .tv_sec = CONNECTION_SEND_TIMEOUT, .tv_usec = 0 };
+    setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
     while (1) {
-        memset(buffer, 0, sizeof(buffer));
-        bytes_read = read(client_socket, buffer, sizeof(buffer) - 1);
+        bytes_read = connection_read(conn);
 
         if (bytes_read <= 0) {
             if (bytes_read == 0) {
@@ -69,52 +87,91 @@ void handle_client(int client_socket) {
             break;
         }
 
-        RedisCommand cmd = parse_redis_array(buffer);
-        if (cmd.argv) {
-            execute_command(client_socket, &cmd);
-            free_command(&cmd);
-        } else {
-            send_redis_error(client_socket, "protocol error");
+        int ret = connection_process_input(conn);
+
+        // Write every queued reply unless the client goes over its output
+        // buffer limit while we wait for it to read
+        Connection *pending;
+        while ((pending = connection_pop_pending())) {
+            int flushed;
+            while ((flushed = connection_flush(pending)) == 0);
+            if (flushed < 0) {
+                ret = -1;
+            }
+        }
+        if (ret != 0) {
+            break;
         }
     }
 
+    connection_free(conn);
     close(client_socket);
 }
 
 
-void *client_thread(void *arg) {
-    int client_socket = *(int *)arg;
-    free(arg);  // Free dynamically allocated socket
-    handle_client(client_socket);
+// Queue a client for the worker pool, or turn it away if the pool is saturated
+static void dispatch_client(int client_socket) {
+    static const char rejected[] = "-ERR max number of clients reached\r\n";
+
+    if (worker_pool_submit(client_socket) != 0) {
+        fprintf(stderr, "Worker pool saturated, rejecting client.\n");
+        send(client_socket, rejected, sizeof(rejected) - 1, MSG_DONTWAIT);
+        close(client_socket);
+    }
+}
+
+static int accept_client(int listen_socket, struct sockaddr *address, socklen_t *address_length) {
+    int client_socket = accept(listen_socket, address, address_length);
+    if (client_socket < 0) {
+        perror("Accept failed");
+        if (errno == EMFILE || errno == ENFILE) {
+            usleep(10000);
+        }
+    }
+    return client_socket;
+}
+
+// Accepts clients on the Unix domain socket for the worker pool
+static void *unix_accept_thread(void *arg) {
+    int listen_socket = *(int *)arg;
+    while (1) {
+        int client_socket = accept_client(listen_socket, NULL, NULL);
+        if (client_socket >= 0) {
+            dispatch_client(client_socket);
+        }
+    }
     return NULL;
 }
 
+// Legacy thread-per-connection model (--io threads). Clients are served by
+// a fixed pool of workers; when all are busy and the queue is full, new
+// clients are turned away instead of spawning more threads.
 void launch(struct Server *server) {
     int address_length = sizeof(server->address);
-    while (1) {
-        printf("====WAITING FOR CONNECTION (PID: %d)=====\n", getpid());
-        int *client_socket = malloc(sizeof(int));
-        if (!client_socket) {
-            fprintf(stderr, "Error: Failed to allocate memory for client socket.\n");
-            continue;
-        }
 
-        *client_socket = accept(server->socket, (struct sockaddr *)&server->address, (socklen_t *)&address_length);
+    if (worker_pool_start(server_config.workers, server_config.worker_queue, handle_client) != 0) {
+        fprintf(stderr, "Failed to start worker pool. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (server->unix_socket >= 0) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, unix_accept_thread, &server->unix_socket) != 0) {
+            perror("Failed to create unix socket acceptor");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread);
+    }
 
-        if (*client_socket < 0) {
-            perror("Accept failed");
-            free(client_socket);
+    while (1) {
+        printf("====WAITING FOR CONNECTION (PID: %d)=====\n", getpid());
+        int client_socket = accept_client(server->socket, (struct sockaddr *)&server->address, (socklen_t *)&address_length);
+        if (client_socket < 0) {
             continue;
         }
 
         printf("CLIENT CONNECTED\n");
-        pthread_t thread;
-        if (pthread_create(&thread, NULL, client_thread, client_socket) != 0) {
-            perror("Failed to create thread");
-            close(*client_socket);
-            free(client_socket);
-        }
-        pthread_detach(thread);  // Auto-cleanup for the thread
+        dispatch_client(client_socket);
     }
 }
 
@@ -141,6 +198,13 @@ void server_shutdown() {
     //     free(repl_state);
     // }
 
+    if (server_config.unixsocket) {
+        unlink(server_config.unixsocket);
+    }
+    if (server_config.shmsocket) {
+        unlink(server_config.shmsocket);
+    }
+
     sleep(1);
     cleanup_commands();
     printf("Server shut down. Resources cleaned up.\n");
@@ -158,6 +222,7 @@ void *background_cleanup(void *arg) {
         sleep(10);
         cleanup_expired_keys();
         check_memory_and_evict();
+        rehash_keyspace();
     }
     return NULL;
 }
@@ -212,6 +277,11 @@ void start_background_cleanup() {
 int main(int argc, char *argv[]) {
     printf("Starting server...\n");
 
+    init_server_config(&server_config);
+    if (parse_server_args(&server_config, argc, argv) != 0) {
+        return EXIT_FAILURE;
+    }
+    set_proto_max_bulk_len(server_config.proto_max_bulk_len);
 
     struct sigaction sa;
     sa.sa_handler = handle_shutdown;
@@ -219,6 +289,9 @@ int main(int argc, char *argv[]) {
     sigemptyset(&sa.sa_mask);
     sigaction(SIGINT, &sa, NULL);
 
+    // Writes to a client that already hung up must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
 
     if (initialize_sdb() != 0) {
         fprintf(stderr, "Failed to initialize SDB file. Exiting.\n");
@@ -231,7 +304,40 @@ int main(int argc, char *argv[]) {
 
     register_commands();
 
-    start_background_cleanup();
+    if (init_connections() != 0) {
+        return EXIT_FAILURE;
+    }
+
+    // Each event loop owns one partition of the keyspace and nothing else
+    // touches it, so locking is off and the loops expire their own keys
+    if (server_config.partitioned) {
+        if (init_keyspace_partitions(server_config.event_loops) != 0 ||
+            init_partitions(server_config.event_loops) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    int partitioned = keyspace_partition_count() > 1;
+    if (partitioned) {
+        set_keyspace_locking(0);
+    }
+
+    // With --io threaded the main thread expires keys itself
+    if (server_config.io_mode != IO_MODE_THREADED && !partitioned) {
+        start_background_cleanup();
+    }
+
+    void (*launcher)(struct Server *server) = launch;
+    if (server_config.io_mode == IO_MODE_EPOLL) {
+        if (start_event_loops(server_config.event_loops) != 0) {
+            fprintf(stderr, "Failed to start event loops. Exiting.\n");
+            return EXIT_FAILURE;
+        }
+        launcher = launch_event_loop;
+    } else if (server_config.io_mode == IO_MODE_URING) {
+        launcher = launch_uring;
+    } else if (server_config.io_mode == IO_MODE_THREADED) {
+        launcher = launch_io_threads;
+    }
 
     // pthread_t heartbeat_thread;
     // if (pthread_create(&heartbeat_thread, NULL, replication_heartbeat, NULL) != 0) {
@@ -246,10 +352,28 @@ int main(int argc, char *argv[]) {
         SOCK_STREAM, 
         0, 
         INADDR_ANY, 
-        6379,  
-        10, 
-        launch
+        server_config.port,  
+        server_config.backlog, 
+        server_config.reuseport || server_config.io_mode == IO_MODE_URING,
+        launcher
     );
+
+    if (server_config.unixsocket) {
+        server.unix_socket = unix_listener_create(server_config.unixsocket, server_config.unixsocketperm,
+                                                  server_config.backlog);
+        if (server.unix_socket < 0) {
+            return EXIT_FAILURE;
+        }
+        printf("Accepting connections at %s\n", server_config.unixsocket);
+    }
+
+    if (server_config.shmsocket) {
+        if (start_shm_transport(server_config.shmsocket, server_config.unixsocketperm,
+                                server_config.backlog) != 0) {
+            return EXIT_FAILURE;
+        }
+        printf("Accepting shared memory clients at %s\n", server_config.shmsocket);
+    }
     
     // if (repl_config.role == ROLE_SLAVE) {
     //     if (connect_to_master() != 0) {
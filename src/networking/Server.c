@@ -1,8 +1,12 @@
 #include "Server.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
-struct Server server_constructor(int domain, int service, int protocol, u_long interface, int port, int backlog, void (*launch)(struct Server *server))
+struct Server server_constructor(int domain, int service, int protocol, u_long interface, int port, int backlog, int reuseport, void (*launch)(struct Server *server))
 {
     struct Server server;
 
@@ -12,18 +16,31 @@ struct Server server_constructor(int domain, int service, int protocol, u_long i
     server.interface = interface;
     server.port = port;
     server.backlog = backlog;
+    server.reuseport = reuseport;
+    server.unix_socket = -1;
 
     server.address.sin_family = domain;
     server.address.sin_port = htons(port);
     server.address.sin_addr.s_addr = htonl(interface);
 
     server.socket = socket(domain, service, protocol);
-    if (server.socket ==0)
+    if (server.socket < 0)
     {
         perror("Failed to connect socket...\n");
         exit(1);
     }
 
+    int enable = 1;
+    setsockopt(server.socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    // With SO_REUSEPORT several listeners share the port and the kernel
+    // spreads incoming connections across them
+    if (reuseport && setsockopt(server.socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0)
+    {
+        perror("Failed to enable SO_REUSEPORT...\n");
+        exit(1);
+    }
+
     if((bind(server.socket, (struct sockaddr *)&server.address, sizeof(server.address))) <0)
     {
         perror("Failed to bind socket...\n");
@@ -40,3 +57,50 @@ struct Server server_constructor(int domain, int service, int protocol, u_long i
     return server;
 
 }
+
+// Listen on a Unix domain socket for clients on the same host. A stale
+// socket file left by a previous run is replaced. permissions of 0 keep
+// the mode given by the umask. Returns the listening socket or -1.
+int unix_listener_create(const char *path, int permissions, int backlog)
+{
+    struct sockaddr_un address;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Error: Unix socket path '%s' is too long.\n", path);
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    int listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_socket < 0)
+    {
+        perror("Failed to create unix socket");
+        return -1;
+    }
+
+    unlink(path);
+    if (bind(listen_socket, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        perror("Failed to bind unix socket");
+        close(listen_socket);
+        return -1;
+    }
+
+    if (permissions && chmod(path, permissions) < 0)
+    {
+        perror("Failed to set unix socket permissions");
+        close(listen_socket);
+        return -1;
+    }
+
+    if (listen(listen_socket, backlog) < 0)
+    {
+        perror("Failed to listen on unix socket");
+        close(listen_socket);
+        return -1;
+    }
+
+    return listen_socket;
+}
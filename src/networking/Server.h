@@ -13,13 +13,16 @@ struct Server
         u_long interface;
         int port;
         int backlog;
+        int reuseport;
         struct sockaddr_in address;
 
         int socket;
+        int unix_socket;     // Optional AF_UNIX listener, -1 if not configured
 
         void (*launch)(struct Server *server);
 };
 
-struct Server server_constructor(int domain, int service, int protocol, u_long interface, int port, int backlog, void (*launch)(struct Server *server));
+struct Server server_constructor(int domain, int service, int protocol, u_long interface, int port, int backlog, int reuseport, void (*launch)(struct Server *server));
+int unix_listener_create(const char *path, int permissions, int backlog);
 
 #endif /* Server.h */
\ No newline at end of file
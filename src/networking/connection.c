@@ -0,0 +1,497 @@
+#include "connection.h"
+#include "../core/commands.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+// Connections indexed by socket. Sized once from RLIMIT_NOFILE so lookups
+// never race with a resize; each slot is only touched by the owning thread.
+static Connection **connection_table = NULL;
+static int connection_table_size = 0;
+
+// Connections that queued replies since this thread last flushed
+static __thread Connection **pending_flush = NULL;
+static __thread int pending_flush_count = 0;
+static __thread int pending_flush_capacity = 0;
+
+static uint64_t next_connection_id = 1;
+
+// Runs commands for this thread's transport, NULL to execute them in place
+static __thread CommandDispatcher command_dispatcher = NULL;
+
+void set_command_dispatcher(CommandDispatcher dispatcher) {
+    command_dispatcher = dispatcher;
+}
+
+int init_connections(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) {
+        limit.rlim_cur = 65536;
+    }
+
+    connection_table_size = (int)limit.rlim_cur;
+    connection_table = calloc(connection_table_size, sizeof(Connection *));
+    if (!connection_table) {
+        fprintf(stderr, "Error: Failed to allocate connection table.\n");
+        return -1;
+    }
+    return 0;
+}
+
+Connection *connection_create(int fd) {
+    if (fd < 0 || fd >= connection_table_size) {
+        fprintf(stderr, "Error: Socket %d exceeds the connection table.\n", fd);
+        return NULL;
+    }
+
+    Connection *conn = calloc(1, sizeof(Connection));
+    if (!conn) {
+        return NULL;
+    }
+    conn->fd = fd;
+    conn->id = __atomic_fetch_add(&next_connection_id, 1, __ATOMIC_RELAXED);
+    conn->client_class = CLIENT_CLASS_NORMAL;
+    conn->protocol = RESP_PROTOCOL_2;
+    init_resp_parser(&conn->parser);
+    connection_table[fd] = conn;
+    return conn;
+}
+
+Connection *connection_lookup(int fd) {
+    if (fd < 0 || fd >= connection_table_size) {
+        return NULL;
+    }
+    return connection_table[fd];
+}
+
+// Switch the limits the connection is held to, e.g. once it becomes a replica
+void connection_set_class(Connection *conn, ClientClass client_class) {
+    conn->client_class = client_class;
+    conn->obuf_soft_limit_since = 0;
+}
+
+// Release the connection state. The caller closes the socket.
+void connection_free(Connection *conn) {
+    if (!conn) {
+        return;
+    }
+    if (connection_table[conn->fd] == conn) {
+        connection_table[conn->fd] = NULL;
+    }
+    if (conn->flush_pending) {
+        for (int i = 0; i < pending_flush_count; i++) {
+            if (pending_flush[i] == conn) {
+                pending_flush[i] = pending_flush[--pending_flush_count];
+                break;
+            }
+        }
+    }
+    while (conn->reply_head) {
+        ReplyBlock *next = conn->reply_head->next;
+        free(conn->reply_head);
+        conn->reply_head = next;
+    }
+    free(conn->commands);
+    free_resp_parser(&conn->parser);
+    free(conn->querybuf);
+    free(conn);
+}
+
+// Move the partial frame to the front of the input buffer
+static void connection_compact_input(Connection *conn) {
+    if (conn->qb_pos > 0) {
+        memmove(conn->querybuf, conn->querybuf + conn->qb_pos, conn->qb_len - conn->qb_pos);
+        conn->qb_len -= conn->qb_pos;
+        conn->qb_pos = 0;
+    }
+}
+
+// Make room for the rest of a large bulk string whose length the parser
+// has read. The buffer grows once to fit the frame, plus the usual read
+// chunk for whatever follows it, so the payload is read into place instead
+// of being copied by every doubling on the way. Returns 1 if there is room,
+// 0 if the frame is not large, -1 if it cannot be buffered.
+static int connection_reserve_frame(Connection *conn) {
+    size_t frame = resp_frame_needed(&conn->parser);
+    if (frame < CONNECTION_BIG_ARG || conn->qb_len - conn->qb_pos >= frame) {
+        return 0;
+    }
+    size_t needed = frame + CONNECTION_READ_CHUNK;
+    if (needed > CONNECTION_MAX_QUERYBUF) {
+        return -1;
+    }
+    if (conn->qb_pos + needed > conn->qb_cap) {
+        connection_compact_input(conn);
+        if (needed > conn->qb_cap) {
+            char *querybuf = realloc(conn->querybuf, needed);
+            if (!querybuf) {
+                return -1;
+            }
+            conn->querybuf = querybuf;
+            conn->qb_cap = needed;
+        }
+    }
+    return 1;
+}
+
+// Make room for at least CONNECTION_READ_CHUNK bytes of input (or the rest
+// of a large bulk string) and return where it should be written. Returns
+// NULL if the buffer limit is reached.
+char *connection_input_space(Connection *conn, size_t *available) {
+    int reserved = connection_reserve_frame(conn);
+    if (reserved < 0) {
+        return NULL;
+    }
+    if (!reserved && conn->qb_cap - conn->qb_len < CONNECTION_READ_CHUNK) {
+        // Move the partial frame to the front before growing
+        connection_compact_input(conn);
+        if (conn->qb_cap - conn->qb_len < CONNECTION_READ_CHUNK) {
+            size_t cap = conn->qb_cap ? conn->qb_cap * 2 : CONNECTION_READ_CHUNK;
+            while (cap - conn->qb_len < CONNECTION_READ_CHUNK) {
+                cap *= 2;
+            }
+            if (cap > CONNECTION_MAX_QUERYBUF) {
+                return NULL;
+            }
+            char *querybuf = realloc(conn->querybuf, cap);
+            if (!querybuf) {
+                return NULL;
+            }
+            conn->querybuf = querybuf;
+            conn->qb_cap = cap;
+        }
+    }
+
+    *available = conn->qb_cap - conn->qb_len;
+    return conn->querybuf + conn->qb_len;
+}
+
+// Read whatever the socket has into the input buffer. Returns read()'s result.
+ssize_t connection_read(Connection *conn) {
+    size_t available;
+    char *space = connection_input_space(conn, &available);
+    if (!space) {
+        fprintf(stderr, "Client %d exceeded the query buffer limit.\n", conn->fd);
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    ssize_t bytes_read = read(conn->fd, space, available);
+    if (bytes_read > 0) {
+        conn->qb_len += bytes_read;
+    }
+    return bytes_read;
+}
+
+// Forget input that has been executed; release a large buffer once idle
+static void connection_input_consumed(Connection *conn) {
+    if (conn->qb_pos == conn->qb_len) {
+        conn->qb_pos = 0;
+        conn->qb_len = 0;
+        conn->commands_end = 0;
+        if (conn->qb_cap > CONNECTION_IDLE_QUERYBUF) {
+            free(conn->querybuf);
+            conn->querybuf = NULL;
+            conn->qb_cap = 0;
+        }
+    }
+}
+
+// Encoding of the client's replies: what HELLO chose, unless the client
+// opened with a binary frame
+static int connection_reply_protocol(const Connection *conn) {
+    return conn->parser.binary > 0 ? RESP_PROTOCOL_BINARY : conn->protocol;
+}
+
+// Execute every complete command in the input buffer. A trailing partial
+// frame stays buffered. Returns -1 if the client sent malformed input and
+// should be disconnected.
+int connection_process_input(Connection *conn) {
+    while (conn->qb_pos < conn->qb_len && !conn->blocked) {
+        if (conn->close_asap) {
+            return -1;
+        }
+
+        RedisCommand cmd;
+        long consumed = parse_redis_command(&conn->parser, conn->querybuf + conn->qb_pos,
+                                            conn->qb_len - conn->qb_pos, &cmd);
+        if (consumed < 0) {
+            set_reply_protocol(connection_reply_protocol(conn));
+            send_redis_error(conn->fd, "protocol error");
+            return -1;
+        }
+        if (consumed == 0) {
+            break;
+        }
+
+        conn->qb_pos += consumed;
+        if (cmd.argc > 0) {
+            set_reply_protocol(connection_reply_protocol(conn));
+            if (!command_dispatcher || !command_dispatcher(conn, &cmd)) {
+                execute_command(conn->fd, &cmd);
+            }
+            conn->protocol = get_reply_protocol();
+        }
+        reset_resp_arena(&conn->parser);
+    }
+    if (conn->close_asap) {
+        return -1;
+    }
+
+    connection_input_consumed(conn);
+    return 0;
+}
+
+// First half of connection_process_input() for --io threaded: parse every
+// complete command without running it. The commands point into the input
+// buffer and the parser's arena, which must not be touched until
+// connection_execute_parsed().
+// Safe to call off the thread that executes commands. Returns the number
+// of commands parsed.
+int connection_parse_input(Connection *conn) {
+    size_t pos = conn->qb_pos;
+    conn->command_count = 0;
+    conn->parse_error = 0;
+
+    while (pos < conn->qb_len) {
+        RedisCommand cmd;
+        long consumed = parse_redis_command(&conn->parser, conn->querybuf + pos, conn->qb_len - pos, &cmd);
+        if (consumed < 0) {
+            conn->parse_error = 1;
+            break;
+        }
+        if (consumed == 0) {
+            break;
+        }
+        pos += consumed;
+        if (cmd.argc == 0) {
+            continue;
+        }
+
+        if (conn->command_count == conn->command_capacity) {
+            int capacity = conn->command_capacity ? conn->command_capacity * 2 : 16;
+            RedisCommand *commands = realloc(conn->commands, capacity * sizeof(RedisCommand));
+            if (!commands) {
+                conn->parse_error = 1;
+                break;
+            }
+            conn->commands = commands;
+            conn->command_capacity = capacity;
+        }
+        conn->commands[conn->command_count++] = cmd;
+    }
+
+    conn->commands_end = pos;
+    return conn->command_count;
+}
+
+// Second half: run the commands parsed by connection_parse_input(). Returns
+// -1 if the client should be disconnected.
+int connection_execute_parsed(Connection *conn) {
+    for (int i = 0; i < conn->command_count; i++) {
+        if (!conn->close_asap) {
+            set_reply_protocol(connection_reply_protocol(conn));
+            execute_command(conn->fd, &conn->commands[i]);
+            conn->protocol = get_reply_protocol();
+        }
+    }
+    reset_resp_arena(&conn->parser);
+    conn->command_count = 0;
+    conn->qb_pos = conn->commands_end;
+
+    if (conn->close_asap) {
+        return -1;
+    }
+    if (conn->parse_error) {
+        set_reply_protocol(connection_reply_protocol(conn));
+        send_redis_error(conn->fd, "protocol error");
+        return -1;
+    }
+    connection_input_consumed(conn);
+    return 0;
+}
+
+// Check whether queueing len more bytes keeps the client within the output
+// buffer limits of its class. Returns 0 if it does, -1 if it must go.
+static int check_output_limits(Connection *conn, size_t len) {
+    const ClientBufferLimit *limit = &server_config.client_obuf_limits[conn->client_class];
+    unsigned long long used = conn->reply_bytes + len;
+
+    if (limit->hard_limit && used >= limit->hard_limit) {
+        return -1;
+    }
+    if (limit->soft_limit && used >= limit->soft_limit) {
+        time_t now = time(NULL);
+        if (conn->obuf_soft_limit_since == 0) {
+            conn->obuf_soft_limit_since = now;
+        } else if (now - conn->obuf_soft_limit_since > limit->soft_seconds) {
+            return -1;
+        }
+    } else {
+        conn->obuf_soft_limit_since = 0;
+    }
+    return 0;
+}
+
+// Flag a client that went over its output buffer limit. Its transport
+// closes it without sending the rest of its output.
+void connection_mark_over_limit(Connection *conn) {
+    fprintf(stderr, "Client %d closed for exceeding its output buffer limit (%zu bytes pending).\n",
+            conn->fd, conn->reply_bytes);
+    conn->close_asap = 1;
+}
+
+// Called when a write left output pending: a client that keeps the buffer
+// above the soft limit by reading slowly is dropped too. Returns 1 if the
+// connection was flagged.
+int connection_output_over_limit(Connection *conn) {
+    if (!conn->close_asap && conn->reply_bytes > 0 && check_output_limits(conn, 0) != 0) {
+        connection_mark_over_limit(conn);
+    }
+    return conn->close_asap;
+}
+
+// ReplyWriter used by the transports: append to the client's output buffer
+// and remember the client so the transport flushes it once per iteration.
+// A client over its output buffer limit gets no more replies and is closed
+// by its transport.
+void connection_queue_reply(int socket, const char *data, size_t len) {
+    Connection *conn = connection_lookup(socket);
+    if (!conn || conn->close_asap) {
+        return;
+    }
+    if (check_output_limits(conn, len) != 0) {
+        connection_mark_over_limit(conn);
+        return;
+    }
+
+    ReplyBlock *tail = conn->reply_tail;
+    size_t space = tail ? tail->size - tail->used : 0;
+    if (space > 0) {
+        size_t chunk = len < space ? len : space;
+        memcpy(tail->data + tail->used, data, chunk);
+        tail->used += chunk;
+        data += chunk;
+        len -= chunk;
+        conn->reply_bytes += chunk;
+    }
+
+    if (len > 0) {
+        size_t size = len > REPLY_BLOCK_SIZE ? len : REPLY_BLOCK_SIZE;
+        ReplyBlock *block = malloc(sizeof(ReplyBlock) + size);
+        if (!block) {
+            // Going on would leave the client's replies out of step with its requests
+            fprintf(stderr, "Error: Failed to allocate reply buffer for client %d.\n", socket);
+            conn->close_asap = 1;
+            return;
+        }
+        block->next = NULL;
+        block->size = size;
+        block->used = len;
+        memcpy(block->data, data, len);
+        if (tail) {
+            tail->next = block;
+        } else {
+            conn->reply_head = block;
+        }
+        conn->reply_tail = block;
+        conn->reply_bytes += len;
+    }
+
+    if (!conn->flush_pending) {
+        if (pending_flush_count == pending_flush_capacity) {
+            int capacity = pending_flush_capacity ? pending_flush_capacity * 2 : 64;
+            Connection **list = realloc(pending_flush, capacity * sizeof(Connection *));
+            if (!list) {
+                return;
+            }
+            pending_flush = list;
+            pending_flush_capacity = capacity;
+        }
+        pending_flush[pending_flush_count++] = conn;
+        conn->flush_pending = 1;
+    }
+}
+
+// Next connection with replies queued on this thread, NULL when done
+Connection *connection_pop_pending(void) {
+    if (pending_flush_count == 0) {
+        return NULL;
+    }
+    Connection *conn = pending_flush[--pending_flush_count];
+    conn->flush_pending = 0;
+    return conn;
+}
+
+// Describe the unsent output as up to max iovecs. Returns the count.
+int connection_reply_iov(Connection *conn, struct iovec *iov, int max) {
+    int count = 0;
+    size_t offset = conn->reply_sent;
+    for (ReplyBlock *block = conn->reply_head; block && count < max; block = block->next) {
+        if (block->used > offset) {
+            iov[count].iov_base = block->data + offset;
+            iov[count].iov_len = block->used - offset;
+            count++;
+        }
+        offset = 0;
+    }
+    return count;
+}
+
+// Drop written bytes from the front of the output buffer
+void connection_reply_written(Connection *conn, size_t written) {
+    conn->reply_bytes -= written;
+    while (conn->reply_head && written > 0) {
+        ReplyBlock *head = conn->reply_head;
+        size_t remaining = head->used - conn->reply_sent;
+        if (written < remaining) {
+            conn->reply_sent += written;
+            return;
+        }
+        written -= remaining;
+        conn->reply_sent = 0;
+        if (!head->next && head->size == REPLY_BLOCK_SIZE) {
+            head->used = 0;  // Keep the last block for the next replies
+        } else {
+            // Blocks sized for one large reply are not kept around
+            conn->reply_head = head->next;
+            if (!conn->reply_head) {
+                conn->reply_tail = NULL;
+            }
+            free(head);
+        }
+    }
+}
+
+// Write queued replies with writev(). Returns 1 when everything was
+// written, 0 if the socket would block and -1 on error or when the client
+// went over its output buffer limit.
+int connection_flush(Connection *conn) {
+    struct iovec iov[CONNECTION_FLUSH_IOV];
+
+    if (conn->close_asap) {
+        return -1;
+    }
+
+    while (conn->reply_bytes > 0) {
+        int count = connection_reply_iov(conn, iov, CONNECTION_FLUSH_IOV);
+        ssize_t written = writev(conn->fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return -1;
+            }
+            return connection_output_over_limit(conn) ? -1 : 0;
+        }
+        connection_reply_written(conn, written);
+        if (conn->reply_bytes > 0 && connection_output_over_limit(conn)) {
+            return -1;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,82 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <time.h>
+#include "../core/protocol.h"
+#include "../core/config.h"
+
+#define CONNECTION_READ_CHUNK 16384                      // Minimum free space per read
+#define CONNECTION_IDLE_QUERYBUF (64 * 1024)             // Larger idle buffers are released
+#define CONNECTION_MAX_QUERYBUF (1024UL * 1024 * 1024)   // Hard cap on buffered input
+#define CONNECTION_BIG_ARG (32 * 1024)                   // Bulk strings read straight into a buffer sized for them
+#define REPLY_BLOCK_SIZE 16384                           // Output is queued in blocks of this size
+#define CONNECTION_FLUSH_IOV 64                          // Reply blocks per writev()
+#define CONNECTION_SEND_TIMEOUT 1                        // Seconds a blocking flush waits between limit checks
+
+// A chunk of queued output. Blocks are never reallocated, so a transport
+// can hand them to the kernel while more replies are appended.
+typedef struct ReplyBlock {
+    struct ReplyBlock *next;
+    size_t size;
+    size_t used;
+    char data[];
+} ReplyBlock;
+
+// Per-client state shared by all transports
+typedef struct Connection {
+    int fd;
+    uint64_t id;         // Unique for the life of the server, unlike fd
+    char *querybuf;      // Buffered input, parsed in place
+    size_t qb_len;       // Bytes buffered
+    size_t qb_pos;       // Start of the first frame not yet executed
+    size_t qb_cap;
+    RespParser parser;
+    int protocol;        // RESP version of the replies, chosen with HELLO; binary clients get binary ones
+    ReplyBlock *reply_head;   // Queued replies, oldest first
+    ReplyBlock *reply_tail;
+    size_t reply_sent;        // Bytes of reply_head already written
+    size_t reply_bytes;       // Total bytes queued and not yet written
+    int flush_pending;        // Listed for this thread's next flush
+    int write_registered;     // Transport is waiting for the socket to drain
+    ClientClass client_class; // Selects the output buffer limits
+    time_t obuf_soft_limit_since;  // When the soft limit was first exceeded, 0 if below
+    int close_asap;           // Went over an output buffer limit; drop without flushing
+    RedisCommand *commands;   // Parsed ahead of execution (--io threaded)
+    int command_count;
+    int command_capacity;
+    size_t commands_end;      // Input offset just past the last parsed command
+    int parse_error;          // Input after the parsed commands is malformed
+    int blocked;              // Waiting for a command run elsewhere; input is held back
+} Connection;
+
+// Lets a transport run commands somewhere else. Returns 0 to execute the
+// command in place, 1 if the dispatcher answered or took it over. When the
+// reply comes later the dispatcher sets conn->blocked, and clears it before
+// calling connection_process_input() again.
+typedef int (*CommandDispatcher)(Connection *conn, RedisCommand *cmd);
+
+int init_connections(void);
+Connection *connection_create(int fd);
+Connection *connection_lookup(int fd);
+void connection_set_class(Connection *conn, ClientClass client_class);
+void connection_free(Connection *conn);
+
+char *connection_input_space(Connection *conn, size_t *available);
+ssize_t connection_read(Connection *conn);
+int connection_process_input(Connection *conn);
+void set_command_dispatcher(CommandDispatcher dispatcher);
+int connection_parse_input(Connection *conn);
+int connection_execute_parsed(Connection *conn);
+
+void connection_queue_reply(int socket, const char *data, size_t len);
+Connection *connection_pop_pending(void);
+int connection_reply_iov(Connection *conn, struct iovec *iov, int max);
+void connection_reply_written(Connection *conn, size_t written);
+void connection_mark_over_limit(Connection *conn);
+int connection_output_over_limit(Connection *conn);
+int connection_flush(Connection *conn);
+
+#endif // CONNECTION_H
@@ -0,0 +1,325 @@
+#define _GNU_SOURCE
+#include "event_loop.h"
+#include "connection.h"
+#include "partition.h"
+#include "../core/protocol.h"
+#include "../core/commands.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+
+static EventLoop *event_loops = NULL;
+static int event_loop_count = 0;
+static unsigned int next_event_loop = 0;
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void register_client(EventLoop *loop, int client_socket) {
+    if (!connection_create(client_socket)) {
+        fprintf(stderr, "Error: Failed to allocate client connection.\n");
+        close(client_socket);
+        return;
+    }
+
+    int nodelay = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = client_socket;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, client_socket, &event) < 0) {
+        perror("Failed to register client socket");
+        connection_free(connection_lookup(client_socket));
+        close(client_socket);
+    }
+}
+
+static void close_client(EventLoop *loop, int client_socket) {
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, client_socket, NULL);
+    connection_free(connection_lookup(client_socket));
+    close(client_socket);
+}
+
+// Read what the client sent and run every complete command in it. Replies
+// are queued on the connection and written after the whole batch of events.
+static void handle_readable(EventLoop *loop, int client_socket) {
+    Connection *conn = connection_lookup(client_socket);
+    ssize_t bytes_read = connection_read(conn);
+
+    if (bytes_read < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return;
+        }
+        close_client(loop, client_socket);
+        return;
+    }
+    if (bytes_read == 0) {
+        close_client(loop, client_socket);
+        return;
+    }
+    if (connection_process_input(conn) != 0) {
+        connection_flush(conn);  // Best effort delivery of the protocol error
+        close_client(loop, client_socket);
+    }
+}
+
+// A command that waited on other partitions has been answered
+static void resume_client(Connection *conn, void *arg) {
+    EventLoop *loop = (EventLoop *)arg;
+    if (connection_process_input(conn) != 0) {
+        connection_flush(conn);
+        close_client(loop, conn->fd);
+    }
+}
+
+// With a partitioned keyspace each loop expires and evicts its own keys
+static void run_partition_cron(time_t *last_cron) {
+    time_t now = time(NULL);
+    if (now - *last_cron >= EVENT_LOOP_CRON_INTERVAL) {
+        cleanup_expired_keys();
+        check_memory_and_evict();
+        rehash_keyspace();
+        *last_cron = now;
+    }
+}
+
+static void set_write_interest(EventLoop *loop, Connection *conn, int enable) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = enable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    event.data.fd = conn->fd;
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->write_registered = enable;
+}
+
+// Write a client's queued replies; wait for EPOLLOUT if the socket is full
+static void flush_client(EventLoop *loop, Connection *conn) {
+    int ret = connection_flush(conn);
+    if (ret < 0) {
+        close_client(loop, conn->fd);
+    } else if (ret == 0 && !conn->write_registered) {
+        set_write_interest(loop, conn, 1);
+    } else if (ret == 1 && conn->write_registered) {
+        set_write_interest(loop, conn, 0);
+    }
+}
+
+// Drain one of the loop's listeners; the accepted sockets stay on this loop
+static void accept_clients(EventLoop *loop, int listen_socket) {
+    for (int i = 0; i < EVENT_LOOP_MAX_ACCEPTS; i++) {
+        int client_socket = accept4(listen_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Accept failed");
+            }
+            return;
+        }
+        register_client(loop, client_socket);
+    }
+}
+
+static void *event_loop_thread(void *arg) {
+    EventLoop *loop = (EventLoop *)arg;
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+    int timeout = -1;
+    time_t last_cron = time(NULL);
+
+    set_reply_writer(connection_queue_reply);
+    if (loop->inbox_fd >= 0) {
+        partition_thread_init(loop->id, resume_client, loop);
+        timeout = 1000;
+    }
+
+    while (1) {
+        int ready = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            int client_socket = events[i].data.fd;
+            if (client_socket == loop->listen_socket || client_socket == loop->unix_socket) {
+                accept_clients(loop, client_socket);
+            } else if (client_socket == loop->inbox_fd) {
+                partition_process_inbox();
+            } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                close_client(loop, client_socket);
+            } else {
+                if (events[i].events & EPOLLOUT) {
+                    flush_client(loop, connection_lookup(client_socket));
+                }
+                if ((events[i].events & EPOLLIN) && connection_lookup(client_socket)) {
+                    handle_readable(loop, client_socket);
+                }
+            }
+        }
+
+        // One write per client per iteration, however many commands it sent
+        Connection *conn;
+        while ((conn = connection_pop_pending())) {
+            if (!conn->write_registered) {
+                flush_client(loop, conn);
+            }
+        }
+
+        if (loop->inbox_fd >= 0) {
+            run_partition_cron(&last_cron);
+        }
+    }
+    return NULL;
+}
+
+// Create count event loop threads. Returns 0 on success, -1 on error.
+int start_event_loops(int count) {
+    event_loops = calloc(count, sizeof(EventLoop));
+    if (!event_loops) {
+        fprintf(stderr, "Error: Failed to allocate event loops.\n");
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        EventLoop *loop = &event_loops[i];
+        loop->id = i;
+        loop->listen_socket = -1;
+        loop->unix_socket = -1;
+        loop->inbox_fd = partition_inbox_fd(i);
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epoll_fd < 0) {
+            perror("epoll_create1 failed");
+            return -1;
+        }
+        if (loop->inbox_fd >= 0) {
+            struct epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.fd = loop->inbox_fd;
+            if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->inbox_fd, &event) < 0) {
+                perror("Failed to register partition inbox");
+                return -1;
+            }
+        }
+        if (pthread_create(&loop->thread, NULL, event_loop_thread, loop) != 0) {
+            perror("Failed to create event loop thread");
+            return -1;
+        }
+        pthread_detach(loop->thread);
+    }
+
+    event_loop_count = count;
+    return 0;
+}
+
+// Hand an accepted socket to the next event loop (round-robin)
+void event_loop_add_client(int client_socket) {
+    EventLoop *loop = &event_loops[next_event_loop++ % event_loop_count];
+
+    if (set_nonblocking(client_socket) < 0) {
+        perror("Failed to set client socket non-blocking");
+        close(client_socket);
+        return;
+    }
+    register_client(loop, client_socket);
+}
+
+// Every loop watches the Unix socket listener; EPOLLEXCLUSIVE wakes only
+// one of them per incoming connection.
+static void listen_unix_socket(int unix_socket) {
+    if (set_nonblocking(unix_socket) < 0) {
+        perror("Failed to set unix listener non-blocking");
+        exit(1);
+    }
+
+    for (int i = 0; i < event_loop_count; i++) {
+        EventLoop *loop = &event_loops[i];
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        event.data.fd = unix_socket;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, unix_socket, &event) < 0) {
+            perror("Failed to register unix listener");
+            exit(1);
+        }
+        loop->unix_socket = unix_socket;
+    }
+}
+
+// Give every event loop its own listener bound to the same port. The first
+// loop reuses the socket the server was constructed with.
+static void launch_reuseport_listeners(struct Server *server) {
+    for (int i = 0; i < event_loop_count; i++) {
+        EventLoop *loop = &event_loops[i];
+        int listen_socket = server->socket;
+
+        if (i > 0) {
+            struct Server listener = server_constructor(server->domain, server->service, server->protocol,
+                                                        server->interface, server->port, server->backlog,
+                                                        1, server->launch);
+            listen_socket = listener.socket;
+        }
+
+        if (set_nonblocking(listen_socket) < 0) {
+            perror("Failed to set listener non-blocking");
+            exit(1);
+        }
+
+        loop->listen_socket = listen_socket;
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = listen_socket;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, listen_socket, &event) < 0) {
+            perror("Failed to register listener");
+            exit(1);
+        }
+    }
+
+    printf("====WAITING FOR CONNECTIONS (%d SO_REUSEPORT event loops)=====\n", event_loop_count);
+    while (1) {
+        pause();
+    }
+}
+
+// Accept loop for epoll mode: the listening thread only accepts and
+// distributes sockets, all request handling happens on the event loops.
+void launch_event_loop(struct Server *server) {
+    if (server->unix_socket >= 0) {
+        listen_unix_socket(server->unix_socket);
+    }
+    if (server->reuseport) {
+        launch_reuseport_listeners(server);
+        return;
+    }
+
+    printf("====WAITING FOR CONNECTIONS (%d event loops)=====\n", event_loop_count);
+
+    while (1) {
+        int client_socket = accept(server->socket, NULL, NULL);
+        if (client_socket < 0) {
+            if (errno == EMFILE || errno == ENFILE) {
+                usleep(10000);  // Out of descriptors, back off instead of spinning
+            } else if (errno != EINTR) {
+                perror("Accept failed");
+            }
+            continue;
+        }
+        event_loop_add_client(client_socket);
+    }
+}
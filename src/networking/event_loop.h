@@ -0,0 +1,25 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <pthread.h>
+#include "Server.h"
+
+#define EVENT_LOOP_MAX_EVENTS 256
+#define EVENT_LOOP_MAX_ACCEPTS 1000  // Accepts per listener wakeup
+#define EVENT_LOOP_CRON_INTERVAL 10  // Seconds between expiry/eviction/rehash runs of a partition
+
+// A single epoll reactor thread serving a subset of the client connections
+typedef struct EventLoop {
+    int id;
+    int epoll_fd;
+    int listen_socket;   // Own SO_REUSEPORT listener, -1 if fed by the acceptor
+    int unix_socket;     // Shared AF_UNIX listener, -1 if not configured
+    int inbox_fd;        // Messages for this loop's keyspace partition, -1 if not split
+    pthread_t thread;
+} EventLoop;
+
+int start_event_loops(int count);
+void event_loop_add_client(int client_socket);
+void launch_event_loop(struct Server *server);
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,383 @@
+#define _GNU_SOURCE
+#include "io_threads.h"
+#include "connection.h"
+#include "../core/protocol.h"
+#include "../core/commands.h"
+#include "../core/config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+
+#define IO_THREADS_MAX_EVENTS 1024
+#define IO_THREADS_MAX_ACCEPTS 1000
+#define IO_THREADS_JOIN_SPIN 1000
+
+typedef enum {
+    IO_OP_READ,     // Read and parse
+    IO_OP_WRITE     // Flush queued replies
+} IoOp;
+
+// Result of an I/O job, read back by the main thread
+enum {
+    IO_JOB_OK = 0,
+    IO_JOB_BLOCKED,   // Write could not finish, wait for EPOLLOUT
+    IO_JOB_CLOSE      // Hung up, read error or write error
+};
+
+typedef struct IoJob {
+    Connection *conn;
+    int status;
+} IoJob;
+
+// Each thread gets its own cache lines: the main thread publishes work by
+// setting pending and the thread clears it when done.
+typedef struct IoThread {
+    _Alignas(64) unsigned long pending;
+    int sleeping;
+    IoOp op;
+    IoJob *jobs;
+    int job_count;
+    sem_t wake;
+    pthread_t thread;
+} IoThread;
+
+static IoThread *io_threads = NULL;
+static int io_thread_count = 0;   // Helper threads, the main thread not included
+static int epoll_fd = -1;
+
+static IoJob *jobs = NULL;        // Ready clients for this round, in event order
+static int job_capacity = 0;
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void run_job(IoOp op, IoJob *job) {
+    Connection *conn = job->conn;
+    if (op == IO_OP_READ) {
+        ssize_t bytes_read = connection_read(conn);
+        // The main thread executes the job even if nothing gets parsed, and
+        // reading may have moved the input to the front of the buffer
+        conn->command_count = 0;
+        conn->commands_end = conn->qb_pos;
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            job->status = IO_JOB_OK;
+        } else if (bytes_read <= 0) {
+            job->status = IO_JOB_CLOSE;
+        } else {
+            connection_parse_input(conn);
+            job->status = IO_JOB_OK;
+        }
+    } else {
+        int ret = connection_flush(conn);
+        job->status = ret < 0 ? IO_JOB_CLOSE : ret == 0 ? IO_JOB_BLOCKED : IO_JOB_OK;
+    }
+}
+
+static void *io_thread_main(void *arg) {
+    IoThread *self = (IoThread *)arg;
+
+    while (1) {
+        int spins = 0;
+        while (__atomic_load_n(&self->pending, __ATOMIC_ACQUIRE) == 0) {
+            if (++spins < IO_THREADS_SPIN) {
+                if (spins % IO_THREADS_JOIN_SPIN == 0) {
+                    sched_yield();
+                }
+                continue;
+            }
+            // Announce the sleep, then look once more so a post is not missed
+            __atomic_store_n(&self->sleeping, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&self->pending, __ATOMIC_SEQ_CST) == 0) {
+                sem_wait(&self->wake);
+            }
+            __atomic_store_n(&self->sleeping, 0, __ATOMIC_RELAXED);
+            spins = 0;
+        }
+
+        for (int i = 0; i < self->job_count; i++) {
+            run_job(self->op, &self->jobs[i]);
+        }
+        __atomic_store_n(&self->pending, 0, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// Spread count jobs over the helpers and the main thread, run them and wait
+// for all of them. Small rounds are not worth the hand-off.
+static void run_jobs(IoOp op, IoJob *round, int count) {
+    int helpers = io_thread_count;
+    if (count < (helpers + 1) * IO_THREADS_MIN_PER_THREAD) {
+        helpers = 0;
+    }
+
+    int share = count / (helpers + 1);
+    int extra = count % (helpers + 1);
+    int offset = 0;
+    for (int t = 0; t < helpers; t++) {
+        IoThread *thread = &io_threads[t];
+        int n = share + (t < extra);
+        thread->op = op;
+        thread->jobs = round + offset;
+        thread->job_count = n;
+        offset += n;
+        __atomic_store_n(&thread->pending, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&thread->sleeping, __ATOMIC_SEQ_CST)) {
+            sem_post(&thread->wake);
+        }
+    }
+
+    // The main thread takes the remainder
+    for (int i = offset; i < count; i++) {
+        run_job(op, &round[i]);
+    }
+
+    // Yield if a helper is slow to finish, it may be waiting for our CPU
+    for (int t = 0; t < helpers; t++) {
+        int spins = 0;
+        while (__atomic_load_n(&io_threads[t].pending, __ATOMIC_ACQUIRE) != 0) {
+            if (++spins > IO_THREADS_JOIN_SPIN) {
+                sched_yield();
+            }
+        }
+    }
+}
+
+static int reserve_jobs(int count) {
+    if (count <= job_capacity) {
+        return 0;
+    }
+    int capacity = job_capacity ? job_capacity : 256;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    IoJob *resized = realloc(jobs, capacity * sizeof(IoJob));
+    if (!resized) {
+        return -1;
+    }
+    jobs = resized;
+    job_capacity = capacity;
+    return 0;
+}
+
+static void register_client(int client_socket, int tcp) {
+    if (!connection_create(client_socket)) {
+        fprintf(stderr, "Error: Failed to allocate client connection.\n");
+        close(client_socket);
+        return;
+    }
+    if (tcp) {
+        int nodelay = 1;
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = client_socket;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &event) < 0) {
+        perror("Failed to register client socket");
+        connection_free(connection_lookup(client_socket));
+        close(client_socket);
+    }
+}
+
+static void close_client(Connection *conn) {
+    int fd = conn->fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    connection_free(conn);
+    close(fd);
+}
+
+static void accept_clients(int listen_socket, int tcp) {
+    for (int i = 0; i < IO_THREADS_MAX_ACCEPTS; i++) {
+        int client_socket = accept4(listen_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket < 0) {
+            if (errno == EMFILE || errno == ENFILE) {
+                usleep(10000);  // Out of descriptors, back off instead of spinning
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Accept failed");
+            }
+            return;
+        }
+        register_client(client_socket, tcp);
+    }
+}
+
+static void set_write_interest(Connection *conn, int enable) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = enable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    event.data.fd = conn->fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->write_registered = enable;
+}
+
+// Apply the outcome of a write job on the main thread
+static void finish_write(IoJob *job) {
+    Connection *conn = job->conn;
+    if (job->status == IO_JOB_CLOSE) {
+        close_client(conn);
+    } else if (job->status == IO_JOB_BLOCKED && !conn->write_registered) {
+        set_write_interest(conn, 1);
+    } else if (job->status == IO_JOB_OK && conn->write_registered) {
+        set_write_interest(conn, 0);
+    }
+}
+
+// Hand every client with queued replies to the I/O threads
+static void write_replies(void) {
+    int count = 0;
+    Connection *conn;
+    while ((conn = connection_pop_pending())) {
+        if (conn->write_registered) {
+            continue;  // Flushed when the socket drains
+        }
+        if (reserve_jobs(count + 1) != 0) {
+            close_client(conn);
+            continue;
+        }
+        jobs[count].conn = conn;
+        jobs[count].status = IO_JOB_OK;
+        count++;
+    }
+
+    run_jobs(IO_OP_WRITE, jobs, count);
+    for (int i = 0; i < count; i++) {
+        finish_write(&jobs[i]);
+    }
+}
+
+static void run_cron(time_t *last_cron) {
+    time_t now = time(NULL);
+    if (now - *last_cron >= IO_THREADS_CRON_INTERVAL) {
+        cleanup_expired_keys();
+        check_memory_and_evict();
+        rehash_keyspace();
+        *last_cron = now;
+    }
+}
+
+static void add_listener(int listen_socket) {
+    if (set_nonblocking(listen_socket) < 0) {
+        perror("Failed to set listener non-blocking");
+        exit(1);
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = listen_socket;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_socket, &event) < 0) {
+        perror("Failed to register listener");
+        exit(1);
+    }
+}
+
+static void start_io_threads(int count) {
+    if (count > IO_THREADS_MAX) {
+        count = IO_THREADS_MAX;
+    }
+    io_thread_count = count - 1;  // The main thread is one of them
+    io_threads = calloc(io_thread_count > 0 ? io_thread_count : 1, sizeof(IoThread));
+    if (!io_threads) {
+        fprintf(stderr, "Error: Failed to allocate I/O threads.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < io_thread_count; i++) {
+        sem_init(&io_threads[i].wake, 0, 0);
+        if (pthread_create(&io_threads[i].thread, NULL, io_thread_main, &io_threads[i]) != 0) {
+            perror("Failed to create I/O thread");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(io_threads[i].thread);
+    }
+}
+
+void launch_io_threads(struct Server *server) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1 failed");
+        exit(1);
+    }
+    add_listener(server->socket);
+    if (server->unix_socket >= 0) {
+        add_listener(server->unix_socket);
+    }
+
+    // Only this thread touches the keyspace from here on
+    set_keyspace_locking(0);
+    set_reply_writer(connection_queue_reply);
+    start_io_threads(server_config.io_threads);
+
+    printf("====WAITING FOR CONNECTIONS (%d I/O threads)=====\n", io_thread_count + 1);
+
+    struct epoll_event events[IO_THREADS_MAX_EVENTS];
+    time_t last_cron = time(NULL);
+    while (1) {
+        int ready = epoll_wait(epoll_fd, events, IO_THREADS_MAX_EVENTS, 1000);
+        if (ready < 0 && errno != EINTR) {
+            perror("epoll_wait failed");
+            break;
+        }
+
+        int count = 0;
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == server->socket || fd == server->unix_socket) {
+                accept_clients(fd, fd == server->socket);
+                continue;
+            }
+
+            Connection *conn = connection_lookup(fd);
+            if (!conn) {
+                continue;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                close_client(conn);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                IoJob job = { .conn = conn, .status = IO_JOB_OK };
+                run_job(IO_OP_WRITE, &job);
+                finish_write(&job);
+                if (job.status == IO_JOB_CLOSE) {
+                    continue;
+                }
+            }
+            if ((events[i].events & EPOLLIN) && reserve_jobs(count + 1) == 0) {
+                jobs[count].conn = conn;
+                jobs[count].status = IO_JOB_OK;
+                count++;
+            }
+        }
+
+        // Read and parse in parallel, then execute here in event order
+        run_jobs(IO_OP_READ, jobs, count);
+        for (int i = 0; i < count; i++) {
+            Connection *conn = jobs[i].conn;
+            if (jobs[i].status == IO_JOB_CLOSE) {
+                close_client(conn);
+            } else if (connection_execute_parsed(conn) != 0) {
+                connection_flush(conn);  // Best effort delivery of the protocol error
+                close_client(conn);
+            }
+        }
+
+        write_replies();
+        run_cron(&last_cron);
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef IO_THREADS_H
+#define IO_THREADS_H
+
+#include "Server.h"
+
+#define IO_THREADS_MAX 128
+#define IO_THREADS_SPIN 100000        // Polls for work before an I/O thread sleeps
+#define IO_THREADS_MIN_PER_THREAD 2   // Fewer ready clients per thread are handled inline
+#define IO_THREADS_CRON_INTERVAL 10   // Seconds between expiry/eviction/rehash runs
+
+// --io threaded: one main thread owns the epoll loop and executes every
+// command, so the keyspace needs no locking. Socket reads with RESP
+// parsing, and reply writes, are fanned out to io_threads helper threads
+// (the main thread takes a share too) and joined before execution resumes.
+void launch_io_threads(struct Server *server);
+
+#endif // IO_THREADS_H
@@ -0,0 +1,501 @@
+#define _GNU_SOURCE
+#include "partition.h"
+#include "../core/commands.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#define PARTITION_KEYS_ON_STACK 64   // Commands with more keys allocate their routing scratch
+
+struct PartitionGather;
+
+// A command (or the share of one) travelling to the partition that owns its
+// keys, and back to the client's loop with the reply
+typedef struct PartitionMessage {
+    struct PartitionMessage *next;
+    struct PartitionGather *gather;
+    int origin;          // Loop serving the client
+    int target;          // Partition that runs the command
+    int executed;        // Set by the target before sending the message back
+    int protocol;        // The client's RESP version, for encoding the reply
+    RedisCommand cmd;    // Private copy; argv and the strings share one allocation
+    char *reply;
+    size_t reply_len;
+    size_t reply_cap;
+} PartitionMessage;
+
+// Collects the parts of one client command on the client's loop
+typedef struct PartitionGather {
+    int client_fd;
+    uint64_t client_id;   // Detects a closed client whose fd was reused
+    GatherMode mode;
+    int parts;
+    int remaining;
+    int key_count;
+    int *key_parts;      // Part answering each key, in argument order; after results
+    size_t *offsets;     // Bytes of each part's reply already written; after key_parts
+    PartitionMessage *results[];
+} PartitionGather;
+
+// Multi-producer, single-consumer stack. The eventfd is signalled when a
+// push finds it empty; the owner takes the whole list at once.
+typedef struct PartitionInbox {
+    PartitionMessage *head;
+    int event_fd;
+} PartitionInbox;
+
+static PartitionInbox *inboxes = NULL;
+static int inbox_count = 0;
+
+static __thread int self = -1;
+static __thread PartitionResume resume_client = NULL;
+static __thread void *resume_arg = NULL;
+static __thread PartitionMessage *capture = NULL;   // Collects replies while a message runs
+
+int init_partitions(int count) {
+    if (count <= 1) {
+        return 0;
+    }
+    inboxes = calloc(count, sizeof(PartitionInbox));
+    if (!inboxes) {
+        fprintf(stderr, "Error: Failed to allocate partition inboxes.\n");
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        inboxes[i].event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (inboxes[i].event_fd < 0) {
+            perror("Failed to create partition eventfd");
+            return -1;
+        }
+    }
+    inbox_count = count;
+    return 0;
+}
+
+int partition_inbox_fd(int partition) {
+    return partition < inbox_count ? inboxes[partition].event_fd : -1;
+}
+
+static void inbox_push(int partition, PartitionMessage *msg) {
+    PartitionInbox *inbox = &inboxes[partition];
+    PartitionMessage *head = __atomic_load_n(&inbox->head, __ATOMIC_RELAXED);
+    do {
+        msg->next = head;
+    } while (!__atomic_compare_exchange_n(&inbox->head, &head, msg, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    if (!head) {
+        uint64_t one = 1;
+        if (write(inbox->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("Failed to signal partition inbox");
+        }
+    }
+}
+
+// Take every queued message, oldest first
+static PartitionMessage *inbox_take(int partition) {
+    PartitionMessage *msg = __atomic_exchange_n(&inboxes[partition].head, NULL, __ATOMIC_ACQUIRE);
+    PartitionMessage *ordered = NULL;
+    while (msg) {
+        PartitionMessage *next = msg->next;
+        msg->next = ordered;
+        ordered = msg;
+        msg = next;
+    }
+    return ordered;
+}
+
+// Copy args into a message bound for target. The client's input buffer may
+// move before the command runs, so nothing may point into it.
+static PartitionMessage *message_create(RedisString **args, int argc, int target) {
+    size_t size = sizeof(PartitionMessage) + (size_t)argc * sizeof(RedisString);
+    for (int i = 0; i < argc; i++) {
+        size += args[i]->length + 1;
+    }
+    PartitionMessage *msg = malloc(size);
+    if (!msg) {
+        return NULL;
+    }
+    memset(msg, 0, sizeof(PartitionMessage));
+    msg->origin = self;
+    msg->target = target;
+    msg->protocol = get_reply_protocol();   // Set for the client being dispatched
+    msg->cmd.argc = argc;
+    msg->cmd.argv = (RedisString *)(msg + 1);
+
+    char *data = (char *)(msg->cmd.argv + argc);
+    for (int i = 0; i < argc; i++) {
+        memcpy(data, args[i]->data, args[i]->length);
+        data[args[i]->length] = '\0';
+        msg->cmd.argv[i].data = data;
+        msg->cmd.argv[i].length = args[i]->length;
+        data += args[i]->length + 1;
+    }
+    return msg;
+}
+
+static void message_free(PartitionMessage *msg) {
+    free(msg->reply);
+    free(msg);
+}
+
+// ReplyWriter installed while a message runs
+static void capture_reply(int socket, const char *data, size_t len) {
+    (void)socket;
+    PartitionMessage *msg = capture;
+    if (msg->reply_len + len > msg->reply_cap) {
+        size_t cap = msg->reply_cap ? msg->reply_cap * 2 : 64;
+        while (cap < msg->reply_len + len) {
+            cap *= 2;
+        }
+        char *reply = realloc(msg->reply, cap);
+        if (!reply) {
+            return;
+        }
+        msg->reply = reply;
+        msg->reply_cap = cap;
+    }
+    memcpy(msg->reply + msg->reply_len, data, len);
+    msg->reply_len += len;
+}
+
+// Run the message against this thread's partition
+static void message_execute(PartitionMessage *msg) {
+    int protocol = get_reply_protocol();
+    capture = msg;
+    set_reply_writer(capture_reply);
+    set_reply_protocol(msg->protocol);
+    execute_command(-1, &msg->cmd);
+    set_reply_protocol(protocol);
+    set_reply_writer(connection_queue_reply);
+    capture = NULL;
+    msg->executed = 1;
+}
+
+// The first part that did not answer with an array of one element per
+// key, NULL if all did. Leaves where each part's elements start in offsets.
+static PartitionMessage *concat_failure(PartitionGather *gather) {
+    for (int p = 0; p < gather->parts; p++) {
+        PartitionMessage *msg = gather->results[p];
+        int expected = 0;
+        for (int k = 0; k < gather->key_count; k++) {
+            expected += gather->key_parts[k] == p;
+        }
+        long long count;
+        size_t pos = reply_aggregate_header(msg->protocol, msg->reply, msg->reply_len, '*', &count);
+        if (pos == 0 || count != expected) {
+            return msg;
+        }
+        gather->offsets[p] = pos;
+        int replies = 0;
+        size_t len;
+        while (pos < msg->reply_len &&
+               (len = reply_length(msg->protocol, msg->reply + pos, msg->reply_len - pos)) > 0) {
+            pos += len;
+            replies++;
+        }
+        if (replies != expected || pos != msg->reply_len) {
+            return msg;
+        }
+    }
+    return NULL;
+}
+
+// One array with the element of every key back in argument order
+static void write_concat(PartitionGather *gather) {
+    PartitionMessage *failed = concat_failure(gather);
+    if (failed) {
+        connection_queue_reply(gather->client_fd, failed->reply, failed->reply_len);
+        return;
+    }
+    size_t *offsets = gather->offsets;
+    send_redis_array(gather->client_fd, gather->key_count);
+    for (int k = 0; k < gather->key_count; k++) {
+        int p = gather->key_parts[k];
+        PartitionMessage *msg = gather->results[p];
+        size_t len = reply_length(msg->protocol, msg->reply + offsets[p], msg->reply_len - offsets[p]);
+        connection_queue_reply(gather->client_fd, msg->reply + offsets[p], len);
+        offsets[p] += len;
+    }
+}
+
+static void write_gathered_reply(PartitionGather *gather) {
+    if (gather->parts == 1) {
+        PartitionMessage *msg = gather->results[0];
+        connection_queue_reply(gather->client_fd, msg->reply, msg->reply_len);
+        return;
+    }
+
+    switch (gather->mode) {
+    case GATHER_CONCAT:
+        write_concat(gather);
+        return;
+    case GATHER_SUM: {
+        long long sum = 0;
+        for (int p = 0; p < gather->parts; p++) {
+            PartitionMessage *msg = gather->results[p];
+            long long value;
+            if (reply_to_integer(msg->protocol, msg->reply, msg->reply_len, &value) != 0) {
+                connection_queue_reply(gather->client_fd, msg->reply, msg->reply_len);
+                return;
+            }
+            sum += value;
+        }
+        send_redis_integer(gather->client_fd, sum);
+        return;
+    }
+    case GATHER_ALL_OK:
+    case GATHER_NONE:
+        for (int p = 0; p < gather->parts; p++) {
+            PartitionMessage *msg = gather->results[p];
+            if (!reply_is_ok(msg->protocol, msg->reply, msg->reply_len)) {
+                connection_queue_reply(gather->client_fd, msg->reply, msg->reply_len);
+                return;
+            }
+        }
+        send_redis_ok(gather->client_fd);
+        return;
+    }
+}
+
+static void gather_free(PartitionGather *gather) {
+    for (int p = 0; p < gather->parts; p++) {
+        if (gather->results[p]) {
+            message_free(gather->results[p]);
+        }
+    }
+    free(gather);
+}
+
+// A part came back to the client's loop
+static void gather_part_done(PartitionGather *gather) {
+    if (--gather->remaining > 0) {
+        return;
+    }
+    Connection *conn = connection_lookup(gather->client_fd);
+    if (conn && conn->id == gather->client_id) {
+        // Merged replies are encoded for this client, not the last one served
+        int protocol = get_reply_protocol();
+        set_reply_protocol(gather->results[0]->protocol);
+        write_gathered_reply(gather);
+        set_reply_protocol(protocol);
+        conn->blocked = 0;
+        gather_free(gather);
+        resume_client(conn, resume_arg);
+        return;
+    }
+    gather_free(gather);
+}
+
+void partition_process_inbox(void) {
+    uint64_t count;
+    if (read(inboxes[self].event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("Failed to read partition eventfd");
+    }
+
+    PartitionMessage *msg = inbox_take(self);
+    while (msg) {
+        PartitionMessage *next = msg->next;
+        if (msg->executed) {
+            gather_part_done(msg->gather);
+        } else {
+            message_execute(msg);
+            inbox_push(msg->origin, msg);
+        }
+        msg = next;
+    }
+}
+
+// Send the parts out; the client blocks until they are all back
+static int scatter(Connection *conn, PartitionGather *gather) {
+    gather->client_fd = conn->fd;
+    gather->client_id = conn->id;
+    gather->remaining = gather->parts;
+    conn->blocked = 1;
+
+    PartitionMessage *local = NULL;
+    for (int p = 0; p < gather->parts; p++) {
+        PartitionMessage *msg = gather->results[p];
+        msg->gather = gather;
+        if (msg->target == self) {
+            local = msg;
+        } else {
+            inbox_push(msg->target, msg);
+        }
+    }
+    // At least one part is remote, so this never completes the gather
+    if (local) {
+        message_execute(local);
+        gather->remaining--;
+    }
+    return 1;
+}
+
+// Room for the results of parts parts and the owner of key_count keys
+static PartitionGather *gather_create(Connection *conn, GatherMode mode, int parts, int key_count) {
+    size_t size = sizeof(PartitionGather) + (size_t)parts * (sizeof(PartitionMessage *) + sizeof(size_t)) +
+                  (size_t)key_count * sizeof(int);
+    PartitionGather *gather = calloc(1, size);
+    if (!gather) {
+        send_redis_error(conn->fd, "out of memory");
+        return NULL;
+    }
+    gather->mode = mode;
+    gather->parts = parts;
+    gather->key_count = key_count;
+    gather->offsets = (size_t *)(gather->results + parts);
+    gather->key_parts = (int *)(gather->offsets + parts);
+    return gather;
+}
+
+static int fail_dispatch(Connection *conn, PartitionGather *gather) {
+    gather_free(gather);
+    send_redis_error(conn->fd, "out of memory");
+    return 1;
+}
+
+// Run a keyless command such as FLUSHALL on every partition
+static int dispatch_broadcast(Connection *conn, RedisCommand *cmd, const CommandRoute *route) {
+    PartitionGather *gather = gather_create(conn, route->gather, inbox_count, 0);
+    if (!gather) {
+        return 1;
+    }
+    RedisString **args = malloc((size_t)cmd->argc * sizeof(RedisString *));
+    if (!args) {
+        return fail_dispatch(conn, gather);
+    }
+    for (int i = 0; i < cmd->argc; i++) {
+        args[i] = &cmd->argv[i];
+    }
+    for (int p = 0; p < inbox_count; p++) {
+        if (!(gather->results[p] = message_create(args, cmd->argc, p))) {
+            free(args);
+            return fail_dispatch(conn, gather);
+        }
+    }
+    free(args);
+    return scatter(conn, gather);
+}
+
+// Send each owning partition its share of cmd: the arguments before the
+// first key, that partition's keys (with their values), then any trailing
+// ones. owners holds the partition of each of the key_count keys, targets
+// has room for as many.
+static int split_command(Connection *conn, RedisCommand *cmd, const CommandRoute *route,
+                         const int *owners, int *targets, int key_count, int first, int last) {
+    int step = route->key_step;
+
+    // Number the owning partitions in order of their first key; the
+    // numbering goes straight into the gather
+    int part_count = 0;
+    for (int k = 0; k < key_count; k++) {
+        int p = 0;
+        while (p < part_count && targets[p] != owners[k]) {
+            p++;
+        }
+        if (p == part_count) {
+            targets[part_count++] = owners[k];
+        }
+    }
+    PartitionGather *gather = gather_create(conn, route->gather, part_count, key_count);
+    if (!gather) {
+        return 1;
+    }
+    for (int k = 0; k < key_count; k++) {
+        int p = 0;
+        while (targets[p] != owners[k]) {
+            p++;
+        }
+        gather->key_parts[k] = p;
+    }
+
+    RedisString **args = malloc((size_t)cmd->argc * sizeof(RedisString *));
+    if (!args) {
+        return fail_dispatch(conn, gather);
+    }
+    for (int p = 0; p < part_count; p++) {
+        int argc = 0;
+        for (int i = 0; i < first; i++) {
+            args[argc++] = &cmd->argv[i];
+        }
+        for (int k = 0; k < key_count; k++) {
+            if (gather->key_parts[k] != p) {
+                continue;
+            }
+            for (int j = 0; j < step; j++) {
+                args[argc++] = &cmd->argv[first + k * step + j];
+            }
+        }
+        for (int i = last + 1; i < cmd->argc; i++) {
+            args[argc++] = &cmd->argv[i];
+        }
+        if (!(gather->results[p] = message_create(args, argc, targets[p]))) {
+            free(args);
+            return fail_dispatch(conn, gather);
+        }
+    }
+    free(args);
+    return scatter(conn, gather);
+}
+
+// CommandDispatcher for partitioned event loops. Commands whose keys all
+// live here run in place; others are split by owning partition.
+static int partition_dispatch(Connection *conn, RedisCommand *cmd) {
+    const CommandRoute *route = lookup_command_route(cmd);
+    if (!route) {
+        return 0;
+    }
+    if (route->broadcast) {
+        return dispatch_broadcast(conn, cmd, route);
+    }
+
+    int first = route->first_key;
+    int last = route->last_key < 0 ? cmd->argc + route->last_key : route->last_key;
+    int step = route->key_step;
+    // No keys, or malformed; the handler reports its own argument errors
+    if (first == 0 || first >= cmd->argc || last >= cmd->argc || last < first ||
+        (last - first + 1) % step != 0) {
+        return 0;
+    }
+
+    int key_count = (last - first + 1) / step;
+    int scratch[2 * PARTITION_KEYS_ON_STACK];   // Owner of each key, then the distinct owners
+    int *owners = scratch;
+    if (key_count > PARTITION_KEYS_ON_STACK && !(owners = malloc(2 * (size_t)key_count * sizeof(int)))) {
+        send_redis_error(conn->fd, "out of memory");
+        return 1;
+    }
+    int single = 1;
+    owners[0] = keyspace_partition_of(cmd->argv[first].data, cmd->argv[first].length);
+    for (int k = 1; k < key_count; k++) {
+        RedisString *key = &cmd->argv[first + k * step];
+        owners[k] = keyspace_partition_of(key->data, key->length);
+        single &= owners[k] == owners[0];
+    }
+    int handled;
+    if (single && owners[0] == self) {
+        handled = 0;   // Runs in place
+    } else if (!single && route->gather == GATHER_NONE) {
+        send_redis_error(conn->fd, "keys in request don't hash to the same partition");
+        handled = 1;
+    } else {
+        handled = split_command(conn, cmd, route, owners, owners + key_count, key_count, first, last);
+    }
+    if (owners != scratch) {
+        free(owners);
+    }
+    return handled;
+}
+
+void partition_thread_init(int partition, PartitionResume resume, void *arg) {
+    if (partition >= inbox_count) {
+        return;
+    }
+    self = partition;
+    resume_client = resume;
+    resume_arg = arg;
+    keyspace_select_partition(partition);
+    set_command_dispatcher(partition_dispatch);
+}
@@ -0,0 +1,31 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "connection.h"
+
+// Shared-nothing keyspace (--partitioned-keyspace yes): event loop i owns
+// keyspace partition i and is the only thread that touches it, so commands
+// run without locks. A command whose keys live on other partitions is
+// shipped to the owning loops through their inboxes; the client stays
+// blocked on its own loop until every part has replied, and the parts are
+// merged according to the command's GatherMode.
+
+// Called on the client's loop once its deferred command has been answered.
+// The connection is unblocked and may have further input to process.
+typedef void (*PartitionResume)(Connection *conn, void *arg);
+
+// Create one inbox per partition. Returns 0 on success, -1 on error.
+int init_partitions(int count);
+
+// Bind the calling event loop thread to its partition
+void partition_thread_init(int partition, PartitionResume resume, void *arg);
+
+// Eventfd that becomes readable when the partition's inbox has messages,
+// -1 if the keyspace is not split
+int partition_inbox_fd(int partition);
+
+// Run commands sent to this thread's partition and merge returned replies.
+// Call when the inbox eventfd is readable.
+void partition_process_inbox(void);
+
+#endif // PARTITION_H
@@ -0,0 +1,410 @@
+#define _GNU_SOURCE
+#include "shm.h"
+#include "Server.h"
+#include "connection.h"
+#include "../core/protocol.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+// One shared-memory client. The control socket doubles as the key of its
+// Connection, so commands and replies go through the usual path.
+typedef struct ShmConn {
+    int control_fd;
+    int request_efd;        // Signalled by the client when we sleep
+    int response_efd;       // Signalled by us when the client sleeps
+    ShmRegion *region;
+    size_t region_size;
+    ShmRingView request;    // Laid out by us, not read back from the region
+    ShmRingView response;
+    int output_pending;     // Replies left over because the response ring was full
+} ShmConn;
+
+typedef struct ShmServer {
+    int listen_socket;
+    int epoll_fd;
+    pthread_t thread;
+    ShmConn **conns;        // Indexed by control socket
+    int conn_capacity;
+    int *active;            // Control sockets of the connected clients
+    int active_count;
+} ShmServer;
+
+static ShmServer shm_server;
+
+// epoll data: what became ready in the high half, the control socket in the low
+enum {
+    SHM_EVENT_LISTENER,
+    SHM_EVENT_CONTROL,
+    SHM_EVENT_REQUEST
+};
+
+#define SHM_EVENT_DATA(kind, fd) (((uint64_t)(kind) << 32) | (uint32_t)(fd))
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static void shm_close_conn(ShmServer *server, ShmConn *conn) {
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->control_fd, NULL);
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->request_efd, NULL);
+    for (int i = 0; i < server->active_count; i++) {
+        if (server->active[i] == conn->control_fd) {
+            server->active[i] = server->active[--server->active_count];
+            break;
+        }
+    }
+    server->conns[conn->control_fd] = NULL;
+    connection_free(connection_lookup(conn->control_fd));
+    munmap(conn->region, conn->region_size);
+    close(conn->request_efd);
+    close(conn->response_efd);
+    close(conn->control_fd);
+    free(conn);
+}
+
+// Send the region and both eventfds over the control socket
+static int shm_send_handshake(ShmConn *conn, int memfd) {
+    uint64_t size = conn->region_size;
+    struct iovec iov = { .iov_base = &size, .iov_len = sizeof(size) };
+    int fds[3] = { memfd, conn->request_efd, conn->response_efd };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    return sendmsg(conn->control_fd, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(size) ? 0 : -1;
+}
+
+static int shm_track_conn(ShmServer *server, ShmConn *conn) {
+    int fd = conn->control_fd;
+    if (fd >= server->conn_capacity) {
+        int capacity = server->conn_capacity ? server->conn_capacity : 256;
+        while (capacity <= fd) {
+            capacity *= 2;
+        }
+        ShmConn **conns = realloc(server->conns, capacity * sizeof(ShmConn *));
+        int *active = realloc(server->active, capacity * sizeof(int));
+        if (conns) {
+            server->conns = conns;
+        }
+        if (active) {
+            server->active = active;
+        }
+        if (!conns || !active) {
+            return -1;
+        }
+        memset(conns + server->conn_capacity, 0, (capacity - server->conn_capacity) * sizeof(ShmConn *));
+        server->conn_capacity = capacity;
+    }
+    server->conns[fd] = conn;
+    server->active[server->active_count++] = fd;
+    return 0;
+}
+
+// Set up the shared region for a client that connected to the control socket
+static void shm_accept(ShmServer *server) {
+    int control_fd = accept4(server->listen_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (control_fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            perror("Accept failed");
+        }
+        return;
+    }
+
+    ShmConn *conn = calloc(1, sizeof(ShmConn));
+    int memfd = memfd_create("swiftdb-shm", MFD_CLOEXEC);
+    if (!conn || memfd < 0) {
+        perror("Failed to create shared memory client");
+        free(conn);
+        close(control_fd);
+        if (memfd >= 0) {
+            close(memfd);
+        }
+        return;
+    }
+    conn->control_fd = control_fd;
+    conn->region_size = shm_region_size(SHM_RING_SIZE);
+    conn->request_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    conn->response_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    conn->region = MAP_FAILED;
+    if (ftruncate(memfd, conn->region_size) == 0) {
+        conn->region = mmap(NULL, conn->region_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, memfd, 0);
+    }
+
+    if (conn->request_efd < 0 || conn->response_efd < 0 || conn->region == MAP_FAILED) {
+        perror("Failed to set up shared memory client");
+        goto fail;
+    }
+    shm_region_init(conn->region, SHM_RING_SIZE);
+    shm_ring_attach(&conn->request, conn->region, &conn->region->request, shm_region_header(), SHM_RING_SIZE);
+    shm_ring_attach(&conn->response, conn->region, &conn->region->response, shm_region_header() + SHM_RING_SIZE,
+                    SHM_RING_SIZE);
+
+    if (shm_send_handshake(conn, memfd) != 0) {
+        perror("Failed to send shared memory handshake");
+        goto fail;
+    }
+    close(memfd);
+
+    if (!connection_create(control_fd) || shm_track_conn(server, conn) != 0) {
+        fprintf(stderr, "Error: Failed to allocate shared memory client.\n");
+        connection_free(connection_lookup(control_fd));
+        memfd = -1;
+        goto fail;
+    }
+
+    // The control socket only reports hangups; the eventfd wakes us for requests
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLRDHUP;
+    event.data.u64 = SHM_EVENT_DATA(SHM_EVENT_CONTROL, control_fd);
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, control_fd, &event);
+    event.events = EPOLLIN;
+    event.data.u64 = SHM_EVENT_DATA(SHM_EVENT_REQUEST, control_fd);
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, conn->request_efd, &event);
+    return;
+
+fail:
+    if (memfd >= 0) {
+        close(memfd);
+    }
+    if (conn->region != MAP_FAILED) {
+        munmap(conn->region, conn->region_size);
+    }
+    if (conn->request_efd >= 0) {
+        close(conn->request_efd);
+    }
+    if (conn->response_efd >= 0) {
+        close(conn->response_efd);
+    }
+    close(control_fd);
+    free(conn);
+}
+
+// Move requests from the ring into the connection's input buffer and run
+// them. Returns 1 if any input was consumed, 0 if idle, -1 to disconnect.
+static int shm_read_requests(ShmConn *conn) {
+    uint32_t pending = shm_ring_readable(&conn->request);
+    if (pending == 0) {
+        return 0;
+    }
+    if (pending == SHM_RING_CORRUPT) {
+        fprintf(stderr, "Client %d corrupted its request ring.\n", conn->control_fd);
+        return -1;
+    }
+
+    Connection *client = connection_lookup(conn->control_fd);
+    size_t available;
+    char *space = connection_input_space(client, &available);
+    if (!space) {
+        fprintf(stderr, "Client %d exceeded the query buffer limit.\n", conn->control_fd);
+        return -1;
+    }
+    if (available > conn->request.size) {
+        available = conn->request.size;
+    }
+    client->qb_len += shm_ring_read(&conn->request, space, available);
+
+    return connection_process_input(client) == 0 ? 1 : -1;
+}
+
+// Copy queued replies into the response ring. Returns -1 if the client has
+// to be dropped for exceeding its output buffer limit or corrupting the ring.
+static int shm_write_replies(ShmConn *conn) {
+    Connection *client = connection_lookup(conn->control_fd);
+    ShmRingView *ring = &conn->response;
+    struct iovec iov[CONNECTION_FLUSH_IOV];
+    size_t written = 0;
+    uint32_t space;
+
+    while (client->reply_bytes > 0 && (space = shm_ring_writable(ring)) > 0) {
+        if (space == SHM_RING_CORRUPT) {
+            fprintf(stderr, "Client %d corrupted its response ring.\n", conn->control_fd);
+            return -1;
+        }
+        int count = connection_reply_iov(client, iov, CONNECTION_FLUSH_IOV);
+        size_t copied = 0;
+        for (int i = 0; i < count; i++) {
+            size_t n = shm_ring_write(ring, iov[i].iov_base, iov[i].iov_len);
+            copied += n;
+            if (n < iov[i].iov_len) {
+                break;
+            }
+        }
+        connection_reply_written(client, copied);
+        written += copied;
+    }
+
+    if (written > 0 && shm_ring_needs_wakeup(ring)) {
+        uint64_t one = 1;
+        if (write(conn->response_efd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("Failed to wake shared memory client");
+        }
+    }
+
+    conn->output_pending = client->reply_bytes > 0;
+    if (conn->output_pending && connection_output_over_limit(client)) {
+        return -1;
+    }
+    return 0;
+}
+
+static void shm_handle_events(ShmServer *server, int timeout) {
+    struct epoll_event events[SHM_MAX_EVENTS];
+    int ready = epoll_wait(server->epoll_fd, events, SHM_MAX_EVENTS, timeout);
+
+    for (int i = 0; i < ready; i++) {
+        int kind = (int)(events[i].data.u64 >> 32);
+        if (kind == SHM_EVENT_LISTENER) {
+            shm_accept(server);
+            continue;
+        }
+
+        // An earlier event in this batch may have closed the client
+        ShmConn *conn = server->conns[(int)(uint32_t)events[i].data.u64];
+        if (!conn) {
+            continue;
+        }
+        if (kind == SHM_EVENT_CONTROL) {
+            shm_close_conn(server, conn);
+        } else {
+            uint64_t count;
+            if (read(conn->request_efd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                perror("Failed to read shared memory eventfd");
+            }
+        }
+    }
+}
+
+// Sleep until a client signals. Returns without sleeping if a request
+// arrived while the waiting flags were being set.
+static void shm_wait(ShmServer *server) {
+    int output_pending = 0;
+    int ready = 0;
+    for (int i = 0; i < server->active_count; i++) {
+        ShmConn *conn = server->conns[server->active[i]];
+        output_pending |= conn->output_pending;
+        if (shm_ring_prepare_wait(&conn->request)) {
+            ready = 1;
+        }
+    }
+
+    if (!ready) {
+        // Replies stuck behind a full ring are retried shortly; the client
+        // does not signal when it frees space
+        shm_handle_events(server, output_pending ? 1 : -1);
+    }
+
+    for (int i = 0; i < server->active_count; i++) {
+        shm_ring_end_wait(&server->conns[server->active[i]]->request);
+    }
+}
+
+static void *shm_thread(void *arg) {
+    ShmServer *server = (ShmServer *)arg;
+    set_reply_writer(connection_queue_reply);
+
+    int idle = 0;
+    unsigned int iterations = 0;
+    while (1) {
+        int busy = 0;
+
+        for (int i = 0; i < server->active_count; i++) {
+            ShmConn *conn = server->conns[server->active[i]];
+            int ret = shm_read_requests(conn);
+            if (ret < 0) {
+                shm_write_replies(conn);  // Best effort delivery of the error
+                shm_close_conn(server, conn);
+                i--;
+                continue;
+            }
+            busy |= ret;
+        }
+
+        Connection *client;
+        while ((client = connection_pop_pending())) {
+            ShmConn *conn = server->conns[client->fd];
+            if (shm_write_replies(conn) != 0) {
+                shm_close_conn(server, conn);
+            }
+        }
+        for (int i = 0; i < server->active_count; i++) {
+            ShmConn *conn = server->conns[server->active[i]];
+            if (conn->output_pending) {
+                if (shm_write_replies(conn) != 0) {
+                    shm_close_conn(server, conn);
+                    i--;
+                    continue;
+                }
+            }
+        }
+
+        if (busy) {
+            idle = 0;
+            if (++iterations % SHM_EPOLL_INTERVAL == 0) {
+                shm_handle_events(server, 0);
+            }
+        } else if (++idle < SHM_SPIN_ITERATIONS) {
+            cpu_relax();
+        } else {
+            shm_wait(server);
+            idle = 0;
+        }
+    }
+    return NULL;
+}
+
+int start_shm_transport(const char *path, int permissions, int backlog) {
+    ShmServer *server = &shm_server;
+    server->listen_socket = unix_listener_create(path, permissions, backlog);
+    if (server->listen_socket < 0) {
+        return -1;
+    }
+    fcntl(server->listen_socket, F_SETFL, fcntl(server->listen_socket, F_GETFL, 0) | O_NONBLOCK);
+
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (server->epoll_fd < 0) {
+        perror("epoll_create1 failed");
+        return -1;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = SHM_EVENT_DATA(SHM_EVENT_LISTENER, server->listen_socket);
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_socket, &event) < 0) {
+        perror("Failed to register shared memory listener");
+        return -1;
+    }
+
+    if (pthread_create(&server->thread, NULL, shm_thread, server) != 0) {
+        perror("Failed to create shared memory thread");
+        return -1;
+    }
+    pthread_detach(server->thread);
+    return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include "shm_ring.h"
+
+#define SHM_SPIN_ITERATIONS 20000   // Idle polls of the rings before sleeping
+#define SHM_EPOLL_INTERVAL 1024     // Busy iterations between checks for new clients
+#define SHM_MAX_EVENTS 64
+
+// Shared-memory transport for clients on the same host. Clients connect to
+// a control Unix socket and receive a memfd with the request/response rings
+// plus one eventfd per direction. The control socket stays open for the
+// lifetime of the client; closing it disconnects.
+//
+// Returns 0 once the listener and the serving thread are running.
+int start_shm_transport(const char *path, int permissions, int backlog);
+
+#endif // SHM_H
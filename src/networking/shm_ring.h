@@ -0,0 +1,153 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+// Layout of the shared-memory transport, used by the server and by the
+// client library in bench/. A region holds two single-producer/single-
+// consumer byte rings carrying ordinary RESP: requests from the client and
+// replies from the server. Positions only ever grow and wrap at 2^32; the
+// ring size is a power of two so they index the data with a mask.
+//
+// Each side keeps its own ShmRingView of a ring and trusts nothing else
+// in the region: positions the peer publishes are checked against the
+// ring size before they are used.
+//
+// A consumer that goes to sleep sets its ring's waiting flag first and the
+// producer signals the matching eventfd only when it sees the flag, so the
+// fast path involves no system calls at all.
+
+#include <stdint.h>
+#include <string.h>
+
+#define SHM_RING_MAGIC 0x53444253u      // "SDBS"
+#define SHM_RING_SIZE (1u << 20)        // Bytes of data per direction
+
+typedef struct ShmRing {
+    _Alignas(64) uint32_t head;         // Consumer position
+    _Alignas(64) uint32_t tail;         // Producer position
+    _Alignas(64) uint32_t waiting;      // Consumer is asleep on its eventfd
+    uint32_t size;                      // Informational; see ShmRingView
+    uint64_t data_offset;               // From the start of the region
+} ShmRing;
+
+typedef struct ShmRegion {
+    uint32_t magic;
+    uint32_t ring_size;
+    ShmRing request;                    // Client -> server
+    ShmRing response;                   // Server -> client
+} ShmRegion;
+
+// Region header rounded up to a page; the request ring's data follows it,
+// then the response ring's
+static inline size_t shm_region_header(void) {
+    return (sizeof(ShmRegion) + 4095) & ~(size_t)4095;
+}
+
+static inline size_t shm_region_size(uint32_t ring_size) {
+    return shm_region_header() + 2 * (size_t)ring_size;
+}
+
+static inline void shm_region_init(ShmRegion *region, uint32_t ring_size) {
+    size_t header = shm_region_header();
+    memset(region, 0, sizeof(*region));
+    region->magic = SHM_RING_MAGIC;
+    region->ring_size = ring_size;
+    region->request.size = ring_size;
+    region->request.data_offset = header;
+    region->response.size = ring_size;
+    region->response.data_offset = header + ring_size;
+}
+
+// One side's view of a ring, in its own memory. Both sides can write to
+// the region, so the data pointer, the size and the position this side
+// advances are kept here and never read back from it: the region only
+// publishes that position to the peer and carries the peer's, which is
+// checked before use.
+typedef struct ShmRingView {
+    ShmRing *ring;
+    char *data;
+    uint32_t size;          // Power of two
+    uint32_t position;      // Our head as the consumer, our tail as the producer
+} ShmRingView;
+
+// What readable/writable return when the peer published a position more
+// than a ring away from ours. Never a real count, the size being at most 2^31.
+#define SHM_RING_CORRUPT UINT32_MAX
+
+static inline void shm_ring_attach(ShmRingView *view, ShmRegion *region, ShmRing *ring, size_t data_offset,
+                                   uint32_t size) {
+    view->ring = ring;
+    view->data = (char *)region + data_offset;
+    view->size = size;
+    view->position = 0;
+}
+
+static inline uint32_t shm_ring_readable(const ShmRingView *view) {
+    uint32_t available = __atomic_load_n(&view->ring->tail, __ATOMIC_ACQUIRE) - view->position;
+    return available > view->size ? SHM_RING_CORRUPT : available;
+}
+
+static inline uint32_t shm_ring_writable(const ShmRingView *view) {
+    uint32_t used = view->position - __atomic_load_n(&view->ring->head, __ATOMIC_ACQUIRE);
+    return used > view->size ? SHM_RING_CORRUPT : view->size - used;
+}
+
+// Copy up to len bytes into the ring. Returns the number copied, 0 if the
+// ring is full or corrupt.
+static inline size_t shm_ring_write(ShmRingView *view, const char *src, size_t len) {
+    uint32_t space = shm_ring_writable(view);
+    if (space == SHM_RING_CORRUPT) {
+        return 0;
+    }
+    if (len > space) {
+        len = space;
+    }
+    uint32_t offset = view->position & (view->size - 1);
+    size_t first = view->size - offset < len ? view->size - offset : len;
+    memcpy(view->data + offset, src, first);
+    memcpy(view->data, src + first, len - first);
+    view->position += (uint32_t)len;
+    __atomic_store_n(&view->ring->tail, view->position, __ATOMIC_RELEASE);
+    return len;
+}
+
+// Copy up to len bytes out of the ring. Returns the number copied, 0 if the
+// ring is empty or corrupt.
+static inline size_t shm_ring_read(ShmRingView *view, char *dst, size_t len) {
+    uint32_t available = shm_ring_readable(view);
+    if (available == SHM_RING_CORRUPT) {
+        return 0;
+    }
+    if (len > available) {
+        len = available;
+    }
+    uint32_t offset = view->position & (view->size - 1);
+    size_t first = view->size - offset < len ? view->size - offset : len;
+    memcpy(dst, view->data + offset, first);
+    memcpy(dst + first, view->data, len - first);
+    view->position += (uint32_t)len;
+    __atomic_store_n(&view->ring->head, view->position, __ATOMIC_RELEASE);
+    return len;
+}
+
+// Consumer side: announce that we are about to sleep. Returns the bytes that
+// arrived meanwhile; if non-zero the caller must not sleep.
+static inline uint32_t shm_ring_prepare_wait(const ShmRingView *view) {
+    __atomic_store_n(&view->ring->waiting, 1, __ATOMIC_SEQ_CST);
+    uint32_t available = shm_ring_readable(view);
+    if (available) {
+        __atomic_store_n(&view->ring->waiting, 0, __ATOMIC_RELAXED);
+    }
+    return available;
+}
+
+static inline void shm_ring_end_wait(const ShmRingView *view) {
+    __atomic_store_n(&view->ring->waiting, 0, __ATOMIC_RELAXED);
+}
+
+// Producer side, after publishing data: whether the consumer needs a signal
+static inline int shm_ring_needs_wakeup(const ShmRingView *view) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&view->ring->waiting, __ATOMIC_RELAXED);
+}
+
+#endif // SHM_RING_H
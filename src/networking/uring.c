@@ -0,0 +1,507 @@
+#define _GNU_SOURCE
+#include "uring.h"
+#include "event_loop.h"
+#include "connection.h"
+#include "../core/protocol.h"
+#include "../core/commands.h"
+#include "../core/config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <netinet/tcp.h>
+#include <linux/io_uring.h>
+
+// user_data layout: operation in the top byte, connection generation in the
+// next three bytes and the socket in the low 32 bits. The generation lets us
+// drop completions that belong to an earlier connection on a reused fd.
+enum {
+    URING_OP_ACCEPT = 1,
+    URING_OP_RECV,
+    URING_OP_SEND
+};
+
+#define URING_USER_DATA(op, gen, fd) (((uint64_t)(op) << 56) | (((uint64_t)(gen) & 0xffffff) << 32) | (uint32_t)(fd))
+#define URING_DATA_OP(data) ((int)((data) >> 56))
+#define URING_DATA_GEN(data) ((uint32_t)(((data) >> 32) & 0xffffff))
+#define URING_DATA_FD(data) ((int)(uint32_t)(data))
+
+#define URING_BUFFER_GROUP 0
+
+// Replies live in the Connection's output blocks. A send covers the bytes
+// queued when it was submitted; later replies wait for the next send.
+typedef struct UringConn {
+    struct msghdr msg;
+    struct iovec iov[CONNECTION_FLUSH_IOV];
+    uint32_t generation;
+    int open;
+    int send_in_flight;
+    int closing;
+} UringConn;
+
+typedef struct UringLoop {
+    int ring_fd;
+    void *ring;             // Mappings made by uring_setup(), NULL until made
+    size_t ring_size;
+    size_t sqes_size;
+    size_t buf_ring_size;
+    int listen_socket;
+    int unix_socket;        // Shared AF_UNIX listener, -1 if not configured
+    pthread_t thread;
+
+    // Submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail;
+    unsigned sq_unsubmitted;
+    struct io_uring_sqe *sqes;
+
+    // Completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // Provided receive buffers
+    struct io_uring_buf_ring *buf_ring;
+    char *buffers;
+    unsigned short buf_tail;
+
+    UringConn **conns;      // Indexed by socket; entries stay put while sends are in flight
+    int conn_capacity;
+} UringLoop;
+
+static int uring_enter(UringLoop *loop, unsigned to_submit, unsigned min_complete) {
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    int ret = (int)syscall(__NR_io_uring_enter, loop->ring_fd, to_submit, min_complete, flags, NULL, 0);
+    return ret < 0 ? -errno : ret;
+}
+
+// Publish queued SQEs and optionally wait for completions
+static void uring_submit(UringLoop *loop, unsigned wait) {
+    __atomic_store_n(loop->sq_tail, loop->sq_local_tail, __ATOMIC_RELEASE);
+    int ret = uring_enter(loop, loop->sq_unsubmitted, wait);
+    if (ret >= 0) {
+        loop->sq_unsubmitted -= (unsigned)ret < loop->sq_unsubmitted ? (unsigned)ret : loop->sq_unsubmitted;
+    } else if (ret != -EINTR && ret != -EAGAIN && ret != -EBUSY) {
+        fprintf(stderr, "io_uring_enter failed: %s\n", strerror(-ret));
+    }
+}
+
+static struct io_uring_sqe *uring_get_sqe(UringLoop *loop) {
+    while (loop->sq_local_tail - __atomic_load_n(loop->sq_head, __ATOMIC_ACQUIRE) >= loop->sq_entries) {
+        uring_submit(loop, 0);  // Queue full, hand what we have to the kernel
+    }
+    struct io_uring_sqe *sqe = &loop->sqes[loop->sq_local_tail & loop->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    loop->sq_local_tail++;
+    loop->sq_unsubmitted++;
+    return sqe;
+}
+
+static void uring_recycle_buffer(UringLoop *loop, unsigned short bid) {
+    struct io_uring_buf *buf = &loop->buf_ring->bufs[loop->buf_tail & (URING_BUFFER_COUNT - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(loop->buffers + (size_t)bid * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = bid;
+    loop->buf_tail++;
+    __atomic_store_n(&loop->buf_ring->tail, loop->buf_tail, __ATOMIC_RELEASE);
+}
+
+static void uring_arm_accept(UringLoop *loop, int listen_socket) {
+    struct io_uring_sqe *sqe = uring_get_sqe(loop);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_socket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = URING_USER_DATA(URING_OP_ACCEPT, 0, listen_socket);
+}
+
+static void uring_arm_recv(UringLoop *loop, int fd) {
+    struct io_uring_sqe *sqe = uring_get_sqe(loop);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = URING_USER_DATA(URING_OP_RECV, loop->conns[fd]->generation, fd);
+}
+
+static void uring_arm_send(UringLoop *loop, int fd, Connection *client) {
+    UringConn *conn = loop->conns[fd];
+    memset(&conn->msg, 0, sizeof(conn->msg));
+    conn->msg.msg_iov = conn->iov;
+    conn->msg.msg_iovlen = connection_reply_iov(client, conn->iov, CONNECTION_FLUSH_IOV);
+
+    struct io_uring_sqe *sqe = uring_get_sqe(loop);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&conn->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = URING_USER_DATA(URING_OP_SEND, conn->generation, fd);
+    conn->send_in_flight = 1;
+}
+
+static void uring_close_conn(UringLoop *loop, int fd) {
+    UringConn *conn = loop->conns[fd];
+    conn->open = 0;
+    conn->closing = 0;
+    conn->generation++;
+    connection_free(connection_lookup(fd));
+    // Shut down first so an armed multishot recv terminates
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+}
+
+static int uring_ensure_conn(UringLoop *loop, int fd) {
+    if (fd >= loop->conn_capacity) {
+        int capacity = loop->conn_capacity ? loop->conn_capacity : 1024;
+        while (capacity <= fd) {
+            capacity *= 2;
+        }
+        UringConn **conns = realloc(loop->conns, capacity * sizeof(UringConn *));
+        if (!conns) {
+            return -1;
+        }
+        memset(conns + loop->conn_capacity, 0, (capacity - loop->conn_capacity) * sizeof(UringConn *));
+        loop->conns = conns;
+        loop->conn_capacity = capacity;
+    }
+    if (!loop->conns[fd]) {
+        loop->conns[fd] = calloc(1, sizeof(UringConn));
+        if (!loop->conns[fd]) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Submit the connection's queued replies unless a send is already in flight
+static void uring_start_send(UringLoop *loop, int fd) {
+    UringConn *conn = loop->conns[fd];
+    Connection *client = connection_lookup(fd);
+    if (conn->send_in_flight || !client || client->close_asap || client->reply_bytes == 0) {
+        return;
+    }
+    uring_arm_send(loop, fd, client);
+}
+
+// Queue one send per connection that got replies in this batch
+static void uring_flush_replies(UringLoop *loop) {
+    Connection *client;
+    while ((client = connection_pop_pending())) {
+        if (loop->conns[client->fd]->open) {
+            uring_start_send(loop, client->fd);
+        }
+    }
+}
+
+static void uring_handle_accept(UringLoop *loop, struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        uring_arm_accept(loop, URING_DATA_FD(cqe->user_data));
+    }
+    if (cqe->res < 0) {
+        if (cqe->res != -EINTR && cqe->res != -EAGAIN) {
+            fprintf(stderr, "Accept failed: %s\n", strerror(-cqe->res));
+        }
+        return;
+    }
+
+    int fd = cqe->res;
+    if (uring_ensure_conn(loop, fd) != 0 || !connection_create(fd)) {
+        fprintf(stderr, "Error: Failed to allocate connection state.\n");
+        close(fd);
+        return;
+    }
+
+    if (URING_DATA_FD(cqe->user_data) == loop->listen_socket) {
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    }
+
+    UringConn *conn = loop->conns[fd];
+    conn->open = 1;
+    conn->closing = 0;
+    conn->send_in_flight = 0;
+    uring_arm_recv(loop, fd);
+}
+
+static void uring_handle_recv(UringLoop *loop, struct io_uring_cqe *cqe) {
+    int fd = URING_DATA_FD(cqe->user_data);
+    UringConn *conn = loop->conns[fd];
+    int current = conn->open && !conn->closing && conn->generation == URING_DATA_GEN(cqe->user_data);
+    Connection *client = current ? connection_lookup(fd) : NULL;
+    int overflow = 0;
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (client && cqe->res > 0) {
+            // Append to the connection's input buffer so frames split
+            // across receives are reassembled
+            size_t available;
+            char *space = connection_input_space(client, &available);
+            if (space) {
+                memcpy(space, loop->buffers + (size_t)bid * URING_BUFFER_SIZE, cqe->res);
+                client->qb_len += cqe->res;
+            } else {
+                overflow = 1;
+            }
+        }
+        uring_recycle_buffer(loop, bid);
+    }
+
+    if (!current) {
+        return;  // Completion for a connection that is already gone
+    }
+
+    if (cqe->res == -ENOBUFS) {
+        // Ran out of provided buffers; they have been recycled, try again
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            uring_arm_recv(loop, fd);
+        }
+        return;
+    }
+    if (cqe->res <= 0 || overflow || connection_process_input(client) != 0) {
+        // Let queued replies (e.g. the protocol error) go out before closing
+        conn->closing = 1;
+        uring_start_send(loop, fd);
+        if (!conn->send_in_flight) {
+            uring_close_conn(loop, fd);
+        } else if (client->close_asap) {
+            // Over its output limit: fail the pending send rather than
+            // waiting for a client that may never read it
+            shutdown(fd, SHUT_RDWR);
+        }
+        return;
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        uring_arm_recv(loop, fd);
+    }
+}
+
+static void uring_handle_send(UringLoop *loop, struct io_uring_cqe *cqe) {
+    int fd = URING_DATA_FD(cqe->user_data);
+    UringConn *conn = loop->conns[fd];
+
+    if (!conn->open || conn->generation != URING_DATA_GEN(cqe->user_data)) {
+        return;
+    }
+    conn->send_in_flight = 0;
+
+    if (cqe->res < 0) {
+        uring_close_conn(loop, fd);
+        return;
+    }
+
+    Connection *client = connection_lookup(fd);
+    connection_reply_written(client, cqe->res);
+    if (connection_output_over_limit(client)) {
+        uring_close_conn(loop, fd);
+        return;
+    }
+
+    uring_start_send(loop, fd);
+    if (conn->closing && !conn->send_in_flight) {
+        uring_close_conn(loop, fd);
+    }
+}
+
+static void *uring_loop_thread(void *arg) {
+    UringLoop *loop = (UringLoop *)arg;
+    set_reply_writer(connection_queue_reply);
+
+    uring_arm_accept(loop, loop->listen_socket);
+    if (loop->unix_socket >= 0) {
+        uring_arm_accept(loop, loop->unix_socket);
+    }
+
+    while (1) {
+        uring_flush_replies(loop);
+        uring_submit(loop, 1);
+
+        unsigned head = *loop->cq_head;
+        unsigned tail = __atomic_load_n(loop->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &loop->cqes[head & loop->cq_mask];
+            switch (URING_DATA_OP(cqe->user_data)) {
+            case URING_OP_ACCEPT:
+                uring_handle_accept(loop, cqe);
+                break;
+            case URING_OP_RECV:
+                uring_handle_recv(loop, cqe);
+                break;
+            case URING_OP_SEND:
+                uring_handle_send(loop, cqe);
+                break;
+            }
+            head++;
+        }
+        __atomic_store_n(loop->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// Undo uring_setup(), or as much of it as was done: closing the ring also
+// drops the buffer group registration
+static void uring_teardown(UringLoop *loop) {
+    if (loop->buf_ring) {
+        munmap(loop->buf_ring, loop->buf_ring_size);
+        loop->buf_ring = NULL;
+    }
+    free(loop->buffers);
+    loop->buffers = NULL;
+    if (loop->sqes) {
+        munmap(loop->sqes, loop->sqes_size);
+        loop->sqes = NULL;
+    }
+    if (loop->ring) {
+        munmap(loop->ring, loop->ring_size);
+        loop->ring = NULL;
+    }
+    if (loop->ring_fd >= 0) {
+        close(loop->ring_fd);
+        loop->ring_fd = -1;
+    }
+}
+
+// Map the rings and register the provided buffer group. Returns 0 on
+// success; on failure nothing is left set up.
+static int uring_setup(UringLoop *loop) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_QUEUE_DEPTH * 4;
+
+    loop->ring_fd = (int)syscall(__NR_io_uring_setup, URING_QUEUE_DEPTH, &params);
+    if (loop->ring_fd < 0) {
+        perror("io_uring_setup failed");
+        return -1;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        fprintf(stderr, "io_uring: kernel lacks IORING_FEAT_SINGLE_MMAP\n");
+        uring_teardown(loop);
+        return -1;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    loop->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    loop->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    char *ring = mmap(NULL, loop->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      loop->ring_fd, IORING_OFF_SQ_RING);
+    loop->ring = ring == MAP_FAILED ? NULL : ring;
+    loop->sqes = mmap(NULL, loop->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      loop->ring_fd, IORING_OFF_SQES);
+    if (loop->sqes == MAP_FAILED) {
+        loop->sqes = NULL;
+    }
+    if (!loop->ring || !loop->sqes) {
+        perror("io_uring mmap failed");
+        uring_teardown(loop);
+        return -1;
+    }
+
+    loop->sq_head = (unsigned *)(ring + params.sq_off.head);
+    loop->sq_tail = (unsigned *)(ring + params.sq_off.tail);
+    loop->sq_mask = *(unsigned *)(ring + params.sq_off.ring_mask);
+    loop->sq_entries = params.sq_entries;
+    loop->sq_local_tail = *loop->sq_tail;
+    loop->sq_unsubmitted = 0;
+    unsigned *sq_array = (unsigned *)(ring + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        sq_array[i] = i;  // SQEs are always used in ring order
+    }
+
+    loop->cq_head = (unsigned *)(ring + params.cq_off.head);
+    loop->cq_tail = (unsigned *)(ring + params.cq_off.tail);
+    loop->cq_mask = *(unsigned *)(ring + params.cq_off.ring_mask);
+    loop->cqes = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+
+    loop->buf_ring_size = URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    loop->buf_ring = mmap(NULL, loop->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (loop->buf_ring == MAP_FAILED) {
+        loop->buf_ring = NULL;
+    }
+    loop->buffers = malloc((size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+    if (!loop->buf_ring || !loop->buffers) {
+        fprintf(stderr, "io_uring: failed to allocate receive buffers\n");
+        uring_teardown(loop);
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)loop->buf_ring;
+    reg.ring_entries = URING_BUFFER_COUNT;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, loop->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("io_uring: provided buffer ring registration failed");
+        uring_teardown(loop);
+        return -1;
+    }
+
+    loop->buf_tail = 0;
+    for (unsigned short bid = 0; bid < URING_BUFFER_COUNT; bid++) {
+        uring_recycle_buffer(loop, bid);
+    }
+    return 0;
+}
+
+// One ring per event loop thread. Each ring owns a SO_REUSEPORT listener
+// with a multishot accept; the first reuses the server's own socket.
+void launch_uring(struct Server *server) {
+    int count = server_config.event_loops;
+    UringLoop *loops = calloc(count, sizeof(UringLoop));
+    if (!loops) {
+        fprintf(stderr, "Error: Failed to allocate io_uring loops.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < count; i++) {
+        loops[i].ring_fd = -1;
+        if (uring_setup(&loops[i]) != 0) {
+            fprintf(stderr, "io_uring unavailable, falling back to epoll event loops.\n");
+            for (int j = 0; j < i; j++) {
+                uring_teardown(&loops[j]);
+            }
+            free(loops);
+            if (start_event_loops(count) != 0) {
+                exit(EXIT_FAILURE);
+            }
+            launch_event_loop(server);
+            return;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        int listen_socket = server->socket;
+        if (i > 0) {
+            struct Server listener = server_constructor(server->domain, server->service, server->protocol,
+                                                        server->interface, server->port, server->backlog,
+                                                        1, server->launch);
+            listen_socket = listener.socket;
+        }
+        loops[i].listen_socket = listen_socket;
+        loops[i].unix_socket = server->unix_socket;  // Every ring accepts from it
+
+        if (pthread_create(&loops[i].thread, NULL, uring_loop_thread, &loops[i]) != 0) {
+            perror("Failed to create io_uring thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("====WAITING FOR CONNECTIONS (%d io_uring loops)=====\n", count);
+    for (int i = 0; i < count; i++) {
+        pthread_join(loops[i].thread, NULL);
+    }
+}
@@ -0,0 +1,14 @@
+#ifndef URING_H
+#define URING_H
+
+#include "Server.h"
+
+#define URING_QUEUE_DEPTH 1024
+#define URING_BUFFER_COUNT 1024   // Provided receive buffers per ring
+#define URING_BUFFER_SIZE 16384
+
+// Run the io_uring backend. Falls back to the epoll loops when the kernel
+// does not support io_uring (or the features we rely on).
+void launch_uring(struct Server *server);
+
+#endif // URING_H
@@ -0,0 +1,130 @@
+#include "worker_pool.h"
+#include "connection.h"
+#include "../core/protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+static SocketQueue queue;
+static sem_t queued_sockets;     // Counts sockets waiting in the queue
+static ClientHandler client_handler = NULL;
+
+static int queue_init(SocketQueue *q, int depth) {
+    size_t capacity = 2;
+    while (capacity < (size_t)depth) {
+        capacity *= 2;
+    }
+
+    q->slots = malloc(capacity * sizeof(SocketQueueSlot));
+    if (!q->slots) {
+        return -1;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        q->slots[i].sequence = i;
+    }
+    q->mask = capacity - 1;
+    q->enqueue_pos = 0;
+    q->dequeue_pos = 0;
+    return 0;
+}
+
+// Returns -1 if the queue is full
+static int queue_push(SocketQueue *q, int client_socket) {
+    size_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    while (1) {
+        SocketQueueSlot *slot = &q->slots[pos & q->mask];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)(sequence - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->client_socket = client_socket;
+                __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Returns -1 if the queue is empty
+static int queue_pop(SocketQueue *q, int *client_socket) {
+    size_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+    while (1) {
+        SocketQueueSlot *slot = &q->slots[pos & q->mask];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)(sequence - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *client_socket = slot->client_socket;
+                __atomic_store_n(&slot->sequence, pos + q->mask + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void *worker_thread(void *arg) {
+    (void)arg;
+    set_reply_writer(connection_queue_reply);
+
+    while (1) {
+        if (sem_wait(&queued_sockets) != 0) {
+            continue;  // EINTR
+        }
+        // The semaphore guarantees a socket is queued for us, but its push
+        // may not be published yet
+        int client_socket;
+        while (queue_pop(&queue, &client_socket) != 0) {
+            sched_yield();
+        }
+        client_handler(client_socket);
+    }
+    return NULL;
+}
+
+// Start the workers. Returns 0 on success, -1 on error.
+int worker_pool_start(int workers, int queue_depth, ClientHandler handler) {
+    client_handler = handler;
+    if (queue_init(&queue, queue_depth) != 0) {
+        fprintf(stderr, "Error: Failed to allocate the worker queue.\n");
+        return -1;
+    }
+    if (sem_init(&queued_sockets, 0, 0) != 0) {
+        perror("sem_init");
+        return -1;
+    }
+
+    for (int i = 0; i < workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_thread, NULL) != 0) {
+            perror("Failed to create worker thread");
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+
+    printf("Started %d worker threads (queue depth %zu)\n", workers, queue.mask + 1);
+    return 0;
+}
+
+// Hand an accepted socket to the pool. Returns -1 when every worker is
+// busy and the queue is full; the caller still owns the socket then.
+int worker_pool_submit(int client_socket) {
+    if (queue_push(&queue, client_socket) != 0) {
+        return -1;
+    }
+    sem_post(&queued_sockets);
+    return 0;
+}
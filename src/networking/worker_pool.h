@@ -0,0 +1,30 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stddef.h>
+
+// Runs a blocking client handler on a fixed set of threads
+typedef void (*ClientHandler)(int client_socket);
+
+// Bounded multi-producer/multi-consumer queue of accepted sockets.
+// Each slot carries a sequence number telling producers and consumers
+// whose turn it is, so the fast path is a single CAS and no lock.
+typedef struct SocketQueueSlot {
+    size_t sequence;
+    int client_socket;
+} SocketQueueSlot;
+
+typedef struct SocketQueue {
+    SocketQueueSlot *slots;
+    size_t mask;              // Capacity - 1, capacity is a power of two
+    char pad0[64];
+    size_t enqueue_pos;       // Kept on separate cache lines
+    char pad1[64];
+    size_t dequeue_pos;
+    char pad2[64];
+} SocketQueue;
+
+int worker_pool_start(int workers, int queue_depth, ClientHandler handler);
+int worker_pool_submit(int client_socket);
+
+#endif // WORKER_POOL_H